@@ -1,25 +1,76 @@
 #include <arpa/inet.h>
+#include <pthread.h>
 
 #include "coding.h"
+#include "coding_helpers.h"
 #include "bitstream.h"
 #include "bitpacking.h"
+#include "stats.h"
+#include "probes.h"
+#include "rans.h"
+#include "coding_u32.h"
+#include "shuffle.h"
 
 #define DEFAULT_BLOCK_SIZE 16
 #define DEFAULT_BLOCK_SIZE_S 32
+#define DEFAULT_BLOCK_SIZE_ADAPTIVE 512
+#define DEFAULT_SPLIT_SIZE 8
+#define DEFAULT_BLOCK_SIZE_U32 128
+#define MAX_BLOCK_SIZE_U32 1024
+//estimated bits per width of a coded signal, for the split decision of adaptive frames
+#define SIGNAL_COST_CODED 2
 
 #define HEADER_SIZE 64
 
+#define HUGE_PAGE_SIZE (2*1024*1024)
+
+//large frame mode of bbp_decode(), see bbp_stream_params()
+static int stream_threshold = BBP_STREAM_THRESHOLD;
+static int prefetch_distance = BBP_PREFETCH_DISTANCE;
+
 #define MAGIC 325498741
+#define BATCH_MAGIC 325498742
+
+/*
+ * batches of bbp_code_batch(): a header laid out like a frame header with
+ * the parameters shared by all tiles (HP_OFFSET, HP_BLOCK_SIZES, HP_CHUNK),
+ * then a record per tile with the words that differ between frames, zero
+ * padded to BBP_ALIGNMENT, then the tiles, which are frames without their
+ * header. All words are big endian.
+ */
+#define BH_MAGIC 0 //BATCH_MAGIC
+#define BH_COUNT 1 //number of tiles
+#define BH_SIZE  2 //size of the batch
+#define BR_SIZE      0 //uncompressed size of the tile
+#define BR_SIZE_C    1 //size of the tile in the batch (the frame without the header)
+#define BR_MODES     2 //HP_MODES of the frame
+#define BR_B_SIZE_C  3 //HP_B_SIZE_C of the frame
+#define BATCH_RECORD_SIZE 16
+#define BATCH_TABLE_SIZE(COUNT) (HEADER_SIZE+RU_N(BATCH_RECORD_SIZE*(size_t)(COUNT), BBP_ALIGNMENT))
+#define BATCH_MAX_THREADS 64
 
 #define HP_MAGIC       0 //magic
 #define HP_SIZE        1 //uncompressed size == b.len
 #define HP_SIZE_C      2 //full compressed size (including header signals etc.)
-#define HP_MODES       3 //compression modes ->also determines positions for coder/decoder NOTE: high 16bit are unused atm.
+#define HP_MODES       3 //compression modes ->also determines positions for coder/decoder, high 16bit are MODE_* flags
 #define HP_OFFSET      4 //offset for b
 #define HP_BLOCK_SIZES 5 //offset for b
 #define HP_B_SIZE_C    6 //compressed size for first stage block data
+#define HP_SPLIT_SIZE   7 //adaptive frames: log2 of the split block size
+#define HP_SPLIT_SIZE_C 8 //adaptive frames: compressed size of the split blocks
+#define HP_PATCH_COUNT  9 //patched frames: number of exceptions
+#define HP_PATCH_SIZE   10 //patched frames: size of the exception stream, which is the (padded) end of the frame
+#define HP_U32_TRANSFORM 11 //32 bit frames: BBP_U32_D1 or BBP_U32_FOR
+#define HP_TYPED         12 //typed frames: element size + 256*transform + 65536*mask of the stored planes
+#define HP_CHUNK         13 //log2 of the inner chunk size, 0 for CHUNK_SIZE (frames before it was stored)
+
+#define MODE_RANS (1 << 16) //signal coded by rans_encode() behind the blocks, no second stage
+#define MODE_PATCHED (1 << 17) //blocks with exceptions, see patch_chunk()
+#define MODE_TYPED (1 << 18) //offset frame of plane rows, see shuffle.h and HP_TYPED
 
-static inline void header_write(uint8_t *buf, Block_Coder_Data *b, Block_Coder_Data *s, uint32_t input_size, uint32_t compressed_size)
+#define TYPED_STORE_MARGIN 8 //typed planes saving less than 1/8 are stored, unpacking them costs more than it saves
+
+static inline void header_write(uint8_t *buf, Block_Coder_Data *b, Block_Coder_Data *s, uint32_t input_size, uint32_t compressed_size, uint32_t flags)
 {
   int mode_b = 0, mode_s = 0;
   int bs = 0, bs_s = 0;
@@ -42,13 +93,15 @@ static inline void header_write(uint8_t *buf, Block_Coder_Data *b, Block_Coder_D
   header[HP_MAGIC] = htonl((uint32_t)MAGIC);
   header[HP_SIZE] = htonl((uint32_t)input_size);
   header[HP_SIZE_C] = htonl((uint32_t)compressed_size);
-  header[HP_MODES] = htonl((uint32_t)(mode_b+256*mode_s));
+  header[HP_MODES] = htonl((uint32_t)(mode_b+256*mode_s) | flags);
   header[HP_OFFSET] = htonl((uint32_t)b->offset);
   header[HP_BLOCK_SIZES] = htonl((uint32_t)(bs+bs_s*65536));
   header[HP_B_SIZE_C] = htonl((uint32_t)b->len_c);
+  header[HP_CHUNK] = htonl((uint32_t)(b->chunk ? __builtin_ctz(b->chunk) : 0));
 }
 
-void header_read(uint8_t *buf, Block_Coder_Data *b, Block_Coder_Data *s, uint32_t *size, uint32_t *size_c)
+//returns the MODE_* flags
+uint32_t header_read(uint8_t *buf, Block_Coder_Data *b, Block_Coder_Data *s, uint32_t *size, uint32_t *size_c)
 { 
   uint32_t *header = (uint32_t*)buf;
   
@@ -64,6 +117,150 @@ void header_read(uint8_t *buf, Block_Coder_Data *b, Block_Coder_Data *s, uint32_
   b->block_size = 1 << (ntohl(header[HP_BLOCK_SIZES]) & 0xFFFF);
   s->block_size = 1 << (ntohl(header[HP_BLOCK_SIZES])/65536);
   b->len_c = ntohl(header[HP_B_SIZE_C]);
+  b->chunk = s->chunk = header[HP_CHUNK] ? 1 << ntohl(header[HP_CHUNK]) : CHUNK_SIZE;
+  
+  return ntohl(header[HP_MODES]) & 0xFFFF0000;
+}
+
+static inline void header_write_split(uint8_t *buf, Block_Coder_Data *sb)
+{
+  uint32_t *header = (uint32_t*)buf;
+  
+  header[HP_SPLIT_SIZE] = htonl((uint32_t)__builtin_ctz(sb->block_size));
+  header[HP_SPLIT_SIZE_C] = htonl((uint32_t)sb->len_c);
+}
+
+static inline void header_write_patch(uint8_t *buf, int count, int size)
+{
+  uint32_t *header = (uint32_t*)buf;
+  
+  header[HP_PATCH_COUNT] = htonl((uint32_t)count);
+  header[HP_PATCH_SIZE] = htonl((uint32_t)size);
+}
+
+//returns the start of the exception stream, data is the frame behind the header
+static inline uint8_t *header_read_patch(uint8_t *buf, uint8_t *data, int *count)
+{
+  uint32_t *header = (uint32_t*)buf;
+  
+  *count = ntohl(header[HP_PATCH_COUNT]);
+  return data+ntohl(header[HP_SIZE_C])-HEADER_SIZE-RU_N(ntohl(header[HP_PATCH_SIZE]), BBP_ALIGNMENT);
+}
+
+static inline void header_write_u32(uint8_t *buf, int transform)
+{
+  uint32_t *header = (uint32_t*)buf;
+  
+  header[HP_U32_TRANSFORM] = htonl((uint32_t)transform);
+}
+
+static inline int header_read_u32(uint8_t *buf)
+{
+  uint32_t *header = (uint32_t*)buf;
+  
+  return ntohl(header[HP_U32_TRANSFORM]);
+}
+
+//typed frames: the frame was written as an offset frame of the stream of rows
+static inline void header_write_typed(uint8_t *buf, uint32_t size, uint32_t size_c, Typed_Rows *t)
+{
+  uint32_t *header = (uint32_t*)buf;
+  
+  header[HP_SIZE] = htonl(size);
+  header[HP_SIZE_C] = htonl(size_c);
+  header[HP_MODES] = htonl(ntohl(header[HP_MODES]) | MODE_TYPED);
+  header[HP_TYPED] = htonl((uint32_t)(t->elem_size+256*(t->xor ? BBP_TYPED_XOR : BBP_TYPED_SHUFFLE)+65536*t->stored));
+}
+
+//also sets the length of the stream of rows in b, data is the frame behind the header
+static inline void header_read_typed(uint8_t *buf, uint8_t *data, Block_Coder_Data *b, Typed_Rows *t)
+{
+  uint32_t *header = (uint32_t*)buf;
+  uint32_t typed = ntohl(header[HP_TYPED]);
+  int size = ntohl(header[HP_SIZE]);
+  int coded;
+  
+  memset(t, 0, sizeof(*t));
+  t->elem_size = typed & 0xFF;
+  t->xor = (typed/256 & 0xFF) == BBP_TYPED_XOR;
+  t->stored = typed/65536;
+  t->count = size/t->elem_size;
+  coded = t->elem_size-__builtin_popcount(t->stored);
+  t->row = b->offset/coded;
+  t->planes = data+ntohl(header[HP_SIZE_C])-HEADER_SIZE-RU_N((t->elem_size-coded)*t->count, BBP_ALIGNMENT);
+  b->len = coded*t->count+size%t->elem_size;
+  b->typed = t;
+}
+
+static inline void header_read_split(uint8_t *buf, Block_Coder_Data *sb)
+{
+  uint32_t *header = (uint32_t*)buf;
+  
+  sb->block_size = 1 << ntohl(header[HP_SPLIT_SIZE]);
+  sb->len_c = ntohl(header[HP_SPLIT_SIZE_C]);
+}
+
+//reads the attribute name of cache index of cpu0 (sysfs cacheinfo), returns 0 if it does not exist
+static int cache_attr(int index, const char *name, char *buf, int len)
+{
+  char path[96];
+  FILE *f;
+  int ok;
+  
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/%s", index, name);
+  f = fopen(path, "r");
+  if (!f)
+    return 0;
+  ok = fgets(buf, len, f) != NULL;
+  fclose(f);
+  
+  return ok;
+}
+
+//size in bytes of the data (or unified) cache of the level, 0 if unknown
+static int cache_size(int level)
+{
+  char buf[32];
+  int i, size;
+  
+  for(i=0;cache_attr(i, "level", buf, sizeof(buf));i++) {
+    if (atoi(buf) != level || !cache_attr(i, "type", buf, sizeof(buf)) || !strncmp(buf, "Instruction", 11))
+      continue;
+    if (!cache_attr(i, "size", buf, sizeof(buf)))
+      return 0;
+    size = atoi(buf);
+    if (strchr(buf, 'K'))
+      size *= 1024;
+    else if (strchr(buf, 'M'))
+      size *= 1024*1024;
+    return size;
+  }
+  
+  return 0;
+}
+
+/*
+ * a chunk passes through the diff, width and pack loops one after the other,
+ * so its input, diffs and packed output (about three chunks) plus the
+ * reference row should stay in L1: the largest power of 2 up to a quarter of
+ * L1d (on a 48KiB L1d 8KiB and 16KiB were equally fast, 32KiB and 64KiB up to
+ * 10% slower). Without L1 information L2/64, which is about the same ratio
+ * on current cores, without any CHUNK_SIZE.
+ */
+static int calibrate_inner_chunk(void)
+{
+  int size = cache_size(1)/4;
+  int chunk = MIN_INNER_CHUNK;
+  
+  if (!size)
+    size = cache_size(2)/64;
+  if (!size)
+    return CHUNK_SIZE;
+  
+  while (chunk < MAX_INNER_CHUNK && 2*chunk <= size)
+    chunk *= 2;
+  
+  return chunk;
 }
 
 void bbp_init(void)
@@ -77,10 +274,29 @@ void bbp_init(void)
   lut = get_wrap_lut();
   lut_inv = get_wrap_lut_inv();
   clz_lut = get_clz_lut();
+  bbp_stats_reset();
+  inner_chunk = calibrate_inner_chunk();
   
   inits_count++;
 }
 
+void bbp_stream_params(int threshold, int distance)
+{
+  assert(threshold >= 0 && distance >= 0);
+  
+  stream_threshold = threshold;
+  prefetch_distance = distance;
+}
+
+int bbp_inner_chunk(int size)
+{
+  assert(!size || (size >= MIN_INNER_CHUNK && size <= MAX_INNER_CHUNK && !(size & (size-1))));
+  
+  inner_chunk = size ? size : calibrate_inner_chunk();
+  
+  return inner_chunk;
+}
+
 void bbp_shutdown(void)
 {
   inits_count--;
@@ -93,22 +309,112 @@ void bbp_shutdown(void)
   free(clz_lut);
 }
 
-int bbp_code_offset(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int offset)
+//copy the frame uncompressed to data, which is usually right behind the header
+static int code_stored(uint8_t *in, uint8_t *header, uint8_t *data, int bs, int len, int offset)
 {
-  int recursive;
   Block_Coder_Data b;
-  Block_Coder_Data s;
+  int len_c = HEADER_SIZE+RU_N(len, BBP_ALIGNMENT);
+  
+  memset(&b, 0, sizeof(b));
+  b.block_size = bs;
+  b.coder = CODER_STORED;
+  b.offset = offset;
+  b.len_c = len;
+  
+  PROBE5(raw__copy, PROBE_DIR_ENCODE, len, len, bs, offset);
+  memcpy(data, in, len);
+  memset(data+len, 0, RU_N(len, BBP_ALIGNMENT)-len);
+  header_write(header, &b, NULL, len, len_c, 0);
+  
+  return len_c;
+}
+
+/*
+ * code count widths from signal to dst with the second stage (into s) if
+ * bs_r > 0, with rANS for BBP_BS_R_RANS or else uncompressed, returns the
+ * size (a multiple of BBP_ALIGNMENT) or -1 if it would pass end
+ */
+static int code_signal(Block_Coder_Data *b, Block_Coder_Data *s, uint8_t *signal, int count, uint8_t *dst, uint8_t *end, int bs_r)
+{
   int len_c;
+  
+  STATS_START(t)
+  PROBE4(stage__code__start, PROBE_STAGE_SIGNAL, count, bs_r, bs_r > 0 ? BBP_ALIGNMENT : 0);
+  
+  if (bs_r > 0) {
+    s->block_size = bs_r;
+    s->chunk = b->chunk;
+    s->len = count;
+    s->coder = CODER_OFFSET;
+    s->offset = BBP_ALIGNMENT;
+    s->signal_buf = dst;
+    s->block_buf = s->signal_buf + RU_N(offset_calc_signal_len(s), BBP_ALIGNMENT);
+    s->block_end = end;
+    
+    if (s->block_buf > end)
+      len_c = -1;
+    else {
+      memset(s->signal_buf+offset_calc_signal_len(s), 0, s->block_buf-s->signal_buf-offset_calc_signal_len(s));
+      code(s, signal, count);
+      len_c = s->len_c < 0 ? -1 : (int)(s->cur_block-dst);
+    }
+  }
+  else if (bs_r == BBP_BS_R_RANS)
+    len_c = rans_encode(signal, count, dst, end-dst);
+  else if (dst+RU_N(count, BBP_ALIGNMENT) > end)
+    len_c = -1;
+  else {
+    memcpy(dst, signal, count);
+    memset(dst+count, 0, RU_N(count, BBP_ALIGNMENT)-count);
+    len_c = RU_N(count, BBP_ALIGNMENT);
+  }
+  
+  PROBE5(stage__code__done, PROBE_STAGE_SIGNAL, count, len_c, bs_r, bs_r > 0 ? BBP_ALIGNMENT : 0);
+  STATS_LAP(b->stats, t, enc_second)
+#ifdef CALC_STATS
+  if (bs_r > 0 && len_c >= 0)
+    stats_hist(b->stats->hist_bits_signal, s->signal_buf, signal_len(s));
+#endif
+  
+  return len_c;
+}
+
+/*
+ * frames of bbp_code_offset(), with exceptions appended if patched, the
+ * signal goes to scratch (at least len/4 bytes) if given or else to a
+ * malloc()ed buffer. The header goes to header and the rest of the frame
+ * (at most RU_N(len, BBP_ALIGNMENT) bytes) to data, which is header+HEADER_SIZE
+ * except for the tiles of a batch. Returns the size including the header.
+ */
+static int code_offset_frame(uint8_t *in, uint8_t *header, uint8_t *data, int bs, int bs_r, int len, int offset, int patched, uint8_t *scratch)
+{
+  int recursive, rans;
+  int stored;
+  Block_Coder_Data b;
+  Block_Coder_Data s;
+  int len_c = 0;
   int b_s_len;
+  int patch_size = 0;
+  uint8_t *patch_buf = NULL;
+  uint8_t *end = data+RU_N(len, BBP_ALIGNMENT);
+#ifdef CALC_STATS
+  Bbp_Stats stats_b, stats_s;
+#endif
   
   memset(&b, 0, sizeof(b));
   memset(&s, 0, sizeof(b));
+#ifdef CALC_STATS
+  memset(&stats_b, 0, sizeof(stats_b));
+  memset(&stats_s, 0, sizeof(stats_s));
+  b.stats = &stats_b;
+  s.stats = &stats_s;
+#endif
      
   assert(len);
   assert(inits_count);
 #ifdef BBP_USE_SIMD
   assert(!((uintptr_t)in % BBP_ALIGNMENT));
-  assert(!((uintptr_t)out % BBP_ALIGNMENT));
+  assert(!((uintptr_t)data % BBP_ALIGNMENT));
 #endif
     
   if (!bs) bs = DEFAULT_BLOCK_SIZE;
@@ -119,6 +425,7 @@ int bbp_code_offset(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int of
       bs_r = DEFAULT_BLOCK_SIZE_S;
   }
   
+  rans = bs_r == BBP_BS_R_RANS;
   if (bs_r < 0)
     recursive = 0;
   else
@@ -126,52 +433,536 @@ int bbp_code_offset(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int of
 
   b.block_size = bs;
   b.len = len;
+  b.chunk = inner_chunk;
   b.coder = CODER_OFFSET;
   b.offset = offset;
   
   b_s_len = offset_calc_signal_len(&b);
   
-  if (recursive && b_s_len) {
-    b.signal_buf = malloc(len/bs);
-    b.block_buf = out + HEADER_SIZE;
+  PROBE4(code__start, len, bs, (recursive || rans) && b_s_len ? bs_r : -1, offset);
+  
+  //noise, encrypted or already compressed input is stored without coding it
+  stored = offset_sample_incompressible(&b, in, !recursive && !rans, 64);
+  
+  if (!stored) {
+    if ((recursive || rans) && b_s_len) {
+      b.signal_buf = scratch ? scratch : malloc(len/bs);
+      b.block_buf = data;
+    }
+    else {
+      b.signal_buf = data;
+      b.block_buf = b.signal_buf+RU_N(b_s_len, BBP_ALIGNMENT);
+      memset(b.signal_buf+b_s_len, 0, RU_N(b_s_len, BBP_ALIGNMENT)-b_s_len);
+    }
+    b.block_end = end;
+    if (patched) {
+      //less than block_size/2 exceptions per block, at most 6 bytes each
+      patch_buf = malloc(3*len+16);
+      assert(patch_buf);
+      b.patch = patch_buf;
+    }
+    
+    PROBE4(stage__code__start, PROBE_STAGE_BLOCKS, len, bs, offset);
+    code(&b, in, len);
+    PROBE5(stage__code__done, PROBE_STAGE_BLOCKS, len, b.len_c, bs, offset);
+    //the blocks alone did not fit, the signal would not either
+    stored = b.len_c < 0;
+  }
+  
+  if (!stored) {
+#ifdef CALC_STATS
+    stats_hist(stats_b.hist_bits, b.signal_buf, signal_len(&b));
+#endif
+    
+    //remove or commen out?
+    assert(b.cur_block_free_bits == 8);
+    assert((b.cur_block-data)%BBP_ALIGNMENT == 0);
+    assert(signal_len(&b) <= len/bs);
+    assert(signal_len(&b) == offset_calc_signal_len(&b));
+  }
+  
+  if (!stored && b_s_len && (recursive || rans)) {
+    len_c = code_signal(&b, &s, b.signal_buf, signal_len(&b), data+b.len_c, end, bs_r);
+    if (len_c < 0)
+      stored = 1;
+    else
+      len_c += HEADER_SIZE+b.len_c;
+  }
+  else if (!stored)
+    len_c = HEADER_SIZE+RU_N(b_s_len, BBP_ALIGNMENT)+b.len_c;
+  
+  if (b.signal_buf && (recursive || rans) && b_s_len && !scratch)
+    free(b.signal_buf);
+  
+  if (!stored && b.patch_count) {
+    patch_size = b.patch-patch_buf;
+    //len_c includes the header, which is not in front of data for batch tiles
+    if (data+len_c-HEADER_SIZE+RU_N(patch_size, BBP_ALIGNMENT) > end)
+      stored = 1;
+    else {
+      memcpy(data+len_c-HEADER_SIZE, patch_buf, patch_size);
+      memset(data+len_c-HEADER_SIZE+patch_size, 0, RU_N(patch_size, BBP_ALIGNMENT)-patch_size);
+      len_c += RU_N(patch_size, BBP_ALIGNMENT);
+    }
+  }
+  free(patch_buf);
+  
+  //coding did not pay off, a stored frame also decodes at memcpy speed
+  if (!stored && len_c >= HEADER_SIZE+RU_N(len, BBP_ALIGNMENT))
+    stored = 1;
+  
+  if (stored) {
+    STATS_START(t)
+    len_c = code_stored(in, header, data, bs, len, offset);
+    STATS_LAP(&stats_b, t, enc_copy)
   }
   else {
-    b.signal_buf = out+HEADER_SIZE;
-    b.block_buf = b.signal_buf+RU_N(b_s_len, BBP_ALIGNMENT);
+    if (b_s_len && recursive)
+      header_write(header, &b, &s, len, len_c, b.patch_count ? MODE_PATCHED : 0);
+    else
+      header_write(header, &b, NULL, len, len_c, (b_s_len && rans ? MODE_RANS : 0) | (b.patch_count ? MODE_PATCHED : 0));
+    if (b.patch_count)
+      header_write_patch(header, b.patch_count, patch_size);
+  }
+  
+  assert(len_c % 16 == 0);
+  assert(data+len_c-HEADER_SIZE <= end);
+  
+  PROBE5(code__done, len, len_c, bs, !stored && (recursive || rans) && b_s_len ? bs_r : -1, offset);
+  
+#ifdef CALC_STATS
+  stats_b.frames_coded = 1;
+  stats_b.bytes_in = len;
+  //batch tiles have no header of their own, their records in the batch table are not counted
+  stats_b.bytes_header = data == header+HEADER_SIZE ? HEADER_SIZE : 0;
+  stats_b.bytes_out = len_c-HEADER_SIZE+stats_b.bytes_header;
+  if (stored) {
+    //the blocks and widths of an abandoned attempt are not part of the output
+    stats_b.frames_stored = 1;
+    stats_b.bytes_raw = len_c-HEADER_SIZE;
+    stats_b.bytes_signal = 0;
+    stats_b.bytes_block = 0;
+    memset(stats_b.hist_bits, 0, sizeof(stats_b.hist_bits));
+    memset(stats_b.hist_bits_signal, 0, sizeof(stats_b.hist_bits_signal));
+  }
+  else {
+    stats_b.bytes_signal = len_c-HEADER_SIZE-b.len_c;
+    stats_b.bytes_block = b.len_c-stats_b.bytes_raw;
+    stats_b.patches = b.patch_count;
   }
+  stats_merge(&stats_b);
+#endif
+  
+  //printf("comp size: %d-%d\n", len_c, b.len_c);
+  //printf("enc positions: %d %d %d\n", b.block_buf-out, s.block_buf-out, s.signal_buf-out);
   
-  code(&b, in, len);
+  return len_c;
+}
+
+int bbp_code_offset(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int offset)
+{
+  return code_offset_frame(in, out, out+HEADER_SIZE, bs, bs_r, len, offset, 0, NULL);
+}
+
+int bbp_code_patched(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int offset)
+{
+  return code_offset_frame(in, out, out+HEADER_SIZE, bs, bs_r, len, offset, 1, NULL);
+}
+
+/*
+ * layout behind the header: split map (a bit per superblock, padded to
+ * BBP_ALIGNMENT), superblocks with raw head and tail (b), split blocks (sb),
+ * signal coded by code_signal()
+ */
+int bbp_code_adaptive(uint8_t *in, uint8_t *out, int bs, int bs_split, int bs_r, int len, int offset)
+{
+  int stored;
+  Block_Coder_Data b;
+  Block_Coder_Data sb;
+  Block_Coder_Data s;
+  int len_c = 0;
+  int super, map_len, b_s_len = 0;
+  uint8_t *split_map = out+HEADER_SIZE;
+  uint8_t *end = out+bbp_max_compressed_size(len);
+  void *split_buf = NULL;
+#ifdef CALC_STATS
+  Bbp_Stats stats_b, stats_s;
+#endif
   
-  //remove or commen out?
-  assert(b.cur_block_free_bits == 8);
-  assert((b.cur_block-out)%BBP_ALIGNMENT == 0);
-  assert(signal_len(&b) <= len/bs);
-  assert(signal_len(&b) == offset_calc_signal_len(&b));
+  memset(&b, 0, sizeof(b));
+  memset(&sb, 0, sizeof(sb));
+  memset(&s, 0, sizeof(s));
+#ifdef CALC_STATS
+  memset(&stats_b, 0, sizeof(stats_b));
+  memset(&stats_s, 0, sizeof(stats_s));
+  b.stats = &stats_b;
+  sb.stats = &stats_b;
+  s.stats = &stats_s;
+#endif
   
-  if (b_s_len && recursive) {
-    s.block_size = bs_r;
-    s.len = signal_len(&b);
-    s.coder = CODER_OFFSET;
-    s.offset = BBP_ALIGNMENT;
-    s.signal_buf = out+HEADER_SIZE+b.len_c;
-    s.block_buf = s.signal_buf + RU_N(offset_calc_signal_len(&s), BBP_ALIGNMENT);
+  assert(len);
+  assert(inits_count);
+#ifdef BBP_USE_SIMD
+  assert(!((uintptr_t)in % BBP_ALIGNMENT));
+  assert(!((uintptr_t)out % BBP_ALIGNMENT));
+#endif
+  
+  if (!bs) bs = DEFAULT_BLOCK_SIZE_ADAPTIVE;
+  if (!bs_split) bs_split = DEFAULT_SPLIT_SIZE;
+  if (!bs_r) bs_r = DEFAULT_BLOCK_SIZE_S;
+  assert(bs_split >= 4 && bs_split*4 <= bs && bs <= BBP_MAX_BLOCK_SIZE);
+  
+  b.block_size = bs;
+  b.len = len;
+  b.chunk = inner_chunk;
+  b.coder = CODER_ADAPTIVE;
+  b.offset = offset;
+  sb.block_size = bs_split;
+  
+  super = offset_calc_signal_len(&b);
+  map_len = RU_N((super+7)/8, BBP_ALIGNMENT);
+  
+  PROBE4(code__start, len, bs, bs_r, offset);
+  
+  stored = offset_sample_incompressible(&b, in, bs_r == -1, 64) || split_map+map_len > end;
+  
+  if (!stored) {
+    memset(split_map, 0, map_len);
+    //the split blocks are collected separately and moved behind the superblocks, they never exceed the input
+    b.signal_buf = malloc(super*(bs/bs_split)+1);
+    if (posix_memalign(&split_buf, BBP_ALIGNMENT, RU_N(len+bs_split, BBP_ALIGNMENT)))
+      abort();
+    assert(b.signal_buf);
+    b.block_buf = split_map+map_len;
+    b.block_end = end;
+    sb.block_buf = split_buf;
+    sb.block_end = sb.block_buf+RU_N(len+bs_split, BBP_ALIGNMENT);
     
-    code(&s, b.signal_buf, signal_len(&b));
-    free(b.signal_buf);
+    PROBE4(stage__code__start, PROBE_STAGE_BLOCKS, len, bs, offset);
+    code_adaptive(&b, &sb, split_map, in, len, bs_r == -1 ? 8 : SIGNAL_COST_CODED);
+    PROBE5(stage__code__done, PROBE_STAGE_BLOCKS, len, b.len_c < 0 ? -1 : b.len_c+sb.len_c, bs, offset);
+    stored = b.len_c < 0 || b.block_buf+b.len_c+sb.len_c > end;
+  }
+  
+  if (!stored) {
+    assert(sb.cur_block <= sb.block_end);
+    memcpy(b.block_buf+b.len_c, sb.block_buf, sb.len_c);
+    b_s_len = signal_len(&b);
+    assert(b_s_len == adaptive_calc_signal_len(&b, &sb, split_map));
+#ifdef CALC_STATS
+    stats_hist(stats_b.hist_bits, b.signal_buf, b_s_len);
+#endif
     
-    len_c = s.cur_block-out;
-    header_write(out, &b, &s, len, len_c);
+    len_c = b_s_len ? code_signal(&b, &s, b.signal_buf, b_s_len, b.block_buf+b.len_c+sb.len_c, end, bs_r) : 0;
+    if (len_c < 0)
+      stored = 1;
+    else
+      len_c += b.block_buf+b.len_c+sb.len_c-out;
+  }
+  
+  free(b.signal_buf);
+  free(split_buf);
+  
+  if (!stored && len_c >= HEADER_SIZE+RU_N(len, BBP_ALIGNMENT))
+    stored = 1;
+  
+  if (stored) {
+    STATS_START(t)
+    len_c = code_stored(in, out, out+HEADER_SIZE, bs, len, offset);
+    STATS_LAP(&stats_b, t, enc_copy)
   }
   else {
-    len_c = HEADER_SIZE+RU_N(b_s_len, BBP_ALIGNMENT)+b.len_c;
-    header_write(out, &b, NULL, len, len_c);
+    header_write(out, &b, bs_r > 0 && b_s_len ? &s : NULL, len, len_c, bs_r == BBP_BS_R_RANS && b_s_len ? MODE_RANS : 0);
+    header_write_split(out, &sb);
   }
   
+  assert(len_c % BBP_ALIGNMENT == 0);
+  assert(out+len_c <= end);
   
-  assert(len_c % 16 == 0);
+  PROBE5(code__done, len, len_c, bs, !stored && b_s_len ? bs_r : -1, offset);
   
-  //printf("comp size: %d-%d\n", len_c, b.len_c);
-  //printf("enc positions: %d %d %d\n", b.block_buf-out, s.block_buf-out, s.signal_buf-out);
+#ifdef CALC_STATS
+  stats_b.frames_coded = 1;
+  stats_b.bytes_in = len;
+  stats_b.bytes_out = len_c;
+  stats_b.bytes_header = HEADER_SIZE;
+  if (stored) {
+    stats_b.frames_stored = 1;
+    stats_b.bytes_raw = len_c-HEADER_SIZE;
+    stats_b.bytes_signal = 0;
+    stats_b.bytes_block = 0;
+    stats_b.blocks_adaptive = 0;
+    stats_b.blocks_split = 0;
+    memset(stats_b.hist_bits, 0, sizeof(stats_b.hist_bits));
+    memset(stats_b.hist_bits_signal, 0, sizeof(stats_b.hist_bits_signal));
+  }
+  else {
+    //the split map is counted as signal
+    stats_b.bytes_signal = len_c-HEADER_SIZE-b.len_c-sb.len_c;
+    stats_b.bytes_block = b.len_c+sb.len_c-stats_b.bytes_raw;
+  }
+  stats_merge(&stats_b);
+#endif
+  
+  return len_c;
+}
+
+typedef struct {
+  int bs, bs_r; //bs 0 stores without coding
+} Level_Preset;
+
+//ordered by ratio on image data, see the table in bbp.h
+static const Level_Preset level_presets[BBP_LEVEL_MAX+1] = {
+  {0, 0},
+  {1024, -1},
+  {128, -1},
+  {64, -1},
+  {32, 32},
+  {16, BBP_BS_R_RANS},
+  {8, BBP_BS_R_RANS},
+  {4, BBP_BS_R_RANS}
+};
+
+int bbp_level_params(int level, int *bs, int *bs_r)
+{
+  assert(level >= BBP_LEVEL_MIN && level <= BBP_LEVEL_MAX);
+  
+  *bs = level_presets[level].bs;
+  *bs_r = level_presets[level].bs_r;
+  
+  return *bs != 0;
+}
+
+int bbp_code_level(uint8_t *in, uint8_t *out, int len, int offset, int level)
+{
+  int bs, bs_r;
+  int len_c;
+#ifdef CALC_STATS
+  Bbp_Stats stats;
+#endif
+  
+  if (bbp_level_params(level, &bs, &bs_r))
+    return bbp_code_offset(in, out, bs, bs_r, len, offset);
+  
+  assert(len);
+  assert(inits_count);
+  
+  PROBE4(code__start, len, DEFAULT_BLOCK_SIZE, -1, offset);
+  STATS_START(t)
+  len_c = code_stored(in, out, out+HEADER_SIZE, DEFAULT_BLOCK_SIZE, len, offset);
+  PROBE5(code__done, len, len_c, DEFAULT_BLOCK_SIZE, -1, offset);
+  
+#ifdef CALC_STATS
+  memset(&stats, 0, sizeof(stats));
+  STATS_LAP(&stats, t, enc_copy)
+  stats.frames_coded = 1;
+  stats.frames_stored = 1;
+  stats.bytes_in = len;
+  stats.bytes_out = len_c;
+  stats.bytes_header = HEADER_SIZE;
+  stats.bytes_raw = len_c-HEADER_SIZE;
+  stats_merge(&stats);
+#endif
+  
+  return len_c;
+}
+
+/*
+ * layout behind the header: block minima of BBP_U32_FOR (padded to
+ * BBP_ALIGNMENT), packed blocks with the raw tail values, signal (raw or coded)
+ */
+int bbp_code_u32(uint32_t *in, uint8_t *out, int bs, int bs_r, int count, int transform)
+{
+  int stored = 0;
+  int len = 4*count;
+  int blocks, refs_len, s_len_c = 0;
+  int len_c = 0;
+  Block_Coder_Data b;
+  Block_Coder_Data s;
+  uint8_t *end = out+bbp_max_compressed_size(len);
+#ifdef CALC_STATS
+  Bbp_Stats stats_b, stats_s;
+#endif
+  
+  memset(&b, 0, sizeof(b));
+  memset(&s, 0, sizeof(s));
+#ifdef CALC_STATS
+  memset(&stats_b, 0, sizeof(stats_b));
+  memset(&stats_s, 0, sizeof(stats_s));
+  b.stats = &stats_b;
+  s.stats = &stats_s;
+#endif
+  
+  assert(count);
+  assert(inits_count);
+  assert(transform == BBP_U32_D1 || transform == BBP_U32_FOR);
+#ifdef BBP_USE_SIMD
+  assert(!((uintptr_t)in % BBP_ALIGNMENT));
+  assert(!((uintptr_t)out % BBP_ALIGNMENT));
+#endif
+  
+  if (!bs) bs = DEFAULT_BLOCK_SIZE_U32;
+  //widths 0-32 are more symbols than the rANS model has
+  if (!bs_r || bs_r == BBP_BS_R_RANS) bs_r = DEFAULT_BLOCK_SIZE_S;
+  assert(bs >= 4 && bs <= MAX_BLOCK_SIZE_U32 && !(bs & (bs-1)));
+  
+  b.block_size = bs;
+  b.len = len;
+  b.chunk = inner_chunk;
+  b.coder = CODER_U32;
+  blocks = count/bs;
+  refs_len = transform == BBP_U32_FOR ? RU_N(4*blocks, BBP_ALIGNMENT) : 0;
+  
+  PROBE4(code__start, len, bs, blocks ? bs_r : -1, 0);
+  
+  if (out+HEADER_SIZE+refs_len > end)
+    stored = 1;
+  else {
+    b.signal_buf = malloc(blocks+1);
+    assert(b.signal_buf);
+    b.block_buf = out+HEADER_SIZE+refs_len;
+    b.block_end = end;
+    memset(out+HEADER_SIZE+4*blocks, 0, refs_len ? refs_len-4*blocks : 0);
+    
+    STATS_START(t)
+    PROBE4(stage__code__start, PROBE_STAGE_BLOCKS, len, bs, 0);
+    code_u32(&b, in, (uint32_t*)(out+HEADER_SIZE), count, transform);
+    PROBE5(stage__code__done, PROBE_STAGE_BLOCKS, len, b.len_c, bs, 0);
+    STATS_LAP(&stats_b, t, enc_pack)
+    stored = b.len_c < 0;
+    
+    if (!stored && blocks) {
+      s_len_c = code_signal(&b, &s, b.signal_buf, blocks, b.block_buf+b.len_c, end, bs_r);
+      stored = s_len_c < 0;
+    }
+    len_c = HEADER_SIZE+refs_len+b.len_c+s_len_c;
+    free(b.signal_buf);
+  }
+  
+  if (!stored && len_c >= HEADER_SIZE+RU_N(len, BBP_ALIGNMENT))
+    stored = 1;
+  
+  if (stored) {
+    STATS_START(t)
+    len_c = code_stored((uint8_t*)in, out, out+HEADER_SIZE, bs, len, 0);
+    STATS_LAP(&stats_b, t, enc_copy)
+  }
+  else {
+    header_write(out, &b, blocks && bs_r > 0 ? &s : NULL, len, len_c, 0);
+    header_write_u32(out, transform);
+  }
+  
+  PROBE5(code__done, len, len_c, bs, !stored && blocks ? bs_r : -1, 0);
+  
+#ifdef CALC_STATS
+  stats_b.frames_coded = 1;
+  stats_b.bytes_in = len;
+  stats_b.bytes_out = len_c;
+  stats_b.bytes_header = HEADER_SIZE;
+  if (stored) {
+    stats_b.frames_stored = 1;
+    stats_b.bytes_raw = len_c-HEADER_SIZE;
+  }
+  else {
+    stats_b.bytes_signal = refs_len+s_len_c;
+    stats_b.bytes_raw = RU_N(4*(count%bs), BBP_ALIGNMENT);
+    stats_b.bytes_block = b.len_c-stats_b.bytes_raw;
+  }
+  stats_merge(&stats_b);
+#endif
+  
+  return len_c;
+}
+
+/*
+ * an offset frame of the rows of the coded planes (see shuffle.h), with the
+ * bytes behind the last element at the end of the stream, followed by the
+ * stored planes (padded to BBP_ALIGNMENT), a stored frame holds the input
+ */
+int bbp_code_typed(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int offset, int elem_size, int transform)
+{
+  int n, p, pos, first, window, whole, stride;
+  int coded, stream_len, stored_len, len_c;
+  uint32_t size, size_c;
+  void *rows = NULL;
+  uint8_t *planes;
+  Typed_Rows t;
+  Block_Coder_Data b, s;
+#ifdef CALC_STATS
+  Bbp_Stats stats;
+#endif
+  
+  assert(len);
+  assert(inits_count);
+  assert(elem_size == 2 || elem_size == 4 || elem_size == 8);
+  assert(transform == BBP_TYPED_SHUFFLE || transform == BBP_TYPED_XOR);
+  
+  if (!bs) bs = DEFAULT_BLOCK_SIZE;
+  
+  memset(&t, 0, sizeof(t));
+  t.elem_size = elem_size;
+  t.xor = transform == BBP_TYPED_XOR;
+  t.count = len/elem_size;
+  t.row = offset/elem_size < BBP_ALIGNMENT ? BBP_ALIGNMENT : offset/elem_size;
+  if (!t.count)
+    return code_stored(in, out, out+HEADER_SIZE, bs, len, offset);
+  
+  /*
+   * the rows and behind them the planes for sampling, aligned for the diff
+   * kernels, noise planes are stored, which also decodes at copy speed
+   */
+  stride = RU_N(t.count, BBP_ALIGNMENT);
+  if (posix_memalign(&rows, BBP_ALIGNMENT, RU_N(len, BBP_ALIGNMENT)+elem_size*stride))
+    return code_stored(in, out, out+HEADER_SIZE, bs, len, offset);
+  planes = (uint8_t*)rows+RU_N(len, BBP_ALIGNMENT);
+  memset(&b, 0, sizeof(b));
+  b.block_size = bs;
+  b.len = t.count;
+  b.offset = t.row;
+  //frames too small to be sampled are estimated on whole planes, which then give the rows
+  whole = offset_sample_window(&b, 0, &window) < 0;
+  if (whole)
+    shuffle_planes(in, &t, planes, stride, 0, t.count);
+  for(n=0;n<OFFSET_SAMPLE_COUNT && (pos = offset_sample_window(&b, n, &window)) >= 0;n++) {
+    first = (pos-t.row)/16*16;
+    shuffle_planes(in, &t, planes, stride, first, pos+window-first);
+  }
+  for(p=0;p<elem_size;p++)
+    if (offset_estimate_incompressible(&b, planes+p*stride, bs_r == -1 || (!bs_r && bs >= 128), TYPED_STORE_MARGIN))
+      t.stored |= 1 << p;
+  coded = elem_size-__builtin_popcount(t.stored);
+  
+  if (!coded) {
+    free(rows);
+    return code_stored(in, out, out+HEADER_SIZE, bs, len, offset);
+  }
+  
+  //the stream (rows and tail) and behind it the stored planes
+  stream_len = coded*t.count+len%elem_size;
+  t.planes = (uint8_t*)rows+stream_len;
+  if (whole)
+    planes_to_rows(planes, stride, rows, &t);
+  else
+    shuffle_rows(in, rows, &t);
+  memcpy((uint8_t*)rows+coded*t.count, in+t.count*elem_size, len%elem_size);
+  len_c = code_offset_frame(rows, out, out+HEADER_SIZE, bs, bs_r, stream_len, coded*t.row, 0, NULL);
+  
+  header_read(out, &b, &s, &size, &size_c);
+  stored_len = RU_N(len-stream_len, BBP_ALIGNMENT);
+  if (b.coder == CODER_STORED || len_c+stored_len >= HEADER_SIZE+RU_N(len, BBP_ALIGNMENT))
+    len_c = code_stored(in, out, out+HEADER_SIZE, bs, len, offset);
+  else {
+    memcpy(out+len_c, t.planes, len-stream_len);
+    memset(out+len_c+len-stream_len, 0, stored_len-(len-stream_len));
+    len_c += stored_len;
+    header_write_typed(out, len, len_c, &t);
+#ifdef CALC_STATS
+    memset(&stats, 0, sizeof(stats));
+    stats.bytes_in = stats.bytes_out = stats.bytes_raw = stored_len;
+    stats_merge(&stats);
+#endif
+  }
+  free(rows);
   
   return len_c;
 }
@@ -182,61 +973,494 @@ void bbp_header_sizes(uint8_t *buf, uint32_t *size, uint32_t *size_c)
   header_read(buf, &b, &s, size, size_c);
 }
 
-int bbp_decode(uint8_t *in, uint8_t *out)
+/*
+ * decode count widths coded by code_signal() with rANS or the second stage
+ * (s, from the header) at src into signal, or a malloc()ed buffer if NULL
+ */
+static uint8_t *decode_signal(Block_Coder_Data *b, Block_Coder_Data *s, uint8_t *src, int count, int size_c, int rans, uint8_t *signal)
 {
-  int b_s_len;
-  uint32_t size, size_c;
+  if (!signal)
+    signal = malloc(count);
+  assert(signal);
+  STATS_START(t)
+  
+  if (rans) {
+    PROBE4(stage__decode__start, PROBE_STAGE_SIGNAL, count, BBP_BS_R_RANS, 0);
+    rans_decode(src, signal, count);
+    PROBE5(stage__decode__done, PROBE_STAGE_SIGNAL, count, size_c, BBP_BS_R_RANS, 0);
+  }
+  else {
+    s->len = count;
+    s->signal_buf = src;
+    s->data_buf = signal;
+    //offset_calc_signal_len needs offset, block_size and len which are now known
+    s->block_buf = s->signal_buf + RU_N(offset_calc_signal_len(s), BBP_ALIGNMENT);
+    PROBE4(stage__decode__start, PROBE_STAGE_SIGNAL, s->len, s->block_size, s->offset);
+    decode(s);
+    PROBE5(stage__decode__done, PROBE_STAGE_SIGNAL, s->len, (int)(s->cur_block-s->signal_buf), s->block_size, s->offset);
+  }
+  STATS_LAP(b->stats, t, dec_second)
+  
+  return signal;
+}
+
+static int decode_u32_frame(uint8_t *in, uint8_t *out, Block_Coder_Data *b, Block_Coder_Data *s, uint32_t size, uint32_t size_c)
+{
+  int transform = header_read_u32(in);
+  int count = size/4;
+  int blocks = count/b->block_size;
+  int refs_len = transform == BBP_U32_FOR ? RU_N(4*blocks, BBP_ALIGNMENT) : 0;
+  int signal_coded = blocks && s->coder != CODER_NONE;
+  uint8_t *signal_src;
+  
+  b->block_buf = in+HEADER_SIZE+refs_len;
+  signal_src = b->block_buf+b->len_c;
+  PROBE5(decode__start, size, size_c, b->block_size, signal_coded ? s->block_size : -1, 0);
+  
+  if (signal_coded)
+    b->signal_buf = decode_signal(b, s, signal_src, blocks, in+size_c-signal_src, 0, NULL);
+  else
+    b->signal_buf = signal_src;
+  
+  STATS_START(t)
+  PROBE4(stage__decode__start, PROBE_STAGE_BLOCKS, size, b->block_size, 0);
+  decode_u32(b, (uint32_t*)(in+HEADER_SIZE), (uint32_t*)out, count, transform);
+  PROBE5(stage__decode__done, PROBE_STAGE_BLOCKS, size, b->len_c, b->block_size, 0);
+  STATS_LAP(b->stats, t, dec_unpack)
+  PROBE5(decode__done, size, size_c, b->block_size, signal_coded ? s->block_size : -1, 0);
+  
+  if (signal_coded)
+    free(b->signal_buf);
+  
+  return size;
+}
+
+/*
+ * frames of bbp_decode(), a coded signal is decoded to scratch (at least
+ * size/4 bytes) if given. The frame follows its header in data, which is
+ * in+HEADER_SIZE except for the tiles of a batch (offset coded or stored).
+ */
+static int decode_frame(uint8_t *in, uint8_t *data, uint8_t *out, uint8_t *scratch)
+{
+  int b_s_len, bs_r;
+  int signal_coded;
+  uint32_t size, size_c, flags;
   Block_Coder_Data b;
+  Block_Coder_Data sb;
   Block_Coder_Data s;
+  uint8_t *split_map = NULL;
+  uint8_t *signal_src;
+  uint8_t *patch;
+  int patch_count;
+  Typed_Rows typed;
+#ifdef CALC_STATS
+  Bbp_Stats stats_b, stats_s;
+#endif
+  
+  memset(&b, 0, sizeof(b));
+  memset(&sb, 0, sizeof(sb));
+  memset(&s, 0, sizeof(s));
+#ifdef CALC_STATS
+  memset(&stats_b, 0, sizeof(stats_b));
+  stats_b.frames_decoded = 1;
+  b.stats = &stats_b;
+  sb.stats = &stats_b;
+  s.stats = &stats_s;
+#endif
   
   assert(in);
   assert(out);
 #ifdef BBP_USE_SIMD
-  assert(!((uintptr_t)in % 16));
+  assert(!((uintptr_t)data % 16));
   assert(!((uintptr_t)out % 16));
 #endif
 
   //determines block_size(s), coder(s), offset(s), b->len_c and b->len
-  header_read(in, &b, &s, &size, &size_c);
+  flags = header_read(in, &b, &s, &size, &size_c);
   
-  b_s_len = offset_calc_signal_len(&b);
-  //printf("decode s len: %d\n", b_s_len);
-  if (b_s_len) {
-    s.len = offset_calc_signal_len(&b);
-    s.signal_buf = in+HEADER_SIZE+b.len_c;
-    s.data_buf = malloc(b_s_len); //for decoded signal of b
-    assert(s.data_buf);
-    //offset_calc_signal_len needs offset, block_size and len which are now known
-    s.block_buf = s.signal_buf + RU_N(offset_calc_signal_len(&s), BBP_ALIGNMENT);
+  b.stream = stream_threshold && size >= (uint32_t)stream_threshold;
+  b.prefetch = b.stream ? prefetch_distance : 0;
+  
+  if (b.coder == CODER_STORED) {
+    PROBE5(decode__start, size, size_c, b.block_size, -1, b.offset);
+    STATS_START(t)
+    PROBE5(raw__copy, PROBE_DIR_DECODE, size, size, b.block_size, b.offset);
+    if (b.stream)
+      _stream_copy(out, data, size);
+    else
+      memcpy(out, data, size);
+    STATS_LAP(&stats_b, t, dec_copy)
+    PROBE5(decode__done, size, size_c, b.block_size, -1, b.offset);
+#ifdef CALC_STATS
+    stats_merge(&stats_b);
+#endif
+    return size;
   }
   
-  b.signal_buf = s.data_buf;
-  b.block_buf = in + HEADER_SIZE;
-  b.data_buf = out;
+  //the stream of rows is shorter than the output if planes are stored
+  if (flags & MODE_TYPED)
+    header_read_typed(in, data, &b, &typed);
   
-  //printf("dec positions: %d %d %d\n", b.block_buf-in, s.block_buf-in, s.signal_buf-in);
+  if (b.coder == CODER_U32) {
+    decode_u32_frame(in, out, &b, &s, size, size_c);
+#ifdef CALC_STATS
+    stats_merge(&stats_b);
+#endif
+    return size;
+  }
   
-  if (b_s_len) {
-    //printf("decode signal len: %d\n", b_s_len);
-    decode(&s);        
-    /*int i;
-    for(i=0;i<b_s_len;i++)
-      printf("%d ", b.signal_buf[i]);
-    printf("\n");*/
+  if (b.coder == CODER_ADAPTIVE) {
+    header_read_split(in, &sb);
+    split_map = data;
+    b_s_len = adaptive_calc_signal_len(&b, &sb, split_map);
+    b.block_buf = split_map+RU_N((offset_calc_signal_len(&b)+7)/8, BBP_ALIGNMENT);
+    sb.block_buf = b.block_buf+b.len_c;
+    signal_src = sb.block_buf+sb.len_c;
+  }
+  else {
+    b_s_len = offset_calc_signal_len(&b);
+    b.block_buf = data;
+    signal_src = b.block_buf+b.len_c;
   }
-  //printf("decode block len: %d\n", b.len);
-  decode(&b);
   
-  assert(b.cur_data-b.data_buf == size);
+  if (flags & MODE_RANS)
+    bs_r = BBP_BS_R_RANS;
+  else
+    bs_r = b_s_len && s.coder != CODER_NONE ? s.block_size : -1;
+  PROBE5(decode__start, size, size_c, b.block_size, bs_r, b.offset);
+  
+  signal_coded = b_s_len && ((flags & MODE_RANS) || s.coder != CODER_NONE);
+  if (signal_coded)
+    b.signal_buf = decode_signal(&b, &s, signal_src, b_s_len, data+size_c-HEADER_SIZE-signal_src, flags & MODE_RANS, scratch);
+  else if (b_s_len && b.coder == CODER_ADAPTIVE)
+    //signal stored uncompressed behind the blocks
+    b.signal_buf = signal_src;
+  else if (b_s_len) {
+    //signal stored uncompressed in front of the blocks
+    b.signal_buf = data;
+    b.block_buf = b.signal_buf+RU_N(b_s_len, BBP_ALIGNMENT);
+  }
+  b.data_buf = out;
+  if (flags & MODE_PATCHED) {
+    patch = header_read_patch(in, data, &patch_count);
+    patch_decoder_init(&b, patch, patch_count);
+  }
   
-  if (b_s_len)
-    free(s.data_buf);
+  PROBE4(stage__decode__start, PROBE_STAGE_BLOCKS, size, b.block_size, b.offset);
+  if (b.coder == CODER_ADAPTIVE)
+    decode_adaptive(&b, &sb, split_map);
+  else
+    decode(&b);
+  PROBE5(stage__decode__done, PROBE_STAGE_BLOCKS, size, (int)(b.cur_block-b.block_buf), b.block_size, b.offset);
+  
+  assert(b.cur_data-b.data_buf == b.len);
+  PROBE5(decode__done, size, size_c, b.block_size, bs_r, b.offset);
+  
+  if (signal_coded && !scratch)
+    free(b.signal_buf);
+  
+#ifdef CALC_STATS
+  stats_merge(&stats_b);
+#endif
 
   return size;
 }
 
+int bbp_decode(uint8_t *in, uint8_t *out)
+{
+  return decode_frame(in, in+HEADER_SIZE, out, NULL);
+}
+
+
+int bbp_decode_u32(uint8_t *in, uint32_t *out)
+{
+  return bbp_decode(in, (uint8_t*)out)/4;
+}
 
 uint32_t bbp_max_compressed_size(uint32_t uncompressed)
 {
-  return uncompressed+uncompressed/4+64+64;
-}
\ No newline at end of file
+  return HEADER_SIZE+RU_N(uncompressed, BBP_ALIGNMENT);
+}
+
+//items of a batch coded or decoded by one thread, with one scratch buffer for the signal of all frames
+typedef struct {
+  Bbp_Batch_Item *items;
+  int count;
+  int first; //index of items[0] in the batch
+  uint8_t *batch;
+  uint8_t *out; //coding: where the tiles of the range go
+  size_t size; //coding: bytes written to out
+  uint32_t block_sizes; //coding: HP_BLOCK_SIZES of the frames, or-ed
+  int bs, bs_r, offset;
+} Batch_Range;
+
+static inline uint32_t *batch_record(uint8_t *batch, int i)
+{
+  return (uint32_t*)(batch+HEADER_SIZE+BATCH_RECORD_SIZE*(size_t)i);
+}
+
+//the full header of tile i, from the shared words of the batch header and the record
+static void batch_frame_header(uint8_t *batch, int i, uint8_t *buf)
+{
+  uint32_t *header = (uint32_t*)buf;
+  uint32_t *record = batch_record(batch, i);
+  uint32_t coder;
+  
+  memcpy(buf, batch, HEADER_SIZE);
+  header[HP_MAGIC] = htonl((uint32_t)MAGIC);
+  header[HP_SIZE] = record[BR_SIZE];
+  header[HP_SIZE_C] = htonl(ntohl(record[BR_SIZE_C])+HEADER_SIZE);
+  header[HP_MODES] = record[BR_MODES];
+  header[HP_B_SIZE_C] = record[BR_B_SIZE_C];
+  
+  coder = ntohl(header[HP_MODES]) & 0xFF;
+  assert(coder == CODER_OFFSET || coder == CODER_STORED);
+}
+
+static void *code_batch_range(void *data)
+{
+  Batch_Range *r = data;
+  int i, max_len = 0;
+  uint8_t *scratch;
+  uint32_t header_buf[HEADER_SIZE/4];
+  uint32_t *record;
+  
+  for(i=0;i<r->count;i++)
+    if (r->items[i].len > max_len)
+      max_len = r->items[i].len;
+  scratch = malloc(max_len/4+1);
+  assert(scratch);
+  
+  r->size = 0;
+  r->block_sizes = 0;
+  for(i=0;i<r->count;i++) {
+    r->items[i].out = r->out+r->size;
+    r->items[i].len_c = code_offset_frame(r->items[i].in, (uint8_t*)header_buf, r->items[i].out, r->bs, r->bs_r, r->items[i].len, r->offset, 0, scratch)-HEADER_SIZE;
+    r->size += r->items[i].len_c;
+    
+    //the block size of the signal is only set where the signal was coded with it, the rest is the same for all tiles
+    r->block_sizes |= header_buf[HP_BLOCK_SIZES];
+    record = batch_record(r->batch, r->first+i);
+    record[BR_SIZE] = header_buf[HP_SIZE];
+    record[BR_SIZE_C] = htonl((uint32_t)r->items[i].len_c);
+    record[BR_MODES] = header_buf[HP_MODES];
+    record[BR_B_SIZE_C] = header_buf[HP_B_SIZE_C];
+  }
+  
+  free(scratch);
+  return NULL;
+}
+
+static void *decode_batch_range(void *data)
+{
+  Batch_Range *r = data;
+  int i, max_len = 0;
+  uint8_t *scratch;
+  uint32_t header_buf[HEADER_SIZE/4];
+  
+  for(i=0;i<r->count;i++)
+    if (r->items[i].len > max_len)
+      max_len = r->items[i].len;
+  scratch = malloc(max_len/4+1);
+  assert(scratch);
+  
+  for(i=0;i<r->count;i++) {
+    batch_frame_header(r->batch, r->first+i, (uint8_t*)header_buf);
+    decode_frame((uint8_t*)header_buf, r->items[i].in, r->items[i].out, scratch);
+  }
+  
+  free(scratch);
+  return NULL;
+}
+
+//splits the items into up to threads ranges of about the same uncompressed size, returns the number of ranges
+static int batch_ranges(Bbp_Batch_Item *items, int count, int threads, uint8_t *batch, Batch_Range *ranges)
+{
+  int i, n = 0;
+  size_t total = 0, sum = 0;
+  
+  if (threads < 1)
+    threads = 1;
+  if (threads > BATCH_MAX_THREADS)
+    threads = BATCH_MAX_THREADS;
+  if (threads > count)
+    threads = count;
+  
+  for(i=0;i<count;i++)
+    total += items[i].len;
+  
+  memset(ranges, 0, threads*sizeof(Batch_Range));
+  ranges[0].items = items;
+  ranges[0].batch = batch;
+  for(i=0;i<count;i++) {
+    if (sum >= total*(n+1)/threads && ranges[n].count) {
+      n++;
+      ranges[n].items = items+i;
+      ranges[n].first = i;
+      ranges[n].batch = batch;
+    }
+    ranges[n].count++;
+    sum += items[i].len;
+  }
+  
+  return n+1;
+}
+
+//runs func for every range, the first one in the calling thread, and in it too where no thread could be started
+static void batch_run(Batch_Range *ranges, int n, void *(*func)(void *))
+{
+  int i;
+  pthread_t threads[BATCH_MAX_THREADS];
+  int started[BATCH_MAX_THREADS];
+  
+  for(i=1;i<n;i++)
+    started[i] = !pthread_create(&threads[i], NULL, func, &ranges[i]);
+  func(&ranges[0]);
+  for(i=1;i<n;i++)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      func(&ranges[i]);
+}
+
+size_t bbp_max_batch_size(int count, size_t len)
+{
+  return BATCH_TABLE_SIZE(count)+(size_t)count*(BBP_ALIGNMENT-1)+len;
+}
+
+size_t bbp_code_batch(Bbp_Batch_Item *items, int count, uint8_t *out, int bs, int bs_r, int offset, int threads)
+{
+  int i, j, n;
+  size_t len = 0;
+  uint8_t *pos, *dst;
+  uint32_t *header = (uint32_t*)out;
+  uint32_t block_sizes = 0;
+  Batch_Range ranges[BATCH_MAX_THREADS];
+  
+  assert(count > 0);
+  assert(!((uintptr_t)out % BBP_ALIGNMENT));
+  for(i=0;i<count;i++)
+    len += items[i].len;
+  //the sizes are 32 bit
+  assert(bbp_max_batch_size(count, len) <= UINT32_MAX);
+  
+  //the records are written by the ranges
+  memset(out, 0, BATCH_TABLE_SIZE(count));
+  
+  //every range codes from the worst case end of the ones before it, so they don't overlap
+  n = batch_ranges(items, count, threads, out, ranges);
+  pos = out+BATCH_TABLE_SIZE(count);
+  for(i=0;i<n;i++) {
+    ranges[i].out = pos;
+    ranges[i].bs = bs;
+    ranges[i].bs_r = bs_r;
+    ranges[i].offset = offset;
+    for(j=0;j<ranges[i].count;j++)
+      pos += RU_N((size_t)ranges[i].items[j].len, BBP_ALIGNMENT);
+  }
+  batch_run(ranges, n, code_batch_range);
+  
+  //and are then moved together, tiles only move towards the start
+  dst = out+BATCH_TABLE_SIZE(count);
+  for(i=0;i<n;i++) {
+    if (ranges[i].out != dst) {
+      memmove(dst, ranges[i].out, ranges[i].size);
+      for(j=0;j<ranges[i].count;j++)
+        ranges[i].items[j].out -= ranges[i].out-dst;
+    }
+    dst += ranges[i].size;
+    block_sizes |= ranges[i].block_sizes;
+  }
+  
+  header[BH_MAGIC] = htonl((uint32_t)BATCH_MAGIC);
+  header[BH_COUNT] = htonl((uint32_t)count);
+  header[BH_SIZE] = htonl((uint32_t)(dst-out));
+  header[HP_OFFSET] = htonl((uint32_t)offset);
+  header[HP_BLOCK_SIZES] = block_sizes;
+  header[HP_CHUNK] = htonl((uint32_t)__builtin_ctz(inner_chunk));
+  
+  return dst-out;
+}
+
+int bbp_batch_count(uint8_t *in)
+{
+  uint32_t *header = (uint32_t*)in;
+  
+  assert(header[BH_MAGIC] == htonl((uint32_t)BATCH_MAGIC));
+  return ntohl(header[BH_COUNT]);
+}
+
+int bbp_batch_items(uint8_t *in, Bbp_Batch_Item *items)
+{
+  int i, count = bbp_batch_count(in);
+  uint8_t *pos = in+BATCH_TABLE_SIZE(count);
+  uint32_t *record;
+  
+  for(i=0;i<count;i++) {
+    record = batch_record(in, i);
+    items[i].in = pos;
+    items[i].len = ntohl(record[BR_SIZE]);
+    items[i].len_c = ntohl(record[BR_SIZE_C]);
+    pos += items[i].len_c;
+  }
+  assert(pos == in+ntohl(((uint32_t*)in)[BH_SIZE]));
+  
+  return count;
+}
+
+int bbp_decode_batch_item(uint8_t *in, int index, Bbp_Batch_Item *item)
+{
+  uint32_t header_buf[HEADER_SIZE/4];
+  
+  assert(index >= 0 && index < bbp_batch_count(in));
+  batch_frame_header(in, index, (uint8_t*)header_buf);
+  
+  return decode_frame((uint8_t*)header_buf, item->in, item->out, NULL);
+}
+
+int bbp_decode_batch(uint8_t *in, Bbp_Batch_Item *items, int threads)
+{
+  int i, n, count;
+  uint8_t *pos;
+  Batch_Range ranges[BATCH_MAX_THREADS];
+  
+  count = bbp_batch_count(in);
+  pos = in+BATCH_TABLE_SIZE(count);
+  for(i=0;i<count;i++) {
+    assert(items[i].in == pos);
+    pos += ntohl(batch_record(in, i)[BR_SIZE_C]);
+  }
+  
+  n = batch_ranges(items, count, threads, in, ranges);
+  batch_run(ranges, n, decode_batch_range);
+  
+  return count;
+}
+
+void *bbp_alloc(size_t size)
+{
+  void *buf;
+  
+  size = RU_N(size, HUGE_PAGE_SIZE);
+  
+#ifdef MAP_HUGETLB
+  buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (buf != MAP_FAILED)
+    return buf;
+#endif
+  
+  buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED)
+    return NULL;
+#ifdef MADV_HUGEPAGE
+  madvise(buf, size, MADV_HUGEPAGE);
+#endif
+  
+  return buf;
+}
+
+void bbp_free(void *buf, size_t size)
+{
+  if (buf)
+    munmap(buf, RU_N(size, HUGE_PAGE_SIZE));
+}
@@ -2,11 +2,41 @@
 #define _BBP_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define BBP_MAX_BLOCK_SIZE 4096
 
 #define BBP_ALIGNMENT 32
 
+/** value for \p bs_r of bbp_code_offset(): code the signal with rANS instead of the second bitpacking stage,
+ * which gives the best ratio with small block sizes at a lower coding speed
+ */
+#define BBP_BS_R_RANS -2
+
+/** default size of the chunks a stream is split into by the bbp tool, each chunk is coded with bbp_code_offset() into one frame.
+ * Every frame costs a 64 byte header plus a raw copy of the first \p offset bytes, larger chunks amortize this better but need
+ * more memory per coding thread.
+ */
+#define BBP_DEFAULT_CHUNK_SIZE (64*1024)
+
+/** default frame size from which on bbp_decode() uses the large frame mode, see bbp_stream_params()
+ */
+#define BBP_STREAM_THRESHOLD (4*1024*1024)
+
+/** default prefetch distance in bytes of the large frame mode, off as the hardware prefetchers of current x86 cores
+ * already follow the sequential block stream
+ */
+#define BBP_PREFETCH_DISTANCE 0
+
+/** range of the inner chunk size, see bbp_inner_chunk()
+ */
+#define BBP_MIN_INNER_CHUNK BBP_MAX_BLOCK_SIZE
+#define BBP_MAX_INNER_CHUNK (64*1024)
+
 /** initialize bbp library (not threadsafe)
  */
 void bbp_init(void);
@@ -24,13 +54,113 @@ void bbp_shutdown(void);
 \param bs primary block size, must be a power of 2 between 4 and 512. Use 0 for the default of 16. In 
 general a smaller block size results in better compression at slower speed
 \param bs_r block size for the second compression step, must be a power of 2 between 4 and 512, or 0 for the default of 32.
-Impact is relativeley low as long as content is not very compressible.
+Impact is relativeley low as long as content is not very compressible. -1 stores the signal uncompressed (the default for \p bs >= 128),
+BBP_BS_R_RANS codes it with rANS.
 \param offset the coder calculates deltas from this offset, this should be the image width in bytes, or two times the image
 width for Bayer pattern data. Must be larger than 16, which is also a good default for unknown or not very compressible sources.
 \return size of the compressed data
  */
 int bbp_code_offset(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int offset);
 
+/** compress like bbp_code_offset(), but pack blocks with a few outliers at a lower bit width and store the outliers as exceptions
+ * 
+ * Patched frame of reference coding: a single large delta (a hot pixel, a star, an edge) otherwise sets the width of
+ * its whole block. Where it pays off the block is packed at a lower width and each delta which does not fit costs
+ * about two bytes (position and value) in an exception stream, which the decoder applies after unpacking. Frames
+ * without outliers come out the same as with bbp_code_offset() at a slightly lower coding speed.
+ * Parameters are the same as for bbp_code_offset(), the output is decoded with bbp_decode().
+\return size of the compressed data
+ */
+int bbp_code_patched(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int offset);
+
+/** compress like bbp_code_offset(), but with a block size that adapts to the content within the frame
+ * 
+ * The frame is coded in superblocks of \p bs bytes, each superblock is either coded as one block or, where this
+ * saves more bits than the additional widths in the signal cost, split into blocks of \p bs_split bytes. Flat or
+ * uniformly noisy regions so run at the speed of the large block size while edges and detail get the ratio of the
+ * small one. The split decisions cost one bit per superblock. The output is decoded with bbp_decode().
+\param bs superblock size, a power of 2 up to BBP_MAX_BLOCK_SIZE and at least 4 * \p bs_split, 0 for the default of 512
+\param bs_split block size of split superblocks, a power of 2 >= 4, 0 for the default of 8
+\param bs_r as for bbp_code_offset(), 0 for the default of 32, the signal is always coded behind the blocks
+\return size of the compressed data
+ */
+int bbp_code_adaptive(uint8_t *in, uint8_t *out, int bs, int bs_split, int bs_r, int len, int offset);
+
+#define BBP_LEVEL_MIN     0
+#define BBP_LEVEL_MAX     7
+#define BBP_LEVEL_DEFAULT 4
+
+/** compress like bbp_code_offset() with block sizes chosen by a level from BBP_LEVEL_MIN (fastest) to BBP_LEVEL_MAX (best ratio)
+ * 
+ * level  bs    bs_r            typical use
+ *   0    -     -               stored uncompressed, memcpy speed
+ *   1    1024  -1              fastest coding, low ratio
+ *   2    128   -1
+ *   3    64    -1
+ *   4    32    32              BBP_LEVEL_DEFAULT, balanced
+ *   5    16    BBP_BS_R_RANS
+ *   6    8     BBP_BS_R_RANS
+ *   7    4     BBP_BS_R_RANS   best ratio, about a tenth of the speed of level 1
+ * 
+ * Measured speeds and ratios are listed in the README. The output is decoded with bbp_decode() and is bounded by bbp_max_compressed_size().
+\param offset as for bbp_code_offset()
+\param level BBP_LEVEL_MIN to BBP_LEVEL_MAX
+\return size of the compressed data
+ */
+int bbp_code_level(uint8_t *in, uint8_t *out, int len, int offset, int level);
+
+/** get the block sizes used by bbp_code_level() for \p level
+\return 1, or 0 for level 0 which stores without coding
+ */
+int bbp_level_params(int level, int *bs, int *bs_r);
+
+
+#define BBP_U32_D1  0 //differences to the previous value, for sorted ids and timestamps
+#define BBP_U32_FOR 1 //differences to the minimum of each block (frame of reference), for unsorted values of a limited range
+
+/** compress \p count 32 bit integers from \p in to \p out
+ * 
+ * Byte deltas as of bbp_code_offset() break the carries between the bytes of wider integers, so this mode
+ * transforms whole 32 bit values, per block of \p bs values either to the difference to the previous value
+ * (BBP_U32_D1, wrapping, so unsorted input still round trips) or to the block minimum (BBP_U32_FOR, the
+ * minimum is stored with 4 bytes per block). Blocks are packed at their bit width (0-32) in 32 bit lanes,
+ * the widths are coded like the signal of bbp_code_offset(). The output is decoded with bbp_decode_u32()
+ * (or bbp_decode(), which yields the same bytes) and is bounded by bbp_max_compressed_size() of 4 * \p count.
+\param in input values, must be 16 byte aligned
+\param out output buffer, must be 16 byte aligned
+\param bs values per block, a power of 2 between 4 and 1024, 0 for the default of 128
+\param bs_r as for bbp_code_offset(), 0 for the default of 32; widths of up to 32 bits don't fit the rANS model,
+so BBP_BS_R_RANS also selects the default
+\param transform BBP_U32_D1 or BBP_U32_FOR
+\return size of the compressed data
+ */
+int bbp_code_u32(uint32_t *in, uint8_t *out, int bs, int bs_r, int count, int transform);
+
+/** decompress 32 bit integers coded by bbp_code_u32()
+\param out output buffer, must be 16 byte aligned and fit the uncompressed size from bbp_header_sizes()
+\return the number of decoded values
+ */
+int bbp_decode_u32(uint8_t *in, uint32_t *out);
+
+#define BBP_TYPED_SHUFFLE 0 //byte planes only, for integers
+#define BBP_TYPED_XOR     1 //xor with the previous element before splitting into planes, for floats
+
+/** compress \p len bytes of elements of \p elem_size bytes (16, 32 or 64 bit integers or floats)
+ * 
+ * Byte deltas of multi-byte elements mix the noisy low bytes with the smooth high bytes. This splits the
+ * elements into byte planes (all first bytes, all second bytes, ...), optionally after xoring each element with
+ * the previous one (BBP_TYPED_XOR), which zeroes sign, exponent and high mantissa bits of slowly changing floats.
+ * The planes are interleaved in rows and coded as one frame like bbp_code_offset(), so each byte is predicted from
+ * the same plane; planes which would barely compress (noise mantissa bytes) are stored instead. bbp_decode()
+ * restores the elements chunk by chunk while decoding, without a separate pass.
+\param bs, bs_r as for bbp_code_offset()
+\param offset distance in bytes as for bbp_code_offset(), a multiple of \p elem_size; the planes use
+\p offset / \p elem_size, at least BBP_ALIGNMENT
+\param elem_size 2, 4 or 8, bytes behind the last full element are stored raw
+\param transform BBP_TYPED_SHUFFLE or BBP_TYPED_XOR
+\return size of the compressed data, at most bbp_max_compressed_size()
+ */
+int bbp_code_typed(uint8_t *in, uint8_t *out, int bs, int bs_r, int len, int offset, int elem_size, int transform);
 
 /** decompress a block previously compressed using 
  * 
@@ -49,7 +179,144 @@ int bbp_decode(uint8_t *in, uint8_t *out);
 void bbp_header_sizes(uint8_t *buf, uint32_t *size, uint32_t *size_c);
 
 /** returns the maximum output size of bbp_code_offset() for a given input size
+ * 
+ * Input which does not compress is stored uncompressed, so this is the header plus the input size rounded up to the alignment.
  */
 uint32_t bbp_max_compressed_size(uint32_t uncompressed);
 
+/** one buffer of a batch, see bbp_code_batch() and bbp_decode_batch()
+ */
+typedef struct {
+  uint8_t *in; //coding: the input (BBP_ALIGNMENT aligned), decoding: the tile in the batch
+  uint8_t *out; //coding: the tile in the batch, decoding: where the buffer is decoded to (16 byte aligned)
+  int len; //uncompressed size
+  int len_c; //size of the tile in the batch
+} Bbp_Batch_Item;
+
+/** returns the maximum output size of bbp_code_batch() for \p count buffers of together \p len bytes
+ */
+size_t bbp_max_batch_size(int count, size_t len);
+
+/** compress many small buffers (e.g. image tiles) into one contiguous batch
+ * 
+ * Each buffer is coded as with bbp_code_offset(), but the batch has a single header with the parameters of all
+ * buffers, followed by a 16 byte record per buffer (sizes and modes) and then the tiles: the frames without their
+ * 64 byte header. A tile still starts with its raw prefix, so every buffer can be decoded on its own with
+ * bbp_decode_batch_item(). The signal buffer is allocated once per thread instead of once per frame. With
+ * \p threads > 1 the items are split into ranges of about the same size which are coded in parallel, the output is
+ * the same as with one thread.
+\param items \p in and \p len of each buffer, \p out and \p len_c are set to the tile in the batch
+\param count number of items, the batch must not exceed 4GiB
+\param out output buffer, must be BBP_ALIGNMENT aligned and fit bbp_max_batch_size() bytes
+\param bs, bs_r, offset as for bbp_code_offset(), for all buffers
+\param threads number of threads, 0 or 1 codes in the calling thread
+\return size of the batch
+ */
+size_t bbp_code_batch(Bbp_Batch_Item *items, int count, uint8_t *out, int bs, int bs_r, int offset, int threads);
+
+/** get the number of buffers in a batch of bbp_code_batch()
+ */
+int bbp_batch_count(uint8_t *in);
+
+/** fill \p in, \p len and \p len_c of bbp_batch_count() items from the records of the batch \p in
+\return the number of items
+ */
+int bbp_batch_items(uint8_t *in, Bbp_Batch_Item *items);
+
+/** decompress a single buffer of a batch
+\param in the batch, must be 16 byte aligned
+\param index index of the buffer in the batch
+\param item as filled by bbp_batch_items() for \p index, with \p out set to the output buffer
+\return the uncompressed size
+ */
+int bbp_decode_batch_item(uint8_t *in, int index, Bbp_Batch_Item *item);
+
+/** decompress a batch of bbp_code_batch()
+ * 
+ * Like bbp_code_batch() with one signal buffer per thread and the items split into ranges for \p threads.
+\param in the batch, must be 16 byte aligned
+\param items as filled by bbp_batch_items(), with \p out set to an output buffer for each item
+\param threads number of threads, 0 or 1 decodes in the calling thread
+\return the number of decoded items
+ */
+int bbp_decode_batch(uint8_t *in, Bbp_Batch_Item *items, int threads);
+
+/** tune the decoding of large frames (not threadsafe, call before decoding)
+ *
+ * Frames of at least \p threshold bytes are reconstructed chunk by chunk in a small cache resident window, which also
+ * holds the reference row (offset up to 8KiB), and written to the output with non-temporal stores, so a multi MB output
+ * doesn't evict the compressed input and the reference rows from the cache. The block stream (and the reference row of
+ * larger offsets) is prefetched \p distance bytes ahead. Stored frames of that size are copied with non-temporal stores.
+\param threshold uncompressed frame size which enables the mode, 0 disables it (default BBP_STREAM_THRESHOLD)
+\param distance prefetch distance in bytes, 0 disables prefetching (default BBP_PREFETCH_DISTANCE)
+ */
+void bbp_stream_params(int threshold, int distance);
+
+/** set the inner chunk size of new frames (not threadsafe)
+ * 
+ * Within a frame the coder diffs, measures and packs the input in chunks of this size, so the diffs and widths of a chunk
+ * stay in the L1 cache between the passes. bbp_init() picks it from the cache sizes the kernel reports (sysfs cacheinfo),
+ * or 8192 where they are not available. The size is stored in every frame, so frames decode with any setting.
+\param size power of 2 from BBP_MIN_INNER_CHUNK to BBP_MAX_INNER_CHUNK, or 0 to repeat the calibration of bbp_init()
+\return the inner chunk size now in use
+ */
+int bbp_inner_chunk(int size);
+
+/** statistics collected by bbp_code_offset() and bbp_decode() if the library was built with CALC_STATS
+ * 
+ * Times are in ticks (tsc cycles on x86, else nanoseconds), see ticks_per_second. Stage times of the second stage
+ * (coding of the signal) are not included in the first stage times but only in enc_second/dec_second.
+ */
+typedef struct {
+  uint64_t frames_coded;
+  uint64_t frames_decoded;
+  uint64_t frames_stored; //coded frames stored uncompressed, counted in bytes_raw
+  uint64_t bytes_in; //uncompressed size of coded frames
+  uint64_t bytes_out; //compressed size of coded frames, the sum of the following four
+  uint64_t bytes_header;
+  uint64_t bytes_signal; //block bit widths, raw or coded by the second stage, exceptions of patched frames and block minima of 32 bit frames
+  uint64_t bytes_block; //bitpacked blocks
+  uint64_t bytes_raw; //raw prefix (first offset bytes), tail and frames too small to code
+  uint64_t enc_diff; //delta calculation
+  uint64_t enc_width; //bit width reduction
+  uint64_t enc_pack; //bitpacking
+  uint64_t enc_second; //second stage, complete
+  uint64_t enc_copy; //raw prefix and tail
+  uint64_t dec_unpack;
+  uint64_t dec_undiff;
+  uint64_t dec_second;
+  uint64_t dec_copy;
+  uint64_t hist_bits[9]; //number of first stage blocks per bit width
+  uint64_t hist_bits_signal[9]; //number of second stage blocks per bit width
+  uint64_t blocks_adaptive; //superblocks coded by bbp_code_adaptive()
+  uint64_t blocks_split; //superblocks of those split into smaller blocks
+  uint64_t patches; //exceptions in frames of bbp_code_patched()
+  double ticks_per_second;
+} Bbp_Stats;
+
+/** get the statistics accumulated (over all threads) since bbp_init() or the last bbp_stats_reset()
+\return 1 if statistics are available, 0 if the library was built without CALC_STATS (\p stats is zeroed)
+ */
+int bbp_stats_get(Bbp_Stats *stats);
+
+void bbp_stats_reset(void);
+
+/** allocate a buffer suitable for in- and output of bbp_code_offset() and bbp_decode()
+ * 
+ * The buffer is backed by 2MiB huge pages if available (MAP_HUGETLB), else transparent huge pages are requested
+ * (MADV_HUGEPAGE), which avoids TLB misses when streaming through large buffers. Allocation is rounded up to 2MiB,
+ * so use this for few large buffers only.
+\return the page aligned buffer or NULL on failure, free with bbp_free()
+ */
+void *bbp_alloc(size_t size);
+
+/** free a buffer allocated with bbp_alloc()
+\param size the size which was passed to bbp_alloc()
+ */
+void bbp_free(void *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,324 @@
+#ifndef _BBP_HPP
+#define _BBP_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#include "bbp.h"
+
+/*
+ * header-only C++ coder for frames of bbp_code_offset() with an uncompressed
+ * signal (bs_r -1). Block size, predictor and optionally offset and frame
+ * length are template parameters, so the diff, width and packing loops have
+ * constant trip counts and shifts and inline into the caller without LTO,
+ * and dispatch on the block size disappears. The frames are the same as
+ * those of the C library: bbp_decode() decodes them and bbp::Frame::decode()
+ * decodes C frames of the same geometry (and an inner chunk size of at least
+ * 4*BlockSize, see bbp_inner_chunk()), other frames are passed on to
+ * bbp_decode() (which needs bbp_init()).
+ *
+ *   //1280 byte lines, 1MiB frames, both known at compile time
+ *   len_c = bbp::Frame<16, 1280, 1024*1024>::code(in, out);
+ *   bbp::Frame<16, 1280, 1024*1024>::decode(out, in);
+ *   //runtime geometry, only the block size is fixed
+ *   len_c = bbp::Frame<64>::code(in, out, len, offset);
+ *
+ * Frames are limited to bbp_max_compressed_size() like those of the C coder.
+ * Unlike bbp_code_offset() there is no sampling for incompressible input, a
+ * frame which does not pay off is stored after the attempt.
+ */
+
+namespace bbp {
+
+//predicts each byte from the byte offset bytes before it, as bbp_code_offset()
+struct Offset_Predictor {
+  static const int coder = 2; //CODER_OFFSET
+  static inline uint8_t predict(const uint8_t *p, int offset) { return p[-offset]; }
+};
+
+namespace detail {
+
+const int header_size = 64;
+const uint32_t magic = 325498741;
+const int chunk_size = 8192;
+const int coder_stored = 1;
+
+//header words, see bbp.c
+enum { hp_magic, hp_size, hp_size_c, hp_modes, hp_offset, hp_block_sizes, hp_b_size_c, hp_chunk = 13 };
+
+constexpr int ru(int v, int r) { return (v+r-1)/r*r; }
+
+inline void put_be32(uint8_t *buf, int word, uint32_t v)
+{
+  buf += 4*word;
+  buf[0] = v >> 24;
+  buf[1] = v >> 16;
+  buf[2] = v >> 8;
+  buf[3] = v;
+}
+
+inline uint32_t get_be32(const uint8_t *buf, int word)
+{
+  buf += 4*word;
+  return ((uint32_t)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+inline void header_write(uint8_t *out, int coder, int bs, int offset, int len, int len_c, int b_len_c)
+{
+  memset(out, 0, header_size);
+  put_be32(out, hp_magic, magic);
+  put_be32(out, hp_size, len);
+  put_be32(out, hp_size_c, len_c);
+  put_be32(out, hp_modes, coder);
+  put_be32(out, hp_offset, offset);
+  put_be32(out, hp_block_sizes, __builtin_ctz(bs));
+  put_be32(out, hp_b_size_c, b_len_c);
+}
+
+inline int code_stored(const uint8_t *in, uint8_t *out, int bs, int len, int offset)
+{
+  memcpy(out+header_size, in, len);
+  memset(out+header_size+len, 0, ru(len, BBP_ALIGNMENT)-len);
+  header_write(out, coder_stored, bs, offset, len, header_size+ru(len, BBP_ALIGNMENT), len);
+
+  return header_size+ru(len, BBP_ALIGNMENT);
+}
+
+//zigzag of the signed difference, as the C kernels
+inline uint8_t zigzag(uint8_t pred, uint8_t val)
+{
+  int8_t d = pred-val;
+  return (uint8_t)(d << 1) ^ (uint8_t)(d >> 7);
+}
+
+inline uint8_t unzigzag(uint8_t z)
+{
+  return (z >> 1) ^ (uint8_t)-(z & 1);
+}
+
+//blocks are packed in words of bytes which are shifted together, see push_block_8()
+template<int BS> struct Lanes {
+  typedef typename std::conditional<(BS >= 8), uint64_t, uint32_t>::type word;
+  static const int count = BS/sizeof(word);
+  static inline word bytes(uint8_t v) { return (word)(0x0101010101010101ull*v); }
+};
+
+template<int BS> inline void push_block(uint8_t *&cur, int &free, const uint8_t *block, int bits)
+{
+  typedef Lanes<BS> L;
+  typename L::word v[L::count], c[L::count];
+  int i, shift;
+
+  memcpy(v, block, BS);
+  memcpy(c, cur, BS);
+  if (free >= bits) {
+    free -= bits;
+    for(i=0;i<L::count;i++)
+      c[i] |= v[i] << free;
+    memcpy(cur, c, BS);
+  }
+  else {
+    //fill the free bits with the high bits, the low ones start the next block
+    shift = bits-free;
+    for(i=0;i<L::count;i++)
+      c[i] |= (v[i] & L::bytes(0xFF << shift)) >> shift;
+    memcpy(cur, c, BS);
+    cur += BS;
+    free = 8-shift;
+    for(i=0;i<L::count;i++)
+      c[i] = (v[i] & L::bytes(0xFF >> free)) << free;
+    memcpy(cur, c, BS);
+  }
+}
+
+template<int BS> inline void pull_block(const uint8_t *&cur, int &free, uint8_t *block, int bits)
+{
+  typedef Lanes<BS> L;
+  typename L::word v[L::count], c[L::count];
+  int i, shift;
+
+  memcpy(c, cur, BS);
+  if (free >= bits) {
+    free -= bits;
+    for(i=0;i<L::count;i++)
+      v[i] = (c[i] >> free) & L::bytes((1 << bits)-1);
+  }
+  else {
+    shift = bits-free;
+    for(i=0;i<L::count;i++)
+      v[i] = (c[i] & L::bytes((1 << free)-1)) << shift;
+    cur += BS;
+    free = 8-shift;
+    memcpy(c, cur, BS);
+    for(i=0;i<L::count;i++)
+      v[i] |= (c[i] & L::bytes(0xFF << free)) >> free;
+  }
+  memcpy(block, v, BS);
+}
+
+inline int width(uint32_t or_)
+{
+  return or_ ? 32-__builtin_clz(or_) : 0;
+}
+
+} //namespace detail
+
+/** frames of bbp_code_offset() (bs_r -1) with compile time parameters
+ *
+\tparam BlockSize power of 2 from 4 to 2048
+\tparam Offset coding distance if known at compile time (at least BBP_ALIGNMENT), 0 to pass it to code()
+\tparam Len frame length if known at compile time, 0 to pass it to code()
+\tparam Predictor see Offset_Predictor, the only one bbp_decode() knows
+ */
+template<int BlockSize, int Offset = 0, int Len = 0, typename Predictor = Offset_Predictor>
+class Frame {
+  static_assert(BlockSize >= 4 && BlockSize <= detail::chunk_size/4 && !(BlockSize & (BlockSize-1)), "block size must be a power of 2 from 4 to 2048");
+  static_assert(!Offset || Offset >= BBP_ALIGNMENT, "offset must be at least BBP_ALIGNMENT");
+  static_assert(Len >= 0, "negative frame length");
+
+  static const int group = 4*BlockSize > BBP_ALIGNMENT ? 4*BlockSize : BBP_ALIGNMENT;
+
+  //bytes coded as blocks behind the raw prefix of start bytes, the rest is a raw tail (if group divides the inner chunk size)
+  static inline int coded_len(int len, int start)
+  {
+    if (start+BlockSize > len)
+      return 0;
+    return (len-start)/group*group;
+  }
+
+public:
+  /** code \p len bytes from \p in to \p out, which has to fit bbp_max_compressed_size(len)
+   *
+   * \p len and \p offset are ignored if given as template parameters. Needs no bbp_init().
+  \return size of the frame
+   */
+  static int code(const uint8_t *in, uint8_t *out, int len = Len, int offset = Offset)
+  {
+    using namespace detail;
+    alignas(BBP_ALIGNMENT) uint8_t diff[chunk_size];
+    int bits[chunk_size/BlockSize];
+    int i, j, k, n, sum;
+    int start, coded, blocks, free = 8;
+    uint32_t or_;
+    uint8_t *signal, *block_buf, *cur;
+    uint8_t *end = out+bbp_max_compressed_size(len);
+
+    if (Len) len = Len;
+    if (Offset) offset = Offset;
+
+    start = ru(offset, BBP_ALIGNMENT) < len ? ru(offset, BBP_ALIGNMENT) : len;
+    coded = coded_len(len, start);
+    if (!coded)
+      return code_stored(in, out, BlockSize, len, offset);
+
+    blocks = coded/BlockSize;
+    signal = out+header_size;
+    block_buf = signal+ru(blocks, BBP_ALIGNMENT);
+    memset(signal+blocks, 0, block_buf-signal-blocks);
+    if (block_buf+start+BlockSize > end)
+      return code_stored(in, out, BlockSize, len, offset);
+    memcpy(block_buf, in, start);
+    cur = block_buf+start;
+    memset(cur, 0, BlockSize);
+
+    for(i=start;i<start+coded;i+=n) {
+      n = start+coded-i < chunk_size ? start+coded-i : chunk_size;
+
+      for(j=0;j<n;j++)
+        diff[j] = zigzag(Predictor::predict(in+i+j, offset), in[i+j]);
+
+      sum = 8-free;
+      for(k=0;k<n/BlockSize;k++) {
+        or_ = 0;
+        for(j=0;j<BlockSize;j++)
+          or_ |= diff[k*BlockSize+j];
+        bits[k] = width(or_);
+        sum += bits[k];
+      }
+      //a push writes at most into the words after the last full ones
+      if (cur+(sum/8+1)*BlockSize > end)
+        return code_stored(in, out, BlockSize, len, offset);
+
+      for(k=0;k<n/BlockSize;k++) {
+        *signal++ = bits[k];
+        push_block<BlockSize>(cur, free, diff+k*BlockSize, bits[k]);
+      }
+    }
+    if (free != 8)
+      cur += BlockSize;
+
+    n = len-start-coded;
+    if (block_buf+ru(cur-block_buf+n, BBP_ALIGNMENT) > end)
+      return code_stored(in, out, BlockSize, len, offset);
+    memcpy(cur, in+start+coded, n);
+    cur += n;
+    memset(cur, 0, ru(cur-block_buf, BBP_ALIGNMENT)-(cur-block_buf));
+    cur = block_buf+ru(cur-block_buf, BBP_ALIGNMENT);
+
+    //coding did not pay off, a stored frame also decodes at memcpy speed
+    if (cur-out >= header_size+ru(len, BBP_ALIGNMENT))
+      return code_stored(in, out, BlockSize, len, offset);
+
+    header_write(out, Predictor::coder, BlockSize, offset, len, cur-out, cur-block_buf);
+    return cur-out;
+  }
+
+  /** decode a frame from \p in to \p out
+   *
+   * Frames of other block sizes, offsets or lengths than the template parameters, or with a coded signal, are
+   * decoded with bbp_decode().
+  \return the decoded size
+   */
+  static int decode(const uint8_t *in, uint8_t *out)
+  {
+    using namespace detail;
+    alignas(BBP_ALIGNMENT) uint8_t diff[chunk_size];
+    int i, j, k, n;
+    int len, offset, start, coded, free = 8;
+    int chunk = get_be32(in, hp_chunk) ? 1 << get_be32(in, hp_chunk) : chunk_size;
+    const uint8_t *signal, *block_buf, *cur;
+
+    len = get_be32(in, hp_size);
+    offset = get_be32(in, hp_offset);
+
+    if ((get_be32(in, hp_modes) & 0xFF) == coder_stored) {
+      memcpy(out, in+header_size, len);
+      return len;
+    }
+    if (get_be32(in, hp_modes) != (uint32_t)Predictor::coder || get_be32(in, hp_block_sizes) != (uint32_t)__builtin_ctz(BlockSize)
+        || (Offset && offset != Offset) || (Len && len != Len) || chunk % group)
+      return bbp_decode((uint8_t*)in, out);
+
+    if (Len) len = Len;
+    if (Offset) offset = Offset;
+
+    start = ru(offset, BBP_ALIGNMENT) < len ? ru(offset, BBP_ALIGNMENT) : len;
+    coded = coded_len(len, start);
+    signal = in+header_size;
+    block_buf = signal+ru(coded/BlockSize, BBP_ALIGNMENT);
+    memcpy(out, block_buf, start);
+    cur = block_buf+start;
+
+    for(i=start;i<start+coded;i+=n) {
+      n = start+coded-i < chunk_size ? start+coded-i : chunk_size;
+
+      for(k=0;k<n/BlockSize;k++)
+        pull_block<BlockSize>(cur, free, diff+k*BlockSize, *signal++);
+
+      //offset >= BBP_ALIGNMENT, the vectorizer checks the distance at runtime
+      for(j=0;j<n;j++)
+        out[i+j] = Predictor::predict(out+i+j, offset)-unzigzag(diff[j]);
+    }
+    if (free != 8)
+      cur += BlockSize;
+
+    memcpy(out+start+coded, cur, len-start-coded);
+
+    return len;
+  }
+};
+
+} //namespace bbp
+
+#endif
@@ -0,0 +1,568 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <math.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "bbp.h"
+#include "bench_util.h"
+
+typedef struct {
+  const char *name;
+  uint8_t *data;
+  size_t len;
+} Corpus_File;
+
+typedef struct {
+  double mean;
+  double stddev;
+  double min;
+  double max;
+} Stat;
+
+typedef struct {
+  Stat mbs; //MiB/s over all repetitions
+  double cpb; //tsc cycles per byte (mean)
+  Perf_Values perf; //summed over all repetitions, with -p
+} Measurement;
+
+typedef struct {
+  int valid; //library built with CALC_STATS
+  Bbp_Stats s;
+} Stage_Stats;
+
+typedef struct {
+  Param_List bs, bs_r, offset, chunk;
+  Param_List level; //if set, levels replace the bs/bs_r lists
+  Param_List split; //split block sizes for bbp_code_adaptive(), 0 codes fixed block sizes
+  int warmup;
+  int reps;
+  int format;
+  int perf; //wrap the timed passes with hardware counters
+  int patched; //code fixed block sizes with bbp_code_patched()
+  int stream_threshold, prefetch; //bbp_stream_params()
+  int inner_chunk; //bbp_inner_chunk(), 0 for the calibrated size
+  int batch, batch_threads; //code the chunks of a file as one batch with bbp_code_batch() in batch_threads
+  Bbp_Batch_Item *items; //one per chunk of the largest file
+  Perf_Counters counters;
+} Bench_Config;
+
+static void stat_calc(Stat *s, double *v, int n)
+{
+  int i;
+  double sum = 0, sq = 0;
+
+  s->min = s->max = v[0];
+  for(i=0;i<n;i++) {
+    sum += v[i];
+    if (v[i] < s->min) s->min = v[i];
+    if (v[i] > s->max) s->max = v[i];
+  }
+  s->mean = sum/n;
+
+  for(i=0;i<n;i++)
+    sq += (v[i]-s->mean)*(v[i]-s->mean);
+  s->stddev = n > 1 ? sqrt(sq/(n-1)) : 0;
+}
+
+static int load_file(Corpus_File *f, const char *name)
+{
+  int fd;
+  struct stat st;
+  size_t done = 0;
+  ssize_t ret;
+
+  fd = open(name, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) || !st.st_size) {
+    fprintf(stderr, "WARNING: could not read %s, skipping\n", name);
+    if (fd != -1)
+      close(fd);
+    return 0;
+  }
+
+  f->name = name;
+  f->len = st.st_size;
+  f->data = bbp_alloc(f->len);
+  assert(f->data);
+
+  while (done < f->len && (ret = read(fd, f->data+done, f->len-done)) > 0)
+    done += ret;
+  close(fd);
+  assert(done == f->len);
+
+  return 1;
+}
+
+//level -1 codes with bs/bs_r (and split), otherwise with bbp_code_level()
+static size_t encode_pass(Corpus_File *f, uint8_t *comp, int level, int bs, int split, int bs_r, int offset, size_t chunk, int patched)
+{
+  size_t pos, len, len_c = 0;
+
+  for(pos=0;pos<f->len;pos+=chunk) {
+    len = f->len-pos;
+    if (len > chunk)
+      len = chunk;
+    if (level >= 0)
+      len_c += bbp_code_level(f->data+pos, comp+len_c, len, offset, level);
+    else if (split)
+      len_c += bbp_code_adaptive(f->data+pos, comp+len_c, bs, split, bs_r, len, offset);
+    else if (patched)
+      len_c += bbp_code_patched(f->data+pos, comp+len_c, bs, bs_r, len, offset);
+    else
+      len_c += bbp_code_offset(f->data+pos, comp+len_c, bs, bs_r, len, offset);
+  }
+
+  return len_c;
+}
+
+static size_t encode_batch_pass(Bench_Config *c, Corpus_File *f, uint8_t *comp, int bs, int bs_r, int offset, size_t chunk)
+{
+  int i = 0;
+  size_t pos;
+
+  for(pos=0;pos<f->len;pos+=chunk,i++) {
+    c->items[i].in = f->data+pos;
+    c->items[i].len = f->len-pos < chunk ? f->len-pos : chunk;
+  }
+
+  return bbp_code_batch(c->items, i, comp, bs, bs_r, offset, c->batch_threads);
+}
+
+static void decode_batch_pass(Bench_Config *c, uint8_t *comp, uint8_t *out)
+{
+  int i, count = bbp_batch_items(comp, c->items);
+
+  for(i=0;i<count;i++) {
+    c->items[i].out = out;
+    out += c->items[i].len;
+  }
+  bbp_decode_batch(comp, c->items, c->batch_threads);
+}
+
+static void decode_pass(uint8_t *comp, size_t len_c, uint8_t *out)
+{
+  size_t pos = 0;
+  uint32_t size, size_c;
+
+  while (pos < len_c) {
+    bbp_header_sizes(comp+pos, &size, &size_c);
+    out += bbp_decode(comp+pos, out);
+    pos += size_c;
+  }
+}
+
+//run one configuration: warmup, then reps timed encode and decode passes
+static void bench_run(Bench_Config *c, Corpus_File *f, uint8_t *comp, uint8_t *dec, int level, int bs, int split, int bs_r, int offset, size_t chunk, size_t *len_c, Measurement *enc, Measurement *dec_m, Stage_Stats *stats)
+{
+  int i;
+  double mbs_e[c->reps], mbs_d[c->reps];
+  uint64_t cyc_e = 0, cyc_d = 0, cyc;
+  struct timespec start, stop;
+
+  for(i=0;i<c->warmup;i++) {
+    if (c->batch) {
+      *len_c = encode_batch_pass(c, f, comp, bs, bs_r, offset, chunk);
+      decode_batch_pass(c, comp, dec);
+    }
+    else {
+      *len_c = encode_pass(f, comp, level, bs, split, bs_r, offset, chunk, c->patched);
+      decode_pass(comp, *len_c, dec);
+    }
+  }
+
+  memset(&enc->perf, 0, sizeof(Perf_Values));
+  memset(&dec_m->perf, 0, sizeof(Perf_Values));
+
+  bbp_stats_reset();
+  for(i=0;i<c->reps;i++) {
+    //counters are started outside of the timed section, so the ioctls don't show up in MB/s
+    if (c->perf)
+      perf_start(&c->counters);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cyc = cycles();
+    if (c->batch)
+      *len_c = encode_batch_pass(c, f, comp, bs, bs_r, offset, chunk);
+    else
+      *len_c = encode_pass(f, comp, level, bs, split, bs_r, offset, chunk, c->patched);
+    cyc_e += cycles()-cyc;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (c->perf)
+      perf_stop(&c->counters, &enc->perf);
+    mbs_e[i] = (double)f->len/1024/1024*1000/ms_delta(start, stop);
+
+    if (c->perf)
+      perf_start(&c->counters);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cyc = cycles();
+    if (c->batch)
+      decode_batch_pass(c, comp, dec);
+    else
+      decode_pass(comp, *len_c, dec);
+    cyc_d += cycles()-cyc;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (c->perf)
+      perf_stop(&c->counters, &dec_m->perf);
+    mbs_d[i] = (double)f->len/1024/1024*1000/ms_delta(start, stop);
+  }
+  stats->valid = bbp_stats_get(&stats->s);
+
+  if (memcmp(dec, f->data, f->len)) {
+    fprintf(stderr, "ERROR: round trip failed for %s level %d bs %d split %d bs_r %d offset %d chunk %zu\n", f->name, level, bs, split, bs_r, offset, chunk);
+    exit(EXIT_FAILURE);
+  }
+
+  stat_calc(&enc->mbs, mbs_e, c->reps);
+  stat_calc(&dec_m->mbs, mbs_d, c->reps);
+  enc->cpb = (double)cyc_e/c->reps/f->len;
+  dec_m->cpb = (double)cyc_d/c->reps/f->len;
+}
+
+static void json_string(const char *str)
+{
+  putchar('"');
+  for(;*str;str++) {
+    if (*str == '"' || *str == '\\')
+      putchar('\\');
+    putchar(*str);
+  }
+  putchar('"');
+}
+
+static void json_measurement(const char *name, Measurement *m)
+{
+  printf("\"%s\": {\"mbs\": %.3f, \"mbs_stddev\": %.3f, \"mbs_min\": %.3f, \"mbs_max\": %.3f, \"cycles_per_byte\": %.4f}", name, m->mbs.mean, m->mbs.stddev, m->mbs.min, m->mbs.max, m->cpb);
+}
+
+//percentage of part in total
+static double pc(uint64_t part, uint64_t total)
+{
+  return total ? 100.0*part/total : 0;
+}
+
+static void json_hist(const char *name, uint64_t *hist)
+{
+  int i;
+
+  printf("\"%s\": [", name);
+  for(i=0;i<9;i++)
+    printf("%s%llu", i ? ", " : "", (unsigned long long)hist[i]);
+  printf("]");
+}
+
+static void json_stats(Bbp_Stats *s)
+{
+  printf(", \"stats\": {\"ticks_per_second\": %.0f, ", s->ticks_per_second);
+  printf("\"frames_coded\": %llu, \"frames_stored\": %llu, ", (unsigned long long)s->frames_coded, (unsigned long long)s->frames_stored);
+  printf("\"blocks_adaptive\": %llu, \"blocks_split\": %llu, \"patches\": %llu, ", (unsigned long long)s->blocks_adaptive, (unsigned long long)s->blocks_split, (unsigned long long)s->patches);
+  printf("\"bytes_header\": %llu, \"bytes_signal\": %llu, \"bytes_block\": %llu, \"bytes_raw\": %llu, ",
+         (unsigned long long)s->bytes_header, (unsigned long long)s->bytes_signal, (unsigned long long)s->bytes_block, (unsigned long long)s->bytes_raw);
+  printf("\"enc_diff\": %llu, \"enc_width\": %llu, \"enc_pack\": %llu, \"enc_second\": %llu, \"enc_copy\": %llu, ",
+         (unsigned long long)s->enc_diff, (unsigned long long)s->enc_width, (unsigned long long)s->enc_pack, (unsigned long long)s->enc_second, (unsigned long long)s->enc_copy);
+  printf("\"dec_unpack\": %llu, \"dec_undiff\": %llu, \"dec_second\": %llu, \"dec_copy\": %llu, ",
+         (unsigned long long)s->dec_unpack, (unsigned long long)s->dec_undiff, (unsigned long long)s->dec_second, (unsigned long long)s->dec_copy);
+  json_hist("hist_bits", s->hist_bits);
+  printf(", ");
+  json_hist("hist_bits_signal", s->hist_bits_signal);
+  printf("}");
+}
+
+static void table_stats(Bbp_Stats *s)
+{
+  int i;
+  uint64_t enc = s->enc_diff+s->enc_width+s->enc_pack+s->enc_second+s->enc_copy;
+  uint64_t dec = s->dec_unpack+s->dec_undiff+s->dec_second+s->dec_copy;
+  uint64_t blocks = 0;
+
+  printf("    encode: diff %.1f%% width %.1f%% pack %.1f%% second stage %.1f%% copy %.1f%%\n",
+         pc(s->enc_diff, enc), pc(s->enc_width, enc), pc(s->enc_pack, enc), pc(s->enc_second, enc), pc(s->enc_copy, enc));
+  printf("    decode: unpack %.1f%% undiff %.1f%% second stage %.1f%% copy %.1f%%\n",
+         pc(s->dec_unpack, dec), pc(s->dec_undiff, dec), pc(s->dec_second, dec), pc(s->dec_copy, dec));
+  printf("    output: header %.2f%% signal %.2f%% blocks %.2f%% raw %.2f%%, stored frames %.1f%%\n",
+         pc(s->bytes_header, s->bytes_out), pc(s->bytes_signal, s->bytes_out), pc(s->bytes_block, s->bytes_out), pc(s->bytes_raw, s->bytes_out),
+         pc(s->frames_stored, s->frames_coded));
+  for(i=0;i<9;i++)
+    blocks += s->hist_bits[i];
+  printf("    bit widths:");
+  for(i=0;i<9;i++)
+    printf(" %d:%.1f%%", i, pc(s->hist_bits[i], blocks));
+  printf("\n");
+  if (s->blocks_adaptive)
+    printf("    superblocks split: %.1f%%\n", pc(s->blocks_split, s->blocks_adaptive));
+  if (s->patches)
+    printf("    exceptions: %.3f%% of the input\n", pc(s->patches, s->bytes_in));
+}
+
+static void print_header(Bench_Config *c)
+{
+  switch (c->format) {
+    case FORMAT_CSV :
+      printf("file,level,bs,split,bs_r,offset,chunk,size,size_c,ratio,enc_mbs,enc_mbs_stddev,enc_mbs_min,enc_mbs_max,enc_cpb,dec_mbs,dec_mbs_stddev,dec_mbs_min,dec_mbs_max,dec_cpb");
+      if (c->perf) {
+        perf_print_csv_header("enc_");
+        perf_print_csv_header("dec_");
+      }
+      printf("\n");
+      break;
+    case FORMAT_JSON :
+      printf("{\"simd\": \"%s\", \"warmup\": %d, \"reps\": %d, \"patched\": %d, \"stream_threshold\": %d, \"prefetch\": %d, \"inner_chunk\": %d, \"batch_threads\": %d, \"results\": [\n",
+             simd_string(), c->warmup, c->reps, c->patched, c->stream_threshold, c->prefetch, c->inner_chunk, c->batch ? c->batch_threads : -1);
+      break;
+    default :
+      printf("simd: %s, warmup %d, reps %d,%s large frames from %d bytes, prefetch %d, inner chunk %d,", simd_string(),
+             c->warmup, c->reps, c->patched ? " patched frames," : "", c->stream_threshold, c->prefetch, c->inner_chunk);
+      if (c->batch)
+        printf(" batches in %d threads,", c->batch_threads);
+      printf(" MB/s as mean +- stddev, cycles/byte from the tsc\n");
+      printf("%-24s %5s %5s %5s %5s %6s %8s %7s %21s %7s %21s %7s\n", "file", "level", "bs", "split", "bs_r", "offset", "chunk", "ratio", "encode MB/s", "cyc/B", "decode MB/s", "cyc/B");
+  }
+}
+
+static void print_result(Bench_Config *c, int first, Corpus_File *f, int level, int bs, int split, int bs_r, int offset, size_t chunk, size_t len_c, Measurement *e, Measurement *d, Stage_Stats *stats)
+{
+  double bytes = (double)f->len*c->reps;
+
+  switch (c->format) {
+    case FORMAT_CSV :
+      printf("%s,%d,%d,%d,%d,%d,%zu,%zu,%zu,%.4f,%.3f,%.3f,%.3f,%.3f,%.4f,%.3f,%.3f,%.3f,%.3f,%.4f", f->name, level, bs, split, bs_r, offset, chunk, f->len, len_c, (double)f->len/len_c,
+             e->mbs.mean, e->mbs.stddev, e->mbs.min, e->mbs.max, e->cpb, d->mbs.mean, d->mbs.stddev, d->mbs.min, d->mbs.max, d->cpb);
+      if (c->perf) {
+        perf_print_csv(&e->perf, bytes);
+        perf_print_csv(&d->perf, bytes);
+      }
+      printf("\n");
+      break;
+    case FORMAT_JSON :
+      printf("%s  {\"file\": ", first ? "" : ",\n");
+      json_string(f->name);
+      printf(", \"level\": %d, \"bs\": %d, \"split\": %d, \"bs_r\": %d, \"offset\": %d, \"chunk\": %zu, \"size\": %zu, \"size_c\": %zu, \"ratio\": %.4f, ", level, bs, split, bs_r, offset, chunk, f->len, len_c, (double)f->len/len_c);
+      json_measurement("encode", e);
+      printf(", ");
+      json_measurement("decode", d);
+      if (c->perf) {
+        perf_print_json("encode_perf", &e->perf, bytes);
+        perf_print_json("decode_perf", &d->perf, bytes);
+      }
+      if (stats->valid)
+        json_stats(&stats->s);
+      printf("}");
+      break;
+    default :
+      printf("%-24s %5d %5d %5d %5d %6d %8zu %7.3f %10.1f +- %7.1f %7.3f %10.1f +- %7.1f %7.3f\n", f->name, level, bs, split, bs_r, offset, chunk, (double)f->len/len_c,
+             e->mbs.mean, e->mbs.stddev, e->cpb, d->mbs.mean, d->mbs.stddev, d->cpb);
+      if (c->perf) {
+        perf_print_table("encode perf", &e->perf, bytes);
+        perf_print_table("decode perf", &d->perf, bytes);
+      }
+      if (stats->valid)
+        table_stats(&stats->s);
+  }
+  fflush(stdout);
+}
+
+static void help(void)
+{
+  printf("usage: bbp_bench [options] <file>...\n");
+  printf("runs bbp encoding and decoding over all files for every combination of the parameter lists\n");
+  printf("  -b <list>   block sizes (default 16)\n");
+  printf("  -r <list>   block sizes of the second stage, -1 disables it (default 0 = library default)\n");
+  printf("  -l <list>   levels %d-%d for bbp_code_level(), replaces -b and -r, level -1 is reported otherwise\n", BBP_LEVEL_MIN, BBP_LEVEL_MAX);
+  printf("  -s <list>   split block sizes, codes adaptive frames with superblocks of -b (default 0 = fixed block size)\n");
+  printf("  -o <list>   offsets, should be the line width in bytes (default 32)\n");
+  printf("  -c <list>   chunk sizes, k/m suffix allowed (default %d)\n", BBP_DEFAULT_CHUNK_SIZE);
+  printf("  -w <n>      warmup passes (default 1)\n");
+  printf("  -n <n>      timed repetitions (default 5)\n");
+  printf("  -f <fmt>    output format: table, csv or json (default table)\n");
+  printf("  -x          code fixed block sizes as patched frames (exceptions for outliers)\n");
+  printf("  -t <size>   frame size from which on decoding streams the output, 0 disables it (default %d, see bbp_stream_params())\n", BBP_STREAM_THRESHOLD);
+  printf("  -d <n>      prefetch distance in bytes of the large frame mode, 0 disables it (default %d)\n", BBP_PREFETCH_DISTANCE);
+  printf("  -i <size>   inner chunk size of the coder, a power of 2 from %d to %d (default 0 = calibrated, see bbp_inner_chunk())\n", BBP_MIN_INNER_CHUNK,
+         BBP_MAX_INNER_CHUNK);
+  printf("  -B <n>      code the chunks of each file as one batch with bbp_code_batch() and bbp_decode_batch() in n threads\n");
+  printf("              (0 = calling thread), not with -l, -s or -x\n");
+  printf("  -p          count cycles, instructions, cache and branch misses with perf_event_open\n");
+  printf("lists are comma separated, e.g. -b 8,16,512\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, i, first = 1;
+  int nfiles = 0;
+  int ib, ir, io, ic, il, is;
+  char *end;
+  int bs, bs_r;
+  size_t max_len = 0, len_c, comp_size, max_items = 0;
+  Corpus_File *files;
+  Bench_Config c;
+  Measurement e, d;
+  Stage_Stats stats;
+  uint8_t *comp, *dec;
+
+  memset(&c, 0, sizeof(c));
+  parse_list(&c.bs, "16");
+  parse_list(&c.bs_r, "0");
+  parse_list(&c.split, "0");
+  parse_list(&c.offset, "32");
+  parse_list(&c.chunk, "64k");
+  c.warmup = 1;
+  c.reps = 5;
+  c.stream_threshold = BBP_STREAM_THRESHOLD;
+  c.prefetch = BBP_PREFETCH_DISTANCE;
+
+  while ((opt = getopt(argc, argv, "b:r:l:s:o:c:w:n:t:d:i:f:B:px")) != -1) {
+    switch (opt) {
+      case 'b' : parse_list(&c.bs, optarg); break;
+      case 'r' : parse_list(&c.bs_r, optarg); break;
+      case 'l' : parse_list(&c.level, optarg); break;
+      case 's' : parse_list(&c.split, optarg); break;
+      case 'o' : parse_list(&c.offset, optarg); break;
+      case 'c' : parse_list(&c.chunk, optarg); break;
+      case 'w' : c.warmup = atoi(optarg); break;
+      case 'n' : c.reps = atoi(optarg); break;
+      case 'p' : c.perf = 1; break;
+      case 'x' : c.patched = 1; break;
+      case 't' : c.stream_threshold = parse_size(optarg, &end); break;
+      case 'd' : c.prefetch = atoi(optarg); break;
+      case 'i' : c.inner_chunk = parse_size(optarg, &end); break;
+      case 'B' :
+        c.batch = 1;
+        c.batch_threads = atoi(optarg);
+        break;
+      case 'f' :
+        c.format = parse_format(optarg);
+        if (c.format < 0)
+          help();
+        break;
+      default : help();
+    }
+  }
+
+  if (optind >= argc || c.reps < 1 || c.warmup < 0 || c.stream_threshold < 0 || c.prefetch < 0)
+    help();
+
+  for(i=0;i<c.bs.count;i++)
+    if (c.bs.val[i] && (c.bs.val[i] < 4 || c.bs.val[i] > BBP_MAX_BLOCK_SIZE || c.bs.val[i] & (c.bs.val[i]-1)))
+      help();
+  //adaptive frames need superblocks of at least 4 split blocks, bs 0 is 512 there
+  for(i=0;i<c.split.count;i++)
+    for(ib=0;ib<c.bs.count;ib++)
+      if (c.split.val[i] && (c.split.val[i] < 4 || c.split.val[i] & (c.split.val[i]-1) || c.split.val[i]*4 > (c.bs.val[ib] ? c.bs.val[ib] : 512)))
+        help();
+  for(i=0;i<c.level.count;i++)
+    if (c.level.val[i] < BBP_LEVEL_MIN || c.level.val[i] > BBP_LEVEL_MAX)
+      help();
+  for(i=0;i<c.offset.count;i++)
+    if (c.offset.val[i] < BBP_ALIGNMENT)
+      help();
+  for(i=0;i<c.chunk.count;i++)
+    if (c.chunk.val[i] <= 0 || c.chunk.val[i] % BBP_ALIGNMENT)
+      help();
+  //batches are frames of bbp_code_offset()
+  if (c.batch && (c.batch_threads < 0 || c.level.count || c.patched))
+    help();
+  for(i=0;i<c.split.count;i++)
+    if (c.batch && c.split.val[i])
+      help();
+  if (c.inner_chunk && (c.inner_chunk < BBP_MIN_INNER_CHUNK || c.inner_chunk > BBP_MAX_INNER_CHUNK || c.inner_chunk & (c.inner_chunk-1)))
+    help();
+
+  files = calloc(argc-optind, sizeof(Corpus_File));
+  for(i=optind;i<argc;i++)
+    if (load_file(&files[nfiles], argv[i])) {
+      if (files[nfiles].len > max_len)
+        max_len = files[nfiles].len;
+      nfiles++;
+    }
+  if (!nfiles)
+    help();
+
+  //enough for the smallest chunk size, where the per frame overhead is largest
+  comp_size = 0;
+  for(ic=0;ic<c.chunk.count;ic++) {
+    size_t s = (max_len/c.chunk.val[ic]+1)*(size_t)bbp_max_compressed_size(c.chunk.val[ic]);
+    if (s > comp_size)
+      comp_size = s;
+    s = bbp_max_batch_size(max_len/c.chunk.val[ic]+1, max_len);
+    if (c.batch && s > comp_size)
+      comp_size = s;
+    if (c.batch && max_len/c.chunk.val[ic]+1 > max_items)
+      max_items = max_len/c.chunk.val[ic]+1;
+  }
+  c.items = calloc(max_items, sizeof(Bbp_Batch_Item));
+  comp = bbp_alloc(comp_size);
+  dec = bbp_alloc(max_len);
+  assert(comp && dec);
+
+  bbp_init();
+  bbp_stream_params(c.stream_threshold, c.prefetch);
+  c.inner_chunk = bbp_inner_chunk(c.inner_chunk);
+
+  //without any usable counter the perf columns are still printed (empty), so csv layouts don't depend on the machine
+  if (c.perf)
+    perf_open(&c.counters);
+
+  print_header(&c);
+  for(i=0;i<nfiles;i++)
+    for(ic=0;ic<c.chunk.count;ic++)
+      for(io=0;io<c.offset.count;io++)
+        if (c.level.count)
+          for(il=0;il<c.level.count;il++) {
+            //reported bs is 0 for the stored level
+            bbp_level_params(c.level.val[il], &bs, &bs_r);
+            bench_run(&c, &files[i], comp, dec, c.level.val[il], bs, 0, bs_r, c.offset.val[io], c.chunk.val[ic], &len_c, &e, &d, &stats);
+            print_result(&c, first, &files[i], c.level.val[il], bs, 0, bs_r, c.offset.val[io], c.chunk.val[ic], len_c, &e, &d, &stats);
+            first = 0;
+          }
+        else
+          for(ib=0;ib<c.bs.count;ib++)
+            for(is=0;is<c.split.count;is++)
+              for(ir=0;ir<c.bs_r.count;ir++) {
+                bench_run(&c, &files[i], comp, dec, -1, c.bs.val[ib], c.split.val[is], c.bs_r.val[ir], c.offset.val[io], c.chunk.val[ic], &len_c, &e, &d, &stats);
+                print_result(&c, first, &files[i], -1, c.bs.val[ib], c.split.val[is], c.bs_r.val[ir], c.offset.val[io], c.chunk.val[ic], len_c, &e, &d, &stats);
+                first = 0;
+              }
+  if (c.format == FORMAT_JSON)
+    printf("\n]}\n");
+
+  if (c.perf)
+    perf_close(&c.counters);
+
+  bbp_shutdown();
+
+  for(i=0;i<nfiles;i++)
+    bbp_free(files[i].data, files[i].len);
+  bbp_free(comp, comp_size);
+  bbp_free(dec, max_len);
+  free(files);
+  free(c.items);
+
+  return EXIT_SUCCESS;
+}
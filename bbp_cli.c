@@ -35,6 +35,8 @@
 #include <time.h>
 
 #include "bbp.h"
+#include "cli_io.h"
+#include "cli_pipeline.h"
 
 #ifdef __APPLE__
 #define clock_gettime(A,B)
@@ -45,136 +47,240 @@ double ms_delta(struct timespec start, struct timespec stop)
   return (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_nsec - start.tv_nsec) / 1000000.0;
 }
 
-#define CHUNK_SIZE (64*1024)
-//#define USE_MMAP_READ
-//#define USE_MMAP_WRITE
+//size of the input segments for the uring backend (several are in flight)
+#define SEGMENT_SIZE (1024*1024)
+#define MAX_CHUNK_SIZE (1024*1024*1024)
 //#define VERIFY_DECODE
 
 #define BENCHMARK_ITERATIONS 16
 
-#define STR(X) #X
+#define STR_(X) #X
+#define STR(X) STR_(X)
 
-#ifdef USE_MMAP_READ
-#define USE_MMAP
-#endif
-#ifdef USE_MMAP_WRITE
-#define USE_MMAP
-#endif
+#define RU_N(V, R) ((V+R-1)/R*R)
+
+//segment size for the input, a multiple of the chunk size
+size_t segment_size(int io, size_t chunk)
+{
+  if (io != IO_BACKEND_URING || chunk >= SEGMENT_SIZE)
+    return chunk;
+  return SEGMENT_SIZE/chunk*chunk;
+}
+
+size_t parse_size(const char *str)
+{
+  char *end;
+  size_t size = strtoul(str, &end, 10);
+  
+  switch (*end) {
+    case 'k' : case 'K' : size *= 1024; break;
+    case 'm' : case 'M' : size *= 1024*1024; break;
+  }
+  
+  return size;
+}
+
+//every frame costs a header and a raw copy of the first offset bytes, report their share of the output
+//header and raw prefix bytes of size coded in frames of chunk bytes
+static uint64_t frame_overhead(uint64_t size, size_t chunk, int offset, uint64_t *frames, uint64_t *raw)
+{
+  uint64_t prefix = RU_N(offset, BBP_ALIGNMENT);
+  
+  if (prefix > chunk)
+    prefix = chunk;
+  *frames = (size+chunk-1)/chunk;
+  *raw = size/chunk*prefix + (size%chunk < prefix ? size%chunk : prefix);
+  
+  return *frames*64 + *raw;
+}
+
+void print_frame_overhead(FILE *info, uint64_t size, uint64_t size_c, size_t chunk, int offset)
+{
+  uint64_t frames, raw, frames_ref, raw_ref;
+  uint64_t overhead = frame_overhead(size, chunk, offset, &frames, &raw);
+  uint64_t overhead_ref = frame_overhead(size, BBP_DEFAULT_CHUNK_SIZE, offset, &frames_ref, &raw_ref);
+  double size_c_ref;
+  
+  fprintf(info, "chunk size %zu: %llu frames, headers %.2f%% raw prefix %.2f%% of output, ratio %.3f\n", chunk, (unsigned long long)frames, 100.0*frames*64/size_c, 100.0*raw/size_c, (double)size/size_c);
+  //reference figures for default sized frames, the bytes outside the raw prefix are assumed to code at the measured payload ratio
+  if (chunk != BBP_DEFAULT_CHUNK_SIZE && size > raw && size_c > overhead) {
+    size_c_ref = overhead_ref + (double)(size - raw_ref)*(size_c - overhead)/(size - raw);
+    fprintf(info, "chunk size %d: %llu frames, headers %.2f%% raw prefix %.2f%% of output, ratio %.3f (estimated)\n", BBP_DEFAULT_CHUNK_SIZE, (unsigned long long)frames_ref, 100.0*frames_ref*64/size_c_ref, 100.0*raw_ref/size_c_ref, size/size_c_ref);
+  }
+}
 
 void help(void)
 {
-  printf("usage: bbp_test <mode> <in> <out> <blocksize> <blocksize2> <offset>\n");
+  printf("usage: bbp_test [-i <io>] [-j <threads>] [-c <chunksize>] [-x] [-t <elemsize>[x]] <mode> <in> <out> <blocksize> <blocksize2> <offset>\n");
+  printf("use '-' as <in> or <out> for stdin/stdout\n");
   printf("where mode is either 'e' for encoding or 'd' for decoding and\n");
   printf("blocksizes must be a power of 2 between 4 and " STR(BBP_MAX_BLOCK_SIZE) " (0 for default)\n");
+  printf("blocksize may also be <superblock>/<split> for an adaptive block size, e.g. 512/8\n");
+  printf("blocksize2 may also be 'r' to code the block widths with rANS (best ratio with small blocksizes)\n");
   printf("offset gives the coding distance and should be the line width in bytes\n");
+  printf("io selects the i/o backend: 'read' (default), 'mmap'");
+#ifdef BBP_USE_URING
+  printf(" or 'uring'");
+#endif
+  printf("\n");
+  printf("threads enables pipelined coding with a reader, <threads> coding threads and a writer\n");
+  printf("chunksize is the size of independently coded frames in bytes (k/m suffix allowed, default %d)\n", BBP_DEFAULT_CHUNK_SIZE);
+  printf("-x codes patched frames: sparse outliers are stored as exceptions instead of widening their block\n");
+  printf("-t codes elements of 2, 4 or 8 bytes as byte planes, with a trailing 'x' xored with the previous element (floats)\n");
   exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[])
 {
-  int b;
+  int b, opt;
   off_t size = 0, size_c = 0;
   uint32_t len, len_c;
-  int bs, bs2;
+  size_t got;
+  int bs, bs2, bs_split = 0;
+  char *split;
   int offset;
-  FILE *in;
-  void *in_buf, *out_buf;
-  uint64_t full_len, out_len;
-  struct stat st;
-  void *in_map = NULL;
-  void *out_map = NULL;
-  int out_fd;
+  int in_fd, out_fd;
+  uint8_t *in_buf, *out_buf;
   double time = 0.0;
-#ifdef USE_MMAP
-  uint64_t out_mapped;
-#endif
+  int io = IO_BACKEND_READ;
+  int threads = 0;
+  int patched = 0;
+  int elem_size = 0, typed_transform = BBP_TYPED_SHUFFLE;
+  size_t chunk = BBP_DEFAULT_CHUNK_SIZE;
+  char mode;
+  Io_Reader reader;
+  Io_Writer writer;
+  FILE *info = stdout;
   
   struct timespec start, stop, start_full, stop_full;
   
+  while ((opt = getopt(argc, argv, "i:j:c:xt:")) != -1) {
+    switch (opt) {
+      case 'i' :
+        io = io_backend_parse(optarg);
+        if (io < 0)
+          help();
+        break;
+      case 'j' :
+        threads = atoi(optarg);
+        if (threads < 1)
+          help();
+        break;
+      case 'c' :
+        chunk = parse_size(optarg);
+        if (!chunk || chunk % BBP_ALIGNMENT || chunk > MAX_CHUNK_SIZE)
+          help();
+        break;
+      case 'x' :
+        patched = 1;
+        break;
+      case 't' :
+        elem_size = atoi(optarg);
+        if (elem_size != 2 && elem_size != 4 && elem_size != 8)
+          help();
+        if (strchr(optarg, 'x'))
+          typed_transform = BBP_TYPED_XOR;
+        break;
+      default :
+        help();
+    }
+  }
+  argc -= optind-1;
+  argv += optind-1;
+  
   if (argc != 7 && argc != 4)
     help();
   if (strlen(argv[1]) != 1)
     help();
+  mode = argv[1][0];
   if (argc == 7) {
     bs = atoi(argv[4]);
-    bs2 = atoi(argv[5]);
+    split = strchr(argv[4], '/');
+    if (split) {
+      bs_split = atoi(split+1);
+      if (bs_split < 4 || bs_split & (bs_split-1) || bs_split*4 > (bs ? bs : 512))
+        help();
+    }
+    bs2 = !strcmp(argv[5], "r") ? BBP_BS_R_RANS : atoi(argv[5]);
     if (bs && (bs < 4 || bs > BBP_MAX_BLOCK_SIZE))
       help();
-    if (bs2 > 0 && (bs2 < 4 || bs > BBP_MAX_BLOCK_SIZE))
+    if (bs2 > 0 && (bs2 < 4 || bs2 > BBP_MAX_BLOCK_SIZE))
       help();
     offset = atoi(argv[6]);
     assert(offset >= 16);
+    //the frame types don't combine
+    if (!!patched + !!elem_size + !!bs_split > 1)
+      help();
   }
   else
-    if (argv[1][0] != 'd')
+    if (mode != 'd')
       help();
   
   //file handling
-  in = fopen(argv[2], "r");
-  assert(in);
+  if (!strcmp(argv[2], "-"))
+    in_fd = STDIN_FILENO;
+  else
+    in_fd = open(argv[2], O_RDONLY);
+  assert(in_fd != -1);
 
-  out_fd = open(argv[3], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
-  assert(out_fd != -1);
-  
-  fstat(fileno(in), &st);
-  full_len = st.st_size;
-  
-#ifdef USE_MMAP
-  switch(argv[1][0]) {
-    case 'e' : out_mapped = full_len*2;   break;
-    case 'd' : out_mapped = CHUNK_SIZE*8; break;
-    case 'm' : out_mapped = full_len; break;
+  if (!strcmp(argv[3], "-")) {
+    out_fd = STDOUT_FILENO;
+    //keep the stream clean
+    info = stderr;
   }
-#endif
+  else
+    out_fd = open(argv[3], O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  assert(out_fd != -1);
   
   //initialisation
-#ifndef USE_MMAP_READ
-  posix_memalign(&in_buf, BBP_ALIGNMENT, bbp_max_compressed_size(CHUNK_SIZE));
-  //in_buf = malloc(bbp_max_compressed_size(CHUNK_SIZE));
-#else
-  in_map = mmap(NULL, full_len, PROT_READ, MAP_SHARED, fileno(in), 0);
-  if (in_map == MAP_FAILED) {
-    printf("WARNING: mmap failed for %s, using regular write\n", argv[2]);
-    in_map = NULL;
-    posix_memalign(&in_buf, BBP_ALIGNMENT, bbp_max_compressed_size(CHUNK_SIZE));
-    //in_buf = malloc(bbp_max_compressed_size(CHUNK_SIZE));
+  //for decoding the chunk size is only used to size buffers, frames are read according to their header
+  if (mode == 'd') {
+    reader_init(&reader, in_fd, io, segment_size(io, RU_N(bbp_max_compressed_size(chunk), 4096)), 16);
+    writer_init(&writer, out_fd, io, chunk, 16);
   }
-  else
-    in_buf = in_map;
-#endif
-#ifndef USE_MMAP_WRITE
-  posix_memalign(&out_buf, BBP_ALIGNMENT, bbp_max_compressed_size(CHUNK_SIZE));
-  //out_buf = malloc(bbp_max_compressed_size(CHUNK_SIZE));
-#else
-  ftruncate(out_fd, out_mapped);
-  out_map = mmap(NULL, out_mapped, PROT_WRITE, MAP_SHARED, out_fd, 0);
-  if (out_map == MAP_FAILED) {
-    printf("WARNING: mmap failed for %s, using regular write\n", argv[3]);
-    out_map = NULL;
-    posix_memalign(&out_buf, BBP_ALIGNMENT, bbp_max_compressed_size(CHUNK_SIZE));
-    //out_buf = malloc(bbp_max_compressed_size(CHUNK_SIZE));
+  else {
+    reader_init(&reader, in_fd, io, segment_size(io, chunk), BBP_ALIGNMENT);
+    writer_init(&writer, out_fd, io, bbp_max_compressed_size(chunk), BBP_ALIGNMENT);
   }
-  else
-    out_buf = out_map;
-#endif
   
   bbp_init();
   
-  switch(argv[1][0]) {
+  if (threads && mode != 'm') {
+    Pipeline_Params params = { mode, threads, bs, bs2, offset, chunk, bs_split, patched, elem_size, typed_transform };
+    Pipeline_Stats stats;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start_full);
+    pipeline_run(&reader, &writer, &params, &stats);
+    clock_gettime(CLOCK_MONOTONIC, &stop_full);
+    size = stats.size;
+    size_c = stats.size_c;
+    //first figure is the combined coding throughput of all threads
+    time = stats.time/threads;
+    if (mode == 'e') {
+      fprintf(info, "compressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
+      fprintf(info, "%.2f %.3f bbp-%d-%d\n",(float)size/size_c, (float)size/1024/1024*1000/time, offset, bs);
+      print_frame_overhead(info, size, size_c, chunk, offset);
+    }
+    else
+      fprintf(info, "decompressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
+  }
+  else switch(mode) {
     case 'e' :
       clock_gettime(CLOCK_MONOTONIC, &start_full);
-#ifndef USE_MMAP_READ
-      while ((len = fread(in_buf, 1, CHUNK_SIZE, in))) {
-#else
-      for(in_buf=in_map;in_buf-in_map<full_len;in_buf+=CHUNK_SIZE) {
-        len = full_len - (in_buf-in_map);
-        if (len > CHUNK_SIZE)
-          len = CHUNK_SIZE;
-#endif
+      while ((in_buf = reader_get(&reader, chunk, &got))) {
+        len = got;
+        out_buf = writer_buf(&writer, bbp_max_compressed_size(len));
 	clock_gettime(CLOCK_MONOTONIC, &start);
         //compression
         for(b=0;b<BENCHMARK_ITERATIONS;b++)
-          len_c = bbp_code_offset(in_buf, out_buf, bs, bs2, len, offset);
+          if (bs_split)
+            len_c = bbp_code_adaptive(in_buf, out_buf, bs, bs_split, bs2, len, offset);
+          else if (elem_size)
+            len_c = bbp_code_typed(in_buf, out_buf, bs, bs2, len, offset, elem_size, typed_transform);
+          else if (patched)
+            len_c = bbp_code_patched(in_buf, out_buf, bs, bs2, len, offset);
+          else
+            len_c = bbp_code_offset(in_buf, out_buf, bs, bs2, len, offset);
 	clock_gettime(CLOCK_MONOTONIC, &stop);
         time += ms_delta(start, stop);
 	size += len;
@@ -182,39 +288,29 @@ int main(int argc, char *argv[])
 
 #ifdef VERIFY_DECODE
 	bbp_header_sizes(out_buf, &len, &len_c);
-        void *test_buf1, test_buf2;
+        void *test_buf1, *test_buf2;
         posix_memalign(&test_buf1, BBP_ALIGNMENT, len_c);
         posix_memalign(&test_buf2, BBP_ALIGNMENT, len);
         memcpy(test_buf1, out_buf, len_c);
-        bbp_decode(out_buf, test_buf2);
+        bbp_decode(test_buf1, test_buf2);
         assert(!memcmp(test_buf2, in_buf, len));
         free(test_buf1);
         free(test_buf2);
 #endif
         
-        if (!out_map) {
-          len = write(out_fd, out_buf, len_c);
-          assert(len == len_c);
-        }
-        else
-          out_buf += len_c;
+        writer_commit(&writer, len_c);
       }
-      out_len = size_c;
       
       clock_gettime(CLOCK_MONOTONIC, &stop_full);
-      printf("compressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
-      printf("%.2f %.3f bbp-%d-%d\n",(float)size/size_c, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, offset, bs);
+      fprintf(info, "compressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
+      fprintf(info, "%.2f %.3f bbp-%d-%d\n",(float)size/size_c, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, offset, bs);
+      print_frame_overhead(info, size, size_c, chunk, offset);
       break;
     case 'm' :
       clock_gettime(CLOCK_MONOTONIC, &start_full);
-#ifndef USE_MMAP_READ
-      while ((len = fread(in_buf, 1, CHUNK_SIZE, in))) {
-#else
-      for(in_buf=in_map;in_buf-in_map<full_len;in_buf+=CHUNK_SIZE) {
-        len = full_len - (in_buf-in_map);
-        if (len > CHUNK_SIZE)
-          len = CHUNK_SIZE;
-#endif
+      while ((in_buf = reader_get(&reader, chunk, &got))) {
+        len = got;
+        out_buf = writer_buf(&writer, len);
 	clock_gettime(CLOCK_MONOTONIC, &start);
         //compression
         for(b=0;b<BENCHMARK_ITERATIONS;b++)
@@ -224,43 +320,17 @@ int main(int argc, char *argv[])
         time += ms_delta(start, stop);
 	size += len;
 	size_c += len_c;
-        if (!out_map) {
-          len = write(out_fd, out_buf, len_c);
-          assert(len == len_c);
-        }
-        else
-          out_buf += len_c;
+        writer_commit(&writer, len_c);
       }
-      out_len = size_c;
       
       clock_gettime(CLOCK_MONOTONIC, &stop_full);
-      printf("compressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
-      printf("%.2f %.3f memcpy\n",(float)size/size_c, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time);
+      fprintf(info, "compressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
+      fprintf(info, "%.2f %.3f memcpy\n",(float)size/size_c, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time);
       break;
     case 'd' :
       clock_gettime(CLOCK_MONOTONIC, &start_full);
-#ifndef USE_MMAP_READ
-      while ((len = fread(in_buf, 1, 64, in)) == 64) {
-	bbp_header_sizes(in_buf, &len, &len_c);
-	len = fread(in_buf+64, 1, len_c-64, in);
-	assert(len == len_c - 64);
-#else
-      for(in_buf=in_map;in_buf-in_map+64<full_len;in_buf+=len_c) {
-        if (out_buf-out_map+CHUNK_SIZE >= out_mapped) {
-          munmap(out_map, out_mapped);
-          out_mapped *= 2;
-          ftruncate(out_fd, out_mapped);
-          out_map = mmap(NULL, out_mapped, PROT_WRITE, MAP_SHARED, out_fd, 0);
-          assert(out_map != MAP_FAILED);
-          out_buf = out_map + size;
-        }
-        
-	bbp_header_sizes(in_buf, &len, &len_c);
-	if (len_c > full_len - (in_buf-in_map)) {
-          printf("ERROR: corrupt input!\n");
-          break;
-        }
-#endif
+      while ((in_buf = reader_frame(&reader, &len, &len_c))) {
+        out_buf = writer_buf(&writer, len);
 	clock_gettime(CLOCK_MONOTONIC, &start);
         //decompression
         len = bbp_decode(in_buf, out_buf);
@@ -268,26 +338,21 @@ int main(int argc, char *argv[])
         time += ms_delta(start, stop);
 	size += len;
 	size_c += len_c;
-        if (!out_map)
-          write(out_fd, out_buf, len);
-        else
-          out_buf += len;
+        writer_commit(&writer, len);
       }
-      out_len = size;
       
       clock_gettime(CLOCK_MONOTONIC, &stop_full);
-      printf("decompressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
+      fprintf(info, "decompressed at %.3fMB/s / %.3fMB/s ratio %.2f\n",(float)size/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
       break;
   }
   
-  if (in_map)
-    munmap(in_map, full_len);
-  fclose(in);
+  reader_close(&reader);
+  if (in_fd != STDIN_FILENO)
+    close(in_fd);
   
-  if (out_map)
-    munmap(out_map, full_len*2);
-  ftruncate(out_fd, out_len);
-  close(out_fd);
+  writer_close(&writer);
+  if (out_fd != STDOUT_FILENO)
+    close(out_fd);
   
   bbp_shutdown();
   
@@ -25,8 +25,9 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <signal.h>
 
-#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -34,104 +35,555 @@
 
 #include <time.h>
 
-#include "bbp.h"
+#include "common.h"
 
+/*
+ * Round trips random (len, bs, bs_r, offset, alignment) tuples. Every case
+ * is derived from the seed and its index only, so a failure is reproduced
+ * with -c <index> regardless of thread count or sharding.
+ */
+
+#define MAX_THREADS 256
+#define SLACK 4096 //room for the alignment shifts
+#define CANARY_LEN 64
+#define CANARY 0xA5
+#define MAX_BATCH 8
+
+typedef struct {
+  uint64_t index;
+  int len;
+  int bs, bs_r;
+  int level; //>= 0 codes with bbp_code_level() instead of bs/bs_r
+  int split; //> 0 codes with bbp_code_adaptive() and this split block size
+  int patched; //codes with bbp_code_patched()
+  int u32; //codes len/4 values with bbp_code_u32() and transform u32-1
+  int elem_size, xor; //elem_size > 0 codes with bbp_code_typed()
+  int batch, threads; //batch > 0 codes that many pieces of the input with bbp_code_batch() in threads
+  int offset;
+  int src_pos; //position of the input in the source data
+  int in_align, out_align, dec_align; //byte offsets of the buffers
+  uint8_t *src; //source data, t.src for the random cases
+  int fixed; //one of fixed_cases instead of a random case
+} Test_Case;
+
+typedef struct {
+  uint8_t *comp;
+  uint8_t *dec;
+  size_t comp_size, dec_size;
+  volatile int busy;
+  Test_Case cur; //for the crash report
+  uint64_t done;
+} Worker;
+
+typedef struct {
+  u4 seed;
+  uint64_t cases;
+  uint64_t next; //next case index, atomic
+  int shard, shards;
+  int max_len;
+  uint8_t *src;
+  int src_len;
+  int verbose;
+  int inner_chunk; //bbp_inner_chunk() of the run, from the seed
+} Tester;
+
+static Tester t;
+static Worker workers[MAX_THREADS];
+static int worker_count;
 
-#define COMP_CHUNK_SIZE (16*1024*1024)
+/*
+ * geometries the random cases rarely hit, run before them on fixed_src:
+ * 64 bit elements with a slowly rising high byte over random low bytes,
+ * so typed frames code the high plane and store the others
+ */
+static Test_Case fixed_cases[] = {
+  //typed: the partial last row group (31 of 32 elements) and the raw tail fill a whole row group of the frame
+  { .len = 8*(32*1000+31)+7, .bs = 8, .bs_r = 256, .level = -1, .elem_size = 8, .xor = 1, .offset = 32 },
+  { .len = 8*(32*1809+31)+6, .bs = 16, .bs_r = 256, .level = -1, .elem_size = 8, .xor = 1, .offset = 32 },
+  { .len = 8*(32*1000+31)+7, .bs = 8, .bs_r = 256, .level = -1, .elem_size = 8, .xor = 0, .offset = 32 },
+};
+
+static void print_case(FILE *f, const char *msg, Test_Case *c)
+{
+  fprintf(f, "%s %scase %llu (seed %u, inner chunk %d): len %d level %d split %d patched %d u32 %d elem %d xor %d batch %d threads %d bs %d bs_r %d offset %d src_pos %d align in %d out %d dec %d\n", msg, c->fixed ? "fixed " : "",
+          (unsigned long long)c->index, (unsigned)t.seed, t.inner_chunk, c->len, c->level, c->split, c->patched, c->u32, c->elem_size, c->xor, c->batch, c->threads, c->bs, c->bs_r, c->offset, c->src_pos,
+          c->in_align, c->out_align, c->dec_align);
+}
 
-void check_decode(uint8_t *in, uint8_t *comp, int len)
-{  
+//the library signals errors with assert()/abort(), report what was running
+static void crash_handler(int sig)
+{
   int i;
-  uint32_t size, size_c;
-  uint8_t *dec, *comp_cpy;
-  
-  bbp_header_sizes(comp, &size, &size_c);
-  
-  assert(size == len);
+
+  fprintf(stderr, "ERROR: signal %d\n", sig);
+  for(i=0;i<worker_count;i++)
+    if (workers[i].busy)
+      print_case(stderr, "ERROR: in flight", &workers[i].cur);
+
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+static int pick_block_size(ranctx *r)
+{
+  return 4 << (ranval(r) % 11);
+}
+
+static void case_gen(Test_Case *c, uint64_t index)
+{
+  ranctx r;
+  u4 p;
+
+  raninit(&r, t.seed*0x9E3779B1u + (u4)index + (u4)(index >> 32)*0x85EBCA6Bu);
+  c->index = index;
+
+  //mostly small frames, where the edge cases are, some up to max_len
+  p = ranval(&r) % 100;
+  if (p < 50)
+    c->len = 1 + ranval(&r) % 4096;
+  else if (p < 80)
+    c->len = 1 + ranval(&r) % 262144;
+  else
+    c->len = 1 + ranval(&r) % t.max_len;
+  if (c->len > t.max_len)
+    c->len = 1 + c->len % t.max_len;
+
+  c->bs = ranval(&r) % 10 ? pick_block_size(&r) : 0;
+
+  p = ranval(&r) % 10;
+  if (p < 2)
+    c->bs_r = -1;
+  else if (p < 3)
+    c->bs_r = 0;
+  else if (p < 4)
+    c->bs_r = BBP_BS_R_RANS;
+  else
+    c->bs_r = pick_block_size(&r);
+
+  p = ranval(&r) % 10;
+  if (p < 2)
+    c->offset = BBP_ALIGNMENT;
+  else if (p < 4)
+    //aligned kernels, 64 uses the register variant
+    c->offset = BBP_ALIGNMENT * (1 + ranval(&r) % 64);
+  else if (p < 8)
+    c->offset = BBP_ALIGNMENT + ranval(&r) % 4096;
+  else
+    c->offset = BBP_ALIGNMENT + ranval(&r) % 65536;
+
+  c->src = t.src;
+  c->src_pos = ranval(&r) % (t.src_len - c->len + 1);
+  //the encoder needs BBP_ALIGNMENT, the decoder 16 byte alignment
+  c->in_align = BBP_ALIGNMENT * (ranval(&r) % (SLACK/BBP_ALIGNMENT));
+  c->out_align = BBP_ALIGNMENT * (ranval(&r) % (SLACK/BBP_ALIGNMENT));
+  c->dec_align = 16 * (ranval(&r) % (SLACK/16));
+
+  //drawn last, so the other parameters of a seed stay the same
+  p = ranval(&r) % 10;
+  c->level = p < 1 ? (int)(ranval(&r) % (BBP_LEVEL_MAX+1)) : -1;
   
-  comp_cpy = malloc(size_c);
-  dec = malloc(size);
-  //printf("dec: %p\n", dec);
+  //adaptive frames need bs >= 4*split, a bs of 0 is the default of 512 there
+  p = ranval(&r) % 10;
+  c->split = 0;
+  if (p < 2 && c->level < 0 && (!c->bs || c->bs >= 16)) {
+    c->split = 4 << (ranval(&r) % 8);
+    while (c->split*4 > (c->bs ? c->bs : 512))
+      c->split /= 2;
+  }
+
+  p = ranval(&r) % 10;
+  c->patched = p < 2 && c->level < 0 && !c->split;
   
-  memcpy(comp_cpy, comp, size_c);
+  //32 bit frames take whole values and at most 1024 per block
+  p = ranval(&r) % 10;
+  c->u32 = p < 2 && c->level < 0 && !c->split && !c->patched && c->len >= 4 ? 1 + p : 0;
+  if (c->u32) {
+    c->len &= ~3;
+    if (c->bs > 1024)
+      c->bs = 1024;
+  }
   
-  bbp_decode(comp_cpy, dec);
+  p = ranval(&r) % 10;
+  c->elem_size = p < 2 && c->level < 0 && !c->split && !c->patched && !c->u32 ? 2 << (ranval(&r) % 3) : 0;
+  c->xor = c->elem_size ? ranval(&r) % 2 : 0;
   
+  p = ranval(&r) % 10;
+  c->batch = p < 1 && c->level < 0 && !c->split && !c->patched && !c->u32 && !c->elem_size ? 1 + ranval(&r) % MAX_BATCH : 0;
+  if (c->batch > c->len)
+    c->batch = c->len;
+  c->threads = c->batch ? ranval(&r) % 4 : 0;
+}
+
+/*
+ * batch cases cut the input at batch-1 random points, code the pieces from
+ * aligned copies at the start of dec and decode them back into dec, the
+ * batch is at the start of comp
+ */
+static int case_run_batch(Worker *w, Test_Case *c)
+{
+  int i, count;
+  int cut[MAX_BATCH+1];
+  size_t pos, size, max_c;
+  ranctx r;
+  Bbp_Batch_Item items[MAX_BATCH], dec_items[MAX_BATCH];
+  uint8_t *comp = w->comp;
+
+  //sorted points in [0, len-batch], the i-th moved up by i, so no piece is empty
+  raninit(&r, (u4)c->index);
+  cut[0] = 0;
+  for(i=1;i<c->batch;i++) {
+    int j, v = ranval(&r) % (c->len-c->batch+1);
+    for(j=i;j>1 && cut[j-1] > v;j--)
+      cut[j] = cut[j-1];
+    cut[j] = v;
+  }
+  for(i=1;i<c->batch;i++)
+    cut[i] += i;
+  cut[c->batch] = c->len;
+
+  pos = 0;
+  for(i=0;i<c->batch;i++) {
+    items[i].in = w->dec+pos;
+    items[i].len = cut[i+1]-cut[i];
+    memcpy(items[i].in, c->src + c->src_pos + cut[i], items[i].len);
+    pos += RU_N((size_t)items[i].len, BBP_ALIGNMENT);
+  }
+
+  max_c = bbp_max_batch_size(c->batch, c->len);
+  memset(comp+max_c, CANARY, CANARY_LEN);
+  size = bbp_code_batch(items, c->batch, comp, c->bs, c->bs_r, c->offset, c->threads);
+
+  for(i=0;i<CANARY_LEN;i++)
+    if (comp[max_c+i] != CANARY) {
+      print_case(stderr, "ERROR: encoder wrote past bbp_max_batch_size()", c);
+      return 0;
+    }
+
+  count = bbp_batch_count(comp);
+  if (count != c->batch || bbp_batch_items(comp, dec_items) != count || size > max_c || size % BBP_ALIGNMENT) {
+    print_case(stderr, "ERROR: bad batch table", c);
+    return 0;
+  }
+  for(i=0;i<count;i++)
+    if (dec_items[i].in != items[i].out || dec_items[i].len != items[i].len || dec_items[i].len_c != items[i].len_c) {
+      fprintf(stderr, "ERROR: item %d of the table doesn't match the coded frame\n", i);
+      print_case(stderr, "ERROR: bad batch table", c);
+      return 0;
+    }
+
+  pos = 0;
+  for(i=0;i<count;i++) {
+    dec_items[i].out = w->dec+pos;
+    pos += RU_N((size_t)dec_items[i].len+CANARY_LEN, 16);
+  }
+  memset(w->dec, CANARY, pos);
+  for(i=0;i<count;i++)
+    memset(dec_items[i].out, 0, dec_items[i].len);
+
+  if (bbp_decode_batch(comp, dec_items, c->threads) != count) {
+    print_case(stderr, "ERROR: bad decoded count", c);
+    return 0;
+  }
+
+  for(i=0;i<count;i++) {
+    if (memcmp(dec_items[i].out, c->src + c->src_pos + cut[i], dec_items[i].len)) {
+      fprintf(stderr, "ERROR: mismatch in item %d\n", i);
+      print_case(stderr, "ERROR: round trip failed", c);
+      return 0;
+    }
+    if (dec_items[i].out[dec_items[i].len] != CANARY) {
+      print_case(stderr, "ERROR: decoder wrote past the output", c);
+      return 0;
+    }
+  }
+
+  //any tile also decodes on its own
+  i = c->index % count;
+  memset(dec_items[i].out, 0, dec_items[i].len);
+  if (bbp_decode_batch_item(comp, i, &dec_items[i]) != dec_items[i].len || memcmp(dec_items[i].out, c->src + c->src_pos + cut[i], dec_items[i].len)) {
+    fprintf(stderr, "ERROR: item %d decoded on its own doesn't match\n", i);
+    print_case(stderr, "ERROR: round trip failed", c);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int case_run(Worker *w, Test_Case *c)
+{
+  int i, len_c;
+  uint32_t size, size_c;
+  uint32_t max_c = bbp_max_compressed_size(c->len);
+  uint8_t *in, *comp, *dec;
+
+  if (c->batch)
+    return case_run_batch(w, c);
+
+  //the input has to be at an aligned address, so it is copied into dec first
+  in = w->dec + c->in_align;
+  memcpy(in, c->src + c->src_pos, c->len);
+  comp = w->comp + c->out_align;
+  memset(comp+max_c, CANARY, CANARY_LEN);
+
+  if (c->level >= 0)
+    len_c = bbp_code_level(in, comp, c->len, c->offset, c->level);
+  else if (c->split)
+    len_c = bbp_code_adaptive(in, comp, c->bs, c->split, c->bs_r, c->len, c->offset);
+  else if (c->elem_size)
+    len_c = bbp_code_typed(in, comp, c->bs, c->bs_r, c->len, c->offset, c->elem_size, c->xor ? BBP_TYPED_XOR : BBP_TYPED_SHUFFLE);
+  else if (c->u32)
+    len_c = bbp_code_u32((uint32_t*)in, comp, c->bs, c->bs_r, c->len/4, c->u32-1);
+  else if (c->patched)
+    len_c = bbp_code_patched(in, comp, c->bs, c->bs_r, c->len, c->offset);
+  else
+    len_c = bbp_code_offset(in, comp, c->bs, c->bs_r, c->len, c->offset);
+
+  for(i=0;i<CANARY_LEN;i++)
+    if (comp[max_c+i] != CANARY) {
+      print_case(stderr, "ERROR: encoder wrote past bbp_max_compressed_size()", c);
+      return 0;
+    }
+
+  bbp_header_sizes(comp, &size, &size_c);
+  if (size != c->len || size_c != len_c || len_c > max_c || len_c % BBP_ALIGNMENT) {
+    fprintf(stderr, "ERROR: header sizes %u/%u, returned %d, max %u\n", size, size_c, len_c, max_c);
+    print_case(stderr, "ERROR: bad header", c);
+    return 0;
+  }
+
+  //move the compressed data so decoding happens from a different alignment
+  memmove(w->comp + c->dec_align/BBP_ALIGNMENT*BBP_ALIGNMENT, comp, len_c);
+  comp = w->comp + c->dec_align/BBP_ALIGNMENT*BBP_ALIGNMENT;
+
+  dec = w->dec + c->dec_align;
+  memset(dec, 0, c->len);
+  memset(dec+c->len, CANARY, CANARY_LEN);
+
+  if (bbp_decode(comp, dec) != c->len) {
+    print_case(stderr, "ERROR: bad decoded size", c);
+    return 0;
+  }
+
+  if (memcmp(dec, c->src + c->src_pos, c->len)) {
+    for(i=0;i<c->len;i++)
+      if (dec[i] != c->src[c->src_pos+i])
+        break;
+    fprintf(stderr, "ERROR: first mismatch at byte %d\n", i);
+    print_case(stderr, "ERROR: round trip failed", c);
+    return 0;
+  }
+
+  for(i=0;i<CANARY_LEN;i++)
+    if (dec[c->len+i] != CANARY) {
+      print_case(stderr, "ERROR: decoder wrote past the output", c);
+      return 0;
+    }
+
+  return 1;
+}
+
+static void *worker_thread(void *data)
+{
+  Worker *w = data;
+  uint64_t index;
+
+  while ((index = __atomic_fetch_add(&t.next, 1, __ATOMIC_RELAXED)) < t.cases) {
+    if (index % t.shards != t.shard)
+      continue;
+    case_gen(&w->cur, index);
+    if (t.verbose)
+      print_case(stdout, "testing", &w->cur);
+    w->busy = 1;
+    if (!case_run(w, &w->cur))
+      exit(EXIT_FAILURE);
+    w->busy = 0;
+    w->done++;
+  }
+
+  return NULL;
+}
+
+//a mix of regions which need every bit width
+static void src_generate(uint8_t *buf, int len, u4 seed)
+{
+  int i, region, depth = 0;
+  uint8_t base = 0;
+  ranctx r;
+
+  raninit(&r, seed);
+  for(i=0;i<len;i++) {
+    region = i/4096;
+    if (!(i % 4096)) {
+      depth = ranval(&r) % 9;
+      base = ranval(&r);
+    }
+    if (depth)
+      buf[i] = base + i/(1+region%7) + (ranval(&r) & ((1 << depth)-1));
+    else
+      buf[i] = base;
+  }
+}
+
+static void fixed_src_generate(uint8_t *buf, int len)
+{
+  int i;
+  ranctx r;
+
+  raninit(&r, 0);
   for(i=0;i<len;i++)
-    if (dec[i] != in[i])
-      abort();
-    
-  free(dec);
-  free(comp_cpy);
+    buf[i] = i % 8 == 7 ? i/4096 : ranval(&r);
+}
+
+static int src_load(uint8_t *buf, int len, const char *path)
+{
+  int fd, got = 0, ret;
+
+  fd = open(path, O_RDONLY);
+  if (fd == -1)
+    return 0;
+  while (got < len && (ret = read(fd, buf+got, len-got)) > 0)
+    got += ret;
+  close(fd);
+  if (!got)
+    return 0;
+  //repeat short files
+  for(ret=got;ret<len;ret++)
+    buf[ret] = buf[ret-got];
+
+  return 1;
+}
+
+static void help(void)
+{
+  printf("usage: bbp_tester [options] [file]\n");
+  printf("round trips randomized (len, bs, bs_r, offset, alignment) cases, input is read from file or generated\n");
+  printf("  -j <n>       threads (default: number of cpus)\n");
+  printf("  -s <n>       seed (default 1)\n");
+  printf("  -n <n>       number of cases (default 10000)\n");
+  printf("  -l <size>    maximum frame length (default 4194304)\n");
+  printf("  -S <k>/<n>   only run the cases with index %% n == k\n");
+  printf("  -c <index>   only run the case with this index\n");
+  printf("  -v           print every case\n");
+  exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[])
 {
-  int len;
-  assert(argc == 2);
-  FILE *f = fopen(argv[1], "r");
-  assert(f);
-  
-  uint8_t *in_buf, *out_buf;
-  in_buf = malloc(COMP_CHUNK_SIZE);
-  out_buf = malloc(bbp_max_compressed_size(COMP_CHUNK_SIZE));
-  
-  len = fread(in_buf, 1, COMP_CHUNK_SIZE, f);
-  fclose(f);
-  
+  int opt, i;
+  int64_t single = -1;
+  uint8_t *fixed_src;
+  Test_Case *c;
+  uint64_t done = 0;
+  pthread_t threads[MAX_THREADS];
+  struct timespec start, stop;
+
+  t.seed = 1;
+  t.cases = 10000;
+  t.shards = 1;
+  t.max_len = 4*1024*1024;
+  worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  while ((opt = getopt(argc, argv, "j:s:n:l:S:c:v")) != -1) {
+    switch (opt) {
+      case 'j' : worker_count = atoi(optarg); break;
+      case 's' : t.seed = strtoul(optarg, NULL, 0); break;
+      case 'n' : t.cases = strtoull(optarg, NULL, 0); break;
+      case 'l' : t.max_len = atoi(optarg); break;
+      case 'S' :
+        if (sscanf(optarg, "%d/%d", &t.shard, &t.shards) != 2)
+          help();
+        break;
+      case 'c' : single = strtoll(optarg, NULL, 0); break;
+      case 'v' : t.verbose = 1; break;
+      default : help();
+    }
+  }
+
+  if (argc-optind > 1 || t.max_len < 1 || t.shards < 1 || t.shard < 0 || t.shard >= t.shards)
+    help();
+  if (worker_count < 1)
+    worker_count = 1;
+  if (worker_count > MAX_THREADS)
+    worker_count = MAX_THREADS;
+
+  if (single >= 0) {
+    t.next = single;
+    t.cases = single+1;
+    t.shard = 0;
+    t.shards = 1;
+    worker_count = 1;
+  }
+
+  t.src_len = t.max_len;
+  t.src = malloc(t.src_len);
+  assert(t.src);
+  if (argc-optind == 1) {
+    if (!src_load(t.src, t.src_len, argv[optind])) {
+      fprintf(stderr, "ERROR: could not read %s\n", argv[optind]);
+      return EXIT_FAILURE;
+    }
+  }
+  else
+    src_generate(t.src, t.src_len, t.seed);
+
+  for(i=0;i<worker_count;i++) {
+    workers[i].comp_size = bbp_max_compressed_size(t.max_len)+CANARY_LEN+SLACK;
+    workers[i].dec_size = t.max_len+CANARY_LEN+SLACK;
+    workers[i].comp = bbp_alloc(workers[i].comp_size);
+    workers[i].dec = bbp_alloc(workers[i].dec_size);
+    assert(workers[i].comp && workers[i].dec);
+  }
+
+  signal(SIGABRT, crash_handler);
+  signal(SIGSEGV, crash_handler);
+  signal(SIGBUS, crash_handler);
+
   bbp_init();
-  
-  assert(len == COMP_CHUNK_SIZE);
-  
-  for(len=1;len<COMP_CHUNK_SIZE;len++) {
-    printf("testing length %d\n", len);
-    bbp_code_offset(in_buf, out_buf, 4, 4, len, 16);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 8, 4, len, 16);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 16, 8, len, 16);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 32, 128, len, 16);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 128, 32, len, 16);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 2048, 32, len, 16);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 2048, 2048, len, 16);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 4, 4, len, 91);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 8, 4, len, 91);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 16, 8, len, 91);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 32, 128, len, 91);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 128, 32, len, 91);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 2048, 32, len, 91);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 2048, 2048, len, 91);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 4, 4, len, 1281);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 8, 4, len, 1281);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 16, 8, len, 1281);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 32, 128, len, 1281);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 128, 32, len, 1281);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 2048, 32, len, 1281);
-    check_decode(in_buf, out_buf, len);
-    bbp_code_offset(in_buf, out_buf, 2048, 2048, len, 1281);
-    check_decode(in_buf, out_buf, len);
-    if (len > 16000)
-      len += rand() % len/10;
+  //the larger cases also cover the large frame mode of bbp_decode()
+  bbp_stream_params(1024*1024, 256);
+  //a global setting, so it changes with the seed instead of per case
+  t.inner_chunk = bbp_inner_chunk(BBP_MIN_INNER_CHUNK << t.seed % 5);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (single < 0) {
+    fixed_src = malloc(t.max_len);
+    assert(fixed_src);
+    fixed_src_generate(fixed_src, t.max_len);
+    for(i=0;i<sizeof(fixed_cases)/sizeof(*fixed_cases);i++) {
+      c = &workers[0].cur;
+      *c = fixed_cases[i];
+      if (c->len > t.max_len)
+        continue;
+      c->index = i;
+      c->fixed = 1;
+      c->src = fixed_src;
+      if (t.verbose)
+        print_case(stdout, "testing", c);
+      workers[0].busy = 1;
+      if (!case_run(&workers[0], c))
+        exit(EXIT_FAILURE);
+      workers[0].busy = 0;
+    }
+    free(fixed_src);
   }
-  
+  for(i=0;i<worker_count;i++)
+    pthread_create(&threads[i], NULL, worker_thread, &workers[i]);
+  for(i=0;i<worker_count;i++) {
+    pthread_join(threads[i], NULL);
+    done += workers[i].done;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
   bbp_shutdown();
-  
+
+  printf("%llu cases ok (seed %u, inner chunk %d, shard %d/%d, %d threads) in %.1fs\n", (unsigned long long)done, (unsigned)t.seed, t.inner_chunk, t.shard, t.shards, worker_count,
+         (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1000000000.0);
+
+  for(i=0;i<worker_count;i++) {
+    bbp_free(workers[i].comp, workers[i].comp_size);
+    bbp_free(workers[i].dec, workers[i].dec_size);
+  }
+  free(t.src);
+
   return EXIT_SUCCESS;
 }
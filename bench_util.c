@@ -0,0 +1,266 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "bench_util.h"
+
+const char *perf_names[PERF_COUNT] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+
+double ms_delta(struct timespec start, struct timespec stop)
+{
+  return (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+const char *simd_string(void)
+{
+#if defined(BBP_USE_AVX2)
+  return "avx2";
+#elif defined(BBP_USE_SSE)
+  return "ssse3";
+#elif defined(BBP_USE_NEON)
+  return "neon";
+#else
+  return "none";
+#endif
+}
+
+int parse_size(const char *str, char **end)
+{
+  int size = strtol(str, end, 10);
+
+  switch (**end) {
+    case 'k' : case 'K' : size *= 1024; (*end)++; break;
+    case 'm' : case 'M' : size *= 1024*1024; (*end)++; break;
+  }
+
+  return size;
+}
+
+void parse_list(Param_List *l, const char *str)
+{
+  char *end;
+
+  l->count = 0;
+  while (*str && l->count < MAX_PARAMS) {
+    l->val[l->count++] = parse_size(str, &end);
+    if (*end == ',')
+      end++;
+    else if (*end) {
+      fprintf(stderr, "ERROR: could not parse list \"%s\"\n", str);
+      exit(EXIT_FAILURE);
+    }
+    str = end;
+  }
+}
+
+int parse_format(const char *str)
+{
+  if (!strcmp(str, "csv"))
+    return FORMAT_CSV;
+  if (!strcmp(str, "json"))
+    return FORMAT_JSON;
+  if (!strcmp(str, "table"))
+    return FORMAT_TABLE;
+  return -1;
+}
+
+//per byte for cycles and instructions, per KiB for misses
+static double perf_scale(int i, Perf_Values *v, double bytes)
+{
+  if (i == PERF_CYCLES || i == PERF_INSTRUCTIONS)
+    return v->val[i]/bytes;
+  return v->val[i]/bytes*1024;
+}
+
+static const char *perf_units[PERF_COUNT] = {"cyc/B", "ins/B", "l1d miss/KiB", "llc miss/KiB", "br miss/KiB"};
+static const char *perf_keys[PERF_COUNT] = {"cycles_per_byte", "instructions_per_byte", "l1d_misses_per_kib", "llc_misses_per_kib", "branch_misses_per_kib"};
+
+void perf_print_table(const char *label, Perf_Values *v, double bytes)
+{
+  int i, n = 0;
+
+  printf("    %s:", label);
+  for(i=0;i<PERF_COUNT;i++)
+    if (v->valid[i]) {
+      printf(" %s %.3f", perf_units[i], perf_scale(i, v, bytes));
+      n++;
+    }
+  if (!n)
+    printf(" no counters");
+  if (v->valid[PERF_CYCLES] && v->valid[PERF_INSTRUCTIONS] && v->val[PERF_CYCLES])
+    printf(" ipc %.2f", (double)v->val[PERF_INSTRUCTIONS]/v->val[PERF_CYCLES]);
+  printf("\n");
+}
+
+void perf_print_csv_header(const char *prefix)
+{
+  int i;
+
+  for(i=0;i<PERF_COUNT;i++)
+    printf(",%s%s", prefix, perf_keys[i]);
+}
+
+void perf_print_csv(Perf_Values *v, double bytes)
+{
+  int i;
+
+  for(i=0;i<PERF_COUNT;i++)
+    if (v->valid[i])
+      printf(",%.4f", perf_scale(i, v, bytes));
+    else
+      printf(",");
+}
+
+void perf_print_json(const char *name, Perf_Values *v, double bytes)
+{
+  int i;
+
+  printf(", \"%s\": {", name);
+  for(i=0;i<PERF_COUNT;i++)
+    if (v->valid[i])
+      printf("%s\"%s\": %.4f", i ? ", " : "", perf_keys[i], perf_scale(i, v, bytes));
+    else
+      printf("%s\"%s\": null", i ? ", " : "", perf_keys[i]);
+  printf("}");
+}
+
+#ifdef __linux__
+
+static int perf_event_open(struct perf_event_attr *attr)
+{
+  return syscall(__NR_perf_event_open, attr, 0, -1, -1, 0);
+}
+
+int perf_open(Perf_Counters *p)
+{
+  int i;
+  struct perf_event_attr attr;
+  static const uint32_t types[PERF_COUNT] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE};
+  static const uint64_t configs[PERF_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES};
+
+  p->available = 0;
+  for(i=0;i<PERF_COUNT;i++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = types[i];
+    attr.config = configs[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    p->fd[i] = perf_event_open(&attr);
+    if (p->fd[i] == -1)
+      fprintf(stderr, "WARNING: counter %s unavailable (%s)\n", perf_names[i], strerror(errno));
+    else
+      p->available++;
+  }
+
+  if (!p->available)
+    fprintf(stderr, "WARNING: no performance counters, check /proc/sys/kernel/perf_event_paranoid or the container seccomp profile\n");
+
+  return p->available;
+}
+
+void perf_close(Perf_Counters *p)
+{
+  int i;
+
+  for(i=0;i<PERF_COUNT;i++)
+    if (p->fd[i] != -1)
+      close(p->fd[i]);
+}
+
+void perf_start(Perf_Counters *p)
+{
+  int i;
+
+  for(i=0;i<PERF_COUNT;i++)
+    if (p->fd[i] != -1) {
+      ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_stop(Perf_Counters *p, Perf_Values *v)
+{
+  int i;
+  //value, time enabled, time running
+  uint64_t buf[3];
+
+  for(i=0;i<PERF_COUNT;i++)
+    if (p->fd[i] != -1)
+      ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+  for(i=0;i<PERF_COUNT;i++) {
+    if (p->fd[i] == -1 || read(p->fd[i], buf, sizeof(buf)) != sizeof(buf) || !buf[2])
+      continue;
+    if (buf[2] < buf[1])
+      buf[0] = (double)buf[0]*buf[1]/buf[2];
+    v->val[i] += buf[0];
+    v->valid[i] = 1;
+  }
+}
+
+#else
+
+int perf_open(Perf_Counters *p)
+{
+  int i;
+
+  for(i=0;i<PERF_COUNT;i++)
+    p->fd[i] = -1;
+  p->available = 0;
+  fprintf(stderr, "WARNING: performance counters are only supported on linux\n");
+
+  return 0;
+}
+
+void perf_close(Perf_Counters *p)
+{
+}
+
+void perf_start(Perf_Counters *p)
+{
+}
+
+void perf_stop(Perf_Counters *p, Perf_Values *v)
+{
+}
+
+#endif
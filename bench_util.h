@@ -0,0 +1,102 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_BENCH_UTIL_H
+#define _BBP_BENCH_UTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#define MAX_PARAMS 32
+
+#define FORMAT_TABLE 0
+#define FORMAT_CSV   1
+#define FORMAT_JSON  2
+
+typedef struct {
+  int count;
+  int val[MAX_PARAMS];
+} Param_List;
+
+#define PERF_CYCLES       0
+#define PERF_INSTRUCTIONS 1
+#define PERF_L1D_MISSES   2
+#define PERF_LLC_MISSES   3
+#define PERF_BRANCH_MISSES 4
+#define PERF_COUNT        5
+
+extern const char *perf_names[PERF_COUNT];
+
+/*
+ * hardware counters of the calling thread via perf_event_open, counters
+ * which can't be opened (containers, vms, paranoid settings) are skipped
+ */
+typedef struct {
+  int fd[PERF_COUNT]; //-1 if unavailable
+  int available; //number of opened counters
+} Perf_Counters;
+
+typedef struct {
+  uint64_t val[PERF_COUNT];
+  int valid[PERF_COUNT];
+} Perf_Values;
+
+//time stamp counter, 0 where not available
+static inline uint64_t cycles(void)
+{
+#ifdef HAVE_RDTSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+double ms_delta(struct timespec start, struct timespec stop);
+//name of the simd instruction set the library was built for
+const char *simd_string(void);
+//parse an integer with optional k/m suffix, *end points behind it
+int parse_size(const char *str, char **end);
+//comma separated list of (possibly negative) values with optional k/m suffix, exits on errors
+void parse_list(Param_List *l, const char *str);
+//open all counters, prints a warning for unavailable ones, returns the number of usable counters
+int perf_open(Perf_Counters *p);
+void perf_close(Perf_Counters *p);
+void perf_start(Perf_Counters *p);
+//adds the counts since perf_start() to v (scaled if the counters were multiplexed)
+void perf_stop(Perf_Counters *p, Perf_Values *v);
+/* print per byte figures (cycles and instructions per byte, ipc, misses per KiB) for \p bytes processed,
+ * unavailable values are left empty (csv) or null (json)
+ */
+void perf_print_table(const char *label, Perf_Values *v, double bytes);
+void perf_print_csv_header(const char *prefix);
+void perf_print_csv(Perf_Values *v, double bytes);
+void perf_print_json(const char *name, Perf_Values *v, double bytes);
+//returns FORMAT_* for "table", "csv" or "json", -1 else
+int parse_format(const char *str);
+
+#endif
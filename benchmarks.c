@@ -33,6 +33,8 @@
 #include <fcntl.h>
 #include <stdint.h>
 
+#include "bbp.h"
+
 #ifdef BBP_USE_SIMDCOMP
 #include <simdcomp.h>
 #endif
@@ -74,6 +76,23 @@ size_t compress(uint32_t * datain, size_t length, uint8_t * buffer) {
 	}
 	return buffer - initout;
 }
+
+/* decompresses data from buffer to backbuffer, returns how many bytes read */
+size_t uncompress(uint8_t * buffer, size_t length, uint32_t * backbuffer) {
+    uint32_t offset;
+    uint8_t * initin;
+    size_t k;
+    offset = 0;
+    initin = buffer;
+	for(k = 0; k < length / SIMDBlockSize; ++k) {
+        uint8_t b = *buffer++;
+		simdunpackd1(offset, (__m128i *) buffer, backbuffer, b);
+        offset = backbuffer[SIMDBlockSize - 1];
+        buffer += b * sizeof(__m128i);
+        backbuffer += SIMDBlockSize;
+	}
+	return buffer - initin;
+}
 #endif
 
 //cached 128KiB (fread/fwrite) 2060MiB/s
@@ -94,6 +113,11 @@ size_t compress(uint32_t * datain, size_t length, uint8_t * buffer) {
 
 void help(void)
 {
+  printf("usage: benchmarks <mode> <in> <out> [<codec> [<level>]]\n");
+  printf("modes: 'e' simdcomp (d1, 128 values per block, needs -D build_with_simdcomp=on),\n");
+  printf("       'u' bbp_code_u32(), <codec> is the block size (default 128), <level> 'd1' (default) or 'for',\n");
+  printf("       's' squash with <codec> and <level>\n");
+  printf("e and u code 32 bit integers and verify the round trip\n");
   exit(EXIT_FAILURE);
 }
 
@@ -110,6 +134,9 @@ int main(int argc, char *argv[])
   void *out_map = NULL;
   int out_fd;
   double time = 0.0;
+  double time_dec = 0.0;
+  int bs = 0, transform = BBP_U32_D1;
+  void *dec_buf;
 #ifdef USE_MMAP
   uint64_t out_mapped;
 #endif
@@ -119,7 +146,7 @@ int main(int argc, char *argv[])
   if (argc < 4 || argc > 6)
     help();
   if (argc == 5 || argc == 6)
-    assert(*argv[1] == 's');
+    assert(*argv[1] == 's' || *argv[1] == 'u');
   if (strlen(argv[1]) != 1)
     help();
   
@@ -142,8 +169,12 @@ int main(int argc, char *argv[])
 #endif
   
   //initialisation
+  //bbp needs BBP_ALIGNMENT for in- and output
+  if (posix_memalign(&dec_buf, BBP_ALIGNMENT, CHUNK_SIZE))
+    abort();
 #ifndef USE_MMAP_READ
-  in_buf = malloc(CHUNK_SIZE);
+  if (posix_memalign(&in_buf, BBP_ALIGNMENT, CHUNK_SIZE))
+    abort();
 #else
   in_map = mmap(NULL, full_len, PROT_READ, MAP_SHARED, fileno(in), 0);
   if (in_map == MAP_FAILED) {
@@ -155,7 +186,8 @@ int main(int argc, char *argv[])
     in_buf = in_map;
 #endif
 #ifndef USE_MMAP_WRITE
-  out_buf = malloc(2*CHUNK_SIZE);
+  if (posix_memalign(&out_buf, BBP_ALIGNMENT, 2*CHUNK_SIZE))
+    abort();
 #else
   ftruncate(out_fd, out_mapped);
   out_map = mmap(NULL, out_mapped, PROT_WRITE, MAP_SHARED, out_fd, 0);
@@ -192,6 +224,13 @@ int main(int argc, char *argv[])
 	size += len;
 	size_c += len_c;
         
+	clock_gettime(CLOCK_MONOTONIC, &start);
+        for(b=0;b<BENCHMARK_ITERATIONS;b++)
+          uncompress(out_buf, len/4, dec_buf);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+        time_dec += ms_delta(start, stop);
+        assert(!memcmp(in_buf, dec_buf, len));
+        
         if (!out_map) {
           len = write(out_fd, out_buf, len_c);
           assert(len == len_c);
@@ -203,9 +242,61 @@ int main(int argc, char *argv[])
       
       clock_gettime(CLOCK_MONOTONIC, &stop_full);
       printf("compressed at %.3f MB/s / %.3fMB/s ratio %.2f\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
-      printf("%.2f %.3f simdcomp\n",(float)size/size_c, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time);
+      printf("decompressed at %.3f MB/s\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time_dec);
+      printf("%.2f %.3f %.3f simdcomp\n",(float)size/size_c, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time_dec);
       break;
 #endif
+    //same measurement as for simdcomp above
+    case 'u' :
+      if (argc >= 5)
+        bs = atoi(argv[4]);
+      if (argc == 6)
+        transform = !strcmp(argv[5], "for") ? BBP_U32_FOR : BBP_U32_D1;
+      bbp_init();
+      clock_gettime(CLOCK_MONOTONIC, &start_full);
+#ifndef USE_MMAP_READ
+      while ((len = fread(in_buf, 1, CHUNK_SIZE, in))) {
+#else
+      for(in_buf=in_map;in_buf-in_map<full_len;in_buf+=CHUNK_SIZE) {
+        len = full_len - (in_buf-in_map);
+        if (len > CHUNK_SIZE)
+          len = CHUNK_SIZE;
+#endif
+        int b;
+        //trailing bytes of a file which are no full value are dropped
+        len &= ~3;
+        if (!len)
+          break;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+        for(b=0;b<BENCHMARK_ITERATIONS;b++)
+          len_c = bbp_code_u32(in_buf, out_buf, bs, 0, len/4, transform);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+        time += ms_delta(start, stop);
+	size += len;
+	size_c += len_c;
+        
+	clock_gettime(CLOCK_MONOTONIC, &start);
+        for(b=0;b<BENCHMARK_ITERATIONS;b++)
+          bbp_decode_u32(out_buf, dec_buf);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+        time_dec += ms_delta(start, stop);
+        assert(!memcmp(in_buf, dec_buf, len));
+        
+        if (!out_map) {
+          len = write(out_fd, out_buf, len_c);
+          assert(len == len_c);
+        }
+        else
+          out_buf += len_c;
+      }
+      out_len = size_c;
+      
+      clock_gettime(CLOCK_MONOTONIC, &stop_full);
+      printf("compressed at %.3f MB/s / %.3fMB/s ratio %.2f\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size/1024/1024*1000/ms_delta(start_full, stop_full), (float)size/size_c);
+      printf("decompressed at %.3f MB/s\n",(float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time_dec);
+      printf("%.2f %.3f %.3f bbp-u32-%s-%d\n",(float)size/size_c, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time, (float)size*BENCHMARK_ITERATIONS/1024/1024*1000/time_dec, transform == BBP_U32_FOR ? "for" : "d1", bs ? bs : 128);
+      bbp_shutdown();
+      break;
 #ifdef BBP_USE_SQUASH
     case 's' :
       assert(argc == 5 || argc == 6);
@@ -267,6 +358,7 @@ int main(int argc, char *argv[])
   if (in_map)
     munmap(in_map, full_len);
   fclose(in);
+  free(dec_buf);
   
   if (out_map)
     munmap(out_map, full_len*2);
@@ -98,7 +98,7 @@ void get_next_block(Block_Coder_Data *b, const int block_size)
 /*
  * push current block to buf and write out if necessary
  */
-CFINLINE void next_signal(Block_Coder_Data *b, uint8_t signal)
+static CFINLINE void next_signal(Block_Coder_Data *b, uint8_t signal)
 {
   *b->cur_signal = signal;
   b->cur_signal++;
@@ -117,7 +117,7 @@ uint8_t get_next_signal(Block_Coder_Data *b)
 }
 
 
-CFINLINE inline void push_block_1(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
+static CFINLINE inline void push_block_1(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
 {
   int i;
   int shift;
@@ -149,7 +149,7 @@ CFINLINE inline void push_block_1(Block_Coder_Data *b, uint8_t bits, uint8_t *bl
 }
 
 
-CFINLINE void pull_block_1(Block_Coder_Data *b, uint8_t *block, const int block_size)
+static CFINLINE void pull_block_1(Block_Coder_Data *b, uint8_t *block, const int block_size)
 {
   int i;
   int shift;
@@ -190,8 +190,47 @@ CFINLINE void pull_block_1(Block_Coder_Data *b, uint8_t *block, const int block_
   }
 }
 
-#ifdef BBP_USE_SSE
-CFINLINE void pull_block_8(Block_Coder_Data *b, uint8_t *block, const int block_size)
+/*
+ * the 4 and 8 byte kernels shift 32/64 bit words, which only needs integer
+ * registers, so they are also the unpack of builds without SIMD
+ */
+static CFINLINE void pull_block_4(Block_Coder_Data *b, uint8_t *block, const int block_size)
+{
+  int i;
+  int shift;
+  uint32_t mask;
+  uint8_t bits = get_next_signal(b);
+  
+  if (!bits) {
+    for(i=0;i<block_size;i++)
+      block[i] = 0;
+    
+    return;
+  }
+  
+  if (b->cur_block_free_bits >= bits) {
+    b->cur_block_free_bits -= bits;
+    mask = mask4_r[8-bits];
+    
+    for(i=0;i<block_size/4;i++)
+      ((uint32_t*)block)[i] = (((uint32_t*)b->cur_block)[i] >> b->cur_block_free_bits) & mask;
+  }
+  else {
+    //first use up remaining free bits
+    shift = bits - b->cur_block_free_bits;
+    mask = mask4_r[8-b->cur_block_free_bits];
+    for(i=0;i<block_size/4;i++)
+      ((uint32_t*)block)[i] = (((uint32_t*)b->cur_block)[i] & mask) << shift;
+    get_next_block(b, block_size);
+    //then write remaining bits into new block
+    b->cur_block_free_bits = 8 + b->cur_block_free_bits - bits;
+    mask = mask4_l[b->cur_block_free_bits];
+    for(i=0;i<block_size/4;i++)
+      ((uint32_t*)block)[i] |= (((uint32_t*)b->cur_block)[i] & mask) >> b->cur_block_free_bits;
+  }
+}
+
+static CFINLINE void pull_block_8(Block_Coder_Data *b, uint8_t *block, const int block_size)
 {
   int i;
   int shift;
@@ -227,7 +266,8 @@ CFINLINE void pull_block_8(Block_Coder_Data *b, uint8_t *block, const int block_
   }
 }
 
-CFINLINE void pull_block_16(Block_Coder_Data *b, uint8_t *block, int block_size)
+#ifdef BBP_USE_SSE
+static CFINLINE void pull_block_16(Block_Coder_Data *b, uint8_t *block, int block_size)
 {
   int i;
   int shift;
@@ -281,15 +321,17 @@ CFINLINE void pull_block(Block_Coder_Data *b, uint8_t *block, const int block_si
 #ifdef BBP_USE_SSE
   if (block_size >= 16)
     pull_block_16(b, block, block_size);
-   else if (block_size >= 8)
-     pull_block_8(b, block, block_size);
   else
 #endif
-//TODO implement pull_block_4!
+  if (block_size >= 8)
+    pull_block_8(b, block, block_size);
+  else if (block_size >= 4)
+    pull_block_4(b, block, block_size);
+  else
     pull_block_1(b, block, block_size);
 }
 
-CFINLINE void push_block_4(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
+static CFINLINE void push_block_4(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
 {
   int i;
   int shift;
@@ -325,9 +367,7 @@ CFINLINE void push_block_4(Block_Coder_Data *b, uint8_t bits, uint8_t *block, co
   }
 }
 
-#ifdef BBP_USE_SSE
-
-CFINLINE void push_block_8(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
+static CFINLINE void push_block_8(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
 {
   int i;
   int shift;
@@ -362,10 +402,9 @@ CFINLINE void push_block_8(Block_Coder_Data *b, uint8_t bits, uint8_t *block, co
       cur_block_8[i] = (block_8[i] & mask) << b->cur_block_free_bits;
   }
 }
-#endif
 
 #ifdef BBP_USE_SSE
-CFINLINE void push_block_16(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
+static CFINLINE void push_block_16(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
 {
   int i;
   int shift;
@@ -415,7 +454,7 @@ CFINLINE void push_block_16(Block_Coder_Data *b, uint8_t bits, uint8_t *block, c
 
 
 #ifdef BBP_USE_AVX2
-CFINLINE void push_block_32(Block_Coder_Data *b, uint8_t bits, uint8_t *block_u8, const int block_size)
+static CFINLINE void push_block_32(Block_Coder_Data *b, uint8_t bits, uint8_t *block_u8, const int block_size)
 {
   int i;
   int shift;
@@ -465,7 +504,7 @@ CFINLINE void push_block_32(Block_Coder_Data *b, uint8_t bits, uint8_t *block_u8
 #endif
 
 #ifdef BBP_USE_NEON
-CFINLINE void push_block_16(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
+static CFINLINE void push_block_16(Block_Coder_Data *b, uint8_t bits, uint8_t *block, const int block_size)
 {
   int i;
   int shift;
@@ -508,8 +547,108 @@ CFINLINE void push_block_16(Block_Coder_Data *b, uint8_t bits, uint8_t *block, c
   }
 }
 #endif
+
 /*
-CFINLINE void push_block(Block_Coder_Data *b, int bits, uint8_t *diff, const int block_size)
+ * 4 and 8 byte blocks a chunk at a time: the current word stays in a
+ * register and is stored once it is full (and at the end), instead of a
+ * read-modify-write of the stream for every block, the signal and the state
+ * are kept in locals, which the compiler can't do for stores through b.
+ * 4 byte blocks use the low half of the 64 bit lanes.
+ */
+static inline void push_blocks_small_bs(Block_Coder_Data *b, int *bits, uint8_t *diff, const int block_size, int count)
+{
+  int n, w, f;
+  uint64_t x, acc;
+  uint8_t *word = b->cur_block;
+  uint8_t *signal = b->cur_signal;
+  
+  f = b->cur_block_free_bits;
+  acc = block_size == 4 ? *(uint32_t*)word : *(uint64_t*)word;
+  for(n=0;n<count;n++) {
+    w = bits[n];
+    signal[n] = w;
+    x = block_size == 4 ? *(uint32_t*)(diff+n*4) : *(uint64_t*)(diff+n*8);
+    if (f >= w) {
+      f -= w;
+      acc |= x << f;
+    }
+    else {
+      acc |= (x >> (w-f)) & mask8_r[8-f];
+      if (block_size == 4)
+        *(uint32_t*)word = acc;
+      else
+        *(uint64_t*)word = acc;
+      word += block_size;
+      f += 8-w;
+      acc = (x << f) & mask8_l[f];
+    }
+  }
+  if (block_size == 4)
+    *(uint32_t*)word = acc;
+  else
+    *(uint64_t*)word = acc;
+  
+  b->cur_signal = signal+count;
+  b->cur_block = word;
+  b->cur_block_free_bits = f;
+}
+
+void push_blocks_small(Block_Coder_Data *b, int *bits, uint8_t *diff, const int block_size, int count)
+{
+  if (block_size == 4)
+    push_blocks_small_bs(b, bits, diff, 4, count);
+  else
+    push_blocks_small_bs(b, bits, diff, 8, count);
+}
+
+/*
+ * the reverse, the current word is loaded once and the next one only when
+ * a block is split
+ */
+static inline void pull_blocks_small_bs(Block_Coder_Data *b, uint8_t *diff, const int block_size, int count)
+{
+  int n, w, f;
+  uint64_t cur, x;
+  uint8_t *word = b->cur_block;
+  uint8_t *signal = b->cur_signal;
+  
+  f = b->cur_block_free_bits;
+  cur = block_size == 4 ? *(uint32_t*)word : *(uint64_t*)word;
+  for(n=0;n<count;n++) {
+    w = signal[n];
+    if (f >= w) {
+      f -= w;
+      x = (cur >> f) & mask8_r[8-w];
+    }
+    else {
+      x = (cur & mask8_r[8-f]) << (w-f);
+      word += block_size;
+      cur = block_size == 4 ? *(uint32_t*)word : *(uint64_t*)word;
+      f += 8-w;
+      x |= (cur >> f) & mask8_r[f];
+    }
+    
+    if (block_size == 4)
+      *(uint32_t*)(diff+n*4) = x;
+    else
+      *(uint64_t*)(diff+n*8) = x;
+  }
+  
+  b->cur_signal = signal+count;
+  b->cur_block = word;
+  b->cur_block_free_bits = f;
+}
+
+void pull_blocks_small(Block_Coder_Data *b, uint8_t *diff, const int block_size, int count)
+{
+  if (block_size == 4)
+    pull_blocks_small_bs(b, diff, 4, count);
+  else
+    pull_blocks_small_bs(b, diff, 8, count);
+}
+
+/*
+static CFINLINE void push_block(Block_Coder_Data *b, int bits, uint8_t *diff, const int block_size)
 {
 #ifdef BBP_USE_NEON
   if (block_size >= 16)
@@ -534,7 +673,7 @@ CFINLINE void push_block(Block_Coder_Data *b, int bits, uint8_t *diff, const int
   }
 }*/
 
-CFINLINE void push_block_chunk_dynamic(Block_Coder_Data *b, int *bits, uint8_t *diff, const int block_size, const int chunk_size)
+static CFINLINE void push_block_chunk_dynamic(Block_Coder_Data *b, int *bits, uint8_t *diff, const int block_size, const int chunk_size)
 {
   int i;
   
@@ -554,14 +693,13 @@ CFINLINE void push_block_chunk_dynamic(Block_Coder_Data *b, int *bits, uint8_t *
   if (block_size >= 16)
     for(i=0;i<chunk_size/block_size;i++)
       push_block_16(b, bits[i], diff+block_size*i, block_size);
-   else if (block_size == 8)
-     for(i=0;i<chunk_size/block_size;i++)
-       push_block_8(b, bits[i], diff+block_size*i, block_size);
   else
 #endif
-  if (block_size == 4)
+  if (block_size == 4 || block_size == 8)
+    push_blocks_small(b, bits, diff, block_size, chunk_size/block_size);
+  else if (block_size >= 8)
     for(i=0;i<chunk_size/block_size;i++)
-      push_block_4(b, bits[i], diff+block_size*i, block_size);
+      push_block_8(b, bits[i], diff+block_size*i, block_size);
   else
     for(i=0;i<chunk_size/block_size;i++)
       push_block_1(b, bits[i], diff+block_size*i, block_size);
@@ -586,3 +724,34 @@ void push_block_chunk(Block_Coder_Data *b, int *bits, uint8_t *diff, const int b
     default : abort();
   }
 }
+
+static CFINLINE void pull_block_chunk_dynamic(Block_Coder_Data *b, uint8_t *diff, const int block_size, const int chunk_size)
+{
+  int i;
+  
+  if (block_size == 4 || block_size == 8) {
+    pull_blocks_small(b, diff, block_size, chunk_size/block_size);
+    return;
+  }
+  for(i=0;i<chunk_size;i+=block_size)
+    pull_block(b, diff+i, block_size);
+}
+
+//pull_block() for chunk_size/block_size blocks with a block size only known at runtime
+void pull_block_chunk(Block_Coder_Data *b, uint8_t *diff, const int block_size, const int chunk_size)
+{
+  switch (block_size) {
+    case 4 : pull_block_chunk_dynamic(b,diff, 4, chunk_size); break;
+    case 8 : pull_block_chunk_dynamic(b,diff, 8, chunk_size); break;
+    case 16 : pull_block_chunk_dynamic(b,diff, 16, chunk_size); break;
+    case 32 : pull_block_chunk_dynamic(b,diff, 32, chunk_size); break;
+    case 64 : pull_block_chunk_dynamic(b,diff, 64, chunk_size); break;
+    case 128 : pull_block_chunk_dynamic(b,diff, 128, chunk_size); break;
+    case 256 : pull_block_chunk_dynamic(b,diff, 256, chunk_size); break;
+    case 512 : pull_block_chunk_dynamic(b,diff, 512, chunk_size); break;
+    case 1024 : pull_block_chunk_dynamic(b,diff, 1024, chunk_size); break;
+    case 2048 : pull_block_chunk_dynamic(b,diff, 2048, chunk_size); break;
+    case 4096 : pull_block_chunk_dynamic(b,diff, 4096, chunk_size); break;
+    default : abort();
+  }
+}
@@ -28,6 +28,7 @@
 
 void push_block_chunk(Block_Coder_Data *b, int *bits, uint8_t *diff, const int block_size, const int chunk_size);
 void pull_block(Block_Coder_Data *b, uint8_t *block, const int block_size);
+void pull_block_chunk(Block_Coder_Data *b, uint8_t *diff, const int block_size, const int chunk_size);
 void next_block(Block_Coder_Data *b, const int block_size);
 void init_masks(void);
 
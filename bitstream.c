@@ -45,7 +45,8 @@ CFINLINE void comp_coder_reset(Block_Coder_Data *b)
   b->block_byte_count = 0;
   b->signal_byte_count = 0;
   
-  memset(b->cur_block, 0, b->block_size);
+  //the first block is zeroed by the coder once the raw prefix is written, doing it here
+  //would write up to block_size bytes past the output for frames smaller than a block
   
   b->last = 0;
 }
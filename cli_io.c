@@ -0,0 +1,640 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "bbp.h"
+#include "cli_io.h"
+
+#define URING_SEGMENTS 8
+#define URING_BUFFERS 8
+#define PAGE_ALIGNMENT 4096
+//prefault mmapped input up to this size, larger inputs rely on sequential readahead
+#define POPULATE_MAX (1024*1024*1024)
+
+#define HEADER_SIZE 64
+
+//requested size of an output pipe, larger pipes mean fewer context switches
+#define OUTPUT_PIPE_SIZE (1024*1024)
+
+static const char *backend_names[] = { "read", "mmap", "uring" };
+
+const char *io_backend_name(int backend)
+{
+  return backend_names[backend];
+}
+
+int io_backend_parse(const char *name)
+{
+  int i;
+
+  for(i=0;i<=IO_BACKEND_URING;i++)
+    if (!strcmp(name, backend_names[i]))
+      return i;
+
+  return -1;
+}
+
+static void *alloc_aligned(size_t size)
+{
+  void *buf;
+
+  if (posix_memalign(&buf, PAGE_ALIGNMENT, size))
+    return NULL;
+
+  return buf;
+}
+
+static size_t read_full(int fd, uint8_t *buf, size_t len)
+{
+  ssize_t ret;
+  size_t done = 0;
+
+  while (done < len) {
+    ret = read(fd, buf+done, len-done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    assert(ret >= 0);
+    if (!ret)
+      break;
+    done += ret;
+  }
+
+  return done;
+}
+
+static size_t pread_full(int fd, uint8_t *buf, size_t len, uint64_t pos)
+{
+  ssize_t ret;
+  size_t done = 0;
+
+  while (done < len) {
+    ret = pread(fd, buf+done, len-done, pos+done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    assert(ret >= 0);
+    if (!ret)
+      break;
+    done += ret;
+  }
+
+  return done;
+}
+
+static void write_full(int fd, uint8_t *buf, size_t len)
+{
+  ssize_t ret;
+  size_t done = 0;
+
+  while (done < len) {
+    ret = write(fd, buf+done, len-done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    assert(ret > 0);
+    done += ret;
+  }
+}
+
+static void pwrite_full(int fd, uint8_t *buf, size_t len, uint64_t pos)
+{
+  ssize_t ret;
+  size_t done = 0;
+
+  while (done < len) {
+    ret = pwrite(fd, buf+done, len-done, pos+done);
+    if (ret < 0 && errno == EINTR)
+      continue;
+    assert(ret > 0);
+    done += ret;
+  }
+}
+
+static void bounce_reserve(uint8_t **bounce, size_t *size, size_t len)
+{
+  if (*size >= len)
+    return;
+
+  free(*bounce);
+  *bounce = alloc_aligned(len);
+  assert(*bounce);
+  *size = len;
+}
+
+/*
+ * reader
+ */
+
+static inline uint8_t *seg_ptr(Io_Reader *r, int i)
+{
+  return r->seg_mem + (size_t)i*r->seg_size;
+}
+
+//a short segment marks the end of the input
+static inline int seg_last(Io_Reader *r, int i)
+{
+  return r->seg_len[i] < (int64_t)r->seg_size || r->backend == IO_BACKEND_MMAP;
+}
+
+//start filling segment i with the next part of the input
+static void seg_fill(Io_Reader *r, int i)
+{
+  r->seg_pos[i] = r->next_pos;
+
+  if (r->eof) {
+    r->seg_len[i] = 0;
+    return;
+  }
+
+  switch (r->backend) {
+    case IO_BACKEND_READ :
+      r->seg_len[i] = read_full(r->fd, seg_ptr(r, i), r->seg_size);
+      if (r->seg_len[i] < r->seg_size)
+        r->eof = 1;
+      break;
+#ifdef BBP_USE_URING
+    case IO_BACKEND_URING :
+      r->seg_len[i] = -1;
+      uring_prep_read_fixed(&r->ring, r->fd, seg_ptr(r, i), r->seg_size, r->seg_pos[i], 0, i);
+      uring_submit(&r->ring);
+      break;
+#endif
+    default :
+      //mmap has a single segment which covers the whole file
+      r->seg_len[i] = 0;
+      r->eof = 1;
+  }
+
+  r->next_pos += r->seg_size;
+}
+
+static void seg_wait(Io_Reader *r, int i)
+{
+#ifdef BBP_USE_URING
+  uint64_t idx;
+  int res;
+
+  while (r->seg_len[i] < 0) {
+    res = uring_wait(&r->ring, &idx);
+    assert(res >= 0);
+    //short read: complete synchronously, if still short we reached the end of the file
+    if (res < (int64_t)r->seg_size)
+      res += pread_full(r->fd, seg_ptr(r, idx)+res, r->seg_size-res, r->seg_pos[idx]+res);
+    r->seg_len[idx] = res;
+  }
+#endif
+}
+
+//returns the number of bytes available in the current segment, 0 at the end of the input
+static size_t cur_ready(Io_Reader *r)
+{
+  while (1) {
+    seg_wait(r, r->cur);
+
+    if ((int64_t)r->pos < r->seg_len[r->cur])
+      return r->seg_len[r->cur] - r->pos;
+
+    if (seg_last(r, r->cur))
+      return 0;
+
+    seg_fill(r, r->cur);
+    r->cur = (r->cur+1) % r->seg_count;
+    r->pos = 0;
+  }
+}
+
+int reader_init(Io_Reader *r, int fd, int backend, size_t seg_size, int align)
+{
+  int i;
+  struct stat st;
+  uint8_t *map;
+
+  memset(r, 0, sizeof(Io_Reader));
+  r->fd = fd;
+  r->align = align;
+
+  assert(seg_size % align == 0);
+
+  if (backend == IO_BACKEND_MMAP) {
+    fstat(fd, &st);
+    map = MAP_FAILED;
+    if (S_ISREG(st.st_mode) && st.st_size)
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED | (st.st_size <= POPULATE_MAX ? MAP_POPULATE : 0), fd, 0);
+    if (map != MAP_FAILED)
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+    if (map == MAP_FAILED) {
+      fprintf(stderr, "WARNING: mmap failed for input, using regular read\n");
+      backend = IO_BACKEND_READ;
+    }
+    else {
+      r->backend = IO_BACKEND_MMAP;
+      r->seg_count = 1;
+      r->seg_size = st.st_size;
+      r->seg_mem = map;
+      r->map_len = st.st_size;
+      r->seg_len = calloc(1, sizeof(int64_t));
+      r->seg_pos = calloc(1, sizeof(uint64_t));
+      r->seg_len[0] = st.st_size;
+      r->eof = 1;
+      return r->backend;
+    }
+  }
+
+  if (backend == IO_BACKEND_URING) {
+    fstat(fd, &st);
+    if (!S_ISREG(st.st_mode)) {
+      fprintf(stderr, "WARNING: io_uring needs a regular file, using regular read\n");
+      backend = IO_BACKEND_READ;
+    }
+  }
+
+#ifdef BBP_USE_URING
+  if (backend == IO_BACKEND_URING) {
+    struct iovec iov;
+
+    r->seg_mem = bbp_alloc(URING_SEGMENTS*seg_size);
+    assert(r->seg_mem);
+    iov.iov_base = r->seg_mem;
+    iov.iov_len = URING_SEGMENTS*seg_size;
+    //register everything as one buffer, the sqe only needs to point inside it
+    if (uring_init(&r->ring, URING_SEGMENTS) || uring_register_buffers(&r->ring, &iov, 1)) {
+      fprintf(stderr, "WARNING: io_uring not available, using regular read\n");
+      bbp_free(r->seg_mem, URING_SEGMENTS*seg_size);
+      backend = IO_BACKEND_READ;
+    }
+    else {
+      r->backend = IO_BACKEND_URING;
+      r->seg_count = URING_SEGMENTS;
+    }
+  }
+#endif
+
+  if (r->backend != IO_BACKEND_URING) {
+    //double buffering, so reader_peek() may look into the next segment
+    r->backend = IO_BACKEND_READ;
+    r->seg_count = 2;
+    r->seg_mem = bbp_alloc(r->seg_count*seg_size);
+    assert(r->seg_mem);
+  }
+
+  r->seg_size = seg_size;
+  r->seg_len = calloc(r->seg_count, sizeof(int64_t));
+  r->seg_pos = calloc(r->seg_count, sizeof(uint64_t));
+
+  for(i=0;i<r->seg_count;i++)
+    seg_fill(r, i);
+
+  return r->backend;
+}
+
+void reader_close(Io_Reader *r)
+{
+#ifdef BBP_USE_URING
+  int i;
+  if (r->backend == IO_BACKEND_URING) {
+    for(i=0;i<r->seg_count;i++)
+      seg_wait(r, i);
+    uring_exit(&r->ring);
+  }
+#endif
+  if (r->backend == IO_BACKEND_MMAP)
+    munmap(r->seg_mem, r->map_len);
+  else
+    bbp_free(r->seg_mem, r->seg_count*r->seg_size);
+
+  free(r->seg_len);
+  free(r->seg_pos);
+  free(r->bounce);
+}
+
+int reader_stable(Io_Reader *r)
+{
+  return r->backend == IO_BACKEND_MMAP;
+}
+
+uint8_t *reader_get(Io_Reader *r, size_t len, size_t *got)
+{
+  size_t avail, n, c;
+  uint8_t *p;
+
+  avail = cur_ready(r);
+  if (!avail) {
+    *got = 0;
+    return NULL;
+  }
+
+  p = seg_ptr(r, r->cur) + r->pos;
+  if (!((uintptr_t)p % r->align) && (avail >= len || seg_last(r, r->cur))) {
+    if (len > avail)
+      len = avail;
+    r->pos += len;
+    *got = len;
+    return p;
+  }
+
+  bounce_reserve(&r->bounce, &r->bounce_size, len);
+
+  for(n=0;n<len && (avail = cur_ready(r));n+=c) {
+    c = len-n;
+    if (c > avail)
+      c = avail;
+    memcpy(r->bounce+n, seg_ptr(r, r->cur)+r->pos, c);
+    r->pos += c;
+  }
+
+  *got = n;
+  return r->bounce;
+}
+
+size_t reader_peek(Io_Reader *r, uint8_t *dst, size_t len)
+{
+  int i;
+  size_t pos, n, c;
+
+  if (!cur_ready(r))
+    return 0;
+
+  i = r->cur;
+  pos = r->pos;
+  for(n=0;n<len;) {
+    seg_wait(r, i);
+    c = r->seg_len[i]-pos;
+    if (c > len-n)
+      c = len-n;
+    memcpy(dst+n, seg_ptr(r, i)+pos, c);
+    n += c;
+
+    if (seg_last(r, i))
+      break;
+    i = (i+1) % r->seg_count;
+    pos = 0;
+    if (i == r->cur)
+      break;
+  }
+
+  return n;
+}
+
+uint8_t *reader_frame(Io_Reader *r, uint32_t *size, uint32_t *size_c)
+{
+  uint8_t header[HEADER_SIZE] __attribute__((aligned(16)));
+  size_t got;
+  uint8_t *frame;
+
+  got = reader_peek(r, header, HEADER_SIZE);
+  if (!got)
+    return NULL;
+  if (got < HEADER_SIZE) {
+    fprintf(stderr, "ERROR: corrupt input!\n");
+    return NULL;
+  }
+
+  bbp_header_sizes(header, size, size_c);
+
+  frame = reader_get(r, *size_c, &got);
+  if (got < *size_c) {
+    fprintf(stderr, "ERROR: corrupt input!\n");
+    return NULL;
+  }
+
+  return frame;
+}
+
+/*
+ * writer
+ */
+
+static inline uint8_t *wbuf_ptr(Io_Writer *w, int i)
+{
+  return w->buf_mem + (size_t)i*w->buf_size;
+}
+
+#ifdef BBP_USE_URING
+//wait for one write to finish, completes short writes synchronously
+static void wbuf_reap(Io_Writer *w)
+{
+  uint64_t idx;
+  int res;
+
+  res = uring_wait(&w->ring, &idx);
+  assert(res >= 0);
+  if (res < w->buf_len[idx])
+    pwrite_full(w->fd, wbuf_ptr(w, idx)+res, w->buf_len[idx]-res, w->buf_pos[idx]+res);
+  w->buf_len[idx] = 0;
+}
+
+static void wbuf_drain(Io_Writer *w)
+{
+  int i;
+
+  for(i=0;i<w->buf_count;i++)
+    while (w->buf_len[i])
+      wbuf_reap(w);
+}
+#endif
+
+int writer_init(Io_Writer *w, int fd, int backend, size_t buf_size, int align)
+{
+  struct stat st;
+
+  memset(w, 0, sizeof(Io_Writer));
+  w->fd = fd;
+  w->align = align;
+  buf_size = (buf_size+PAGE_ALIGNMENT-1)/PAGE_ALIGNMENT*PAGE_ALIGNMENT;
+
+  fstat(fd, &st);
+
+  /*
+   * pipes are written with write(): vmsplice would leave the pages of the
+   * buffer referenced by the pipe (and anything the reader splices it into)
+   * while they are overwritten by the next frames, gifting fresh pages instead
+   * cost more in page faults than the copy saves
+   */
+#ifdef F_SETPIPE_SZ
+  if (S_ISFIFO(st.st_mode))
+    fcntl(fd, F_SETPIPE_SZ, OUTPUT_PIPE_SIZE);
+#endif
+
+  if (backend != IO_BACKEND_READ && !S_ISREG(st.st_mode)) {
+    fprintf(stderr, "WARNING: %s output needs a regular file, using regular write\n", io_backend_name(backend));
+    backend = IO_BACKEND_READ;
+  }
+
+  if (backend == IO_BACKEND_MMAP) {
+    w->map = MAP_FAILED;
+    w->map_len = buf_size*16;
+    if (!ftruncate(fd, w->map_len))
+      w->map = mmap(NULL, w->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (w->map == MAP_FAILED) {
+      fprintf(stderr, "WARNING: mmap failed for output, using regular write\n");
+      w->map = NULL;
+      backend = IO_BACKEND_READ;
+    }
+    else {
+      w->backend = IO_BACKEND_MMAP;
+      return w->backend;
+    }
+  }
+
+  w->buf_size = buf_size;
+
+#ifdef BBP_USE_URING
+  if (backend == IO_BACKEND_URING) {
+    struct iovec iov;
+
+    w->buf_mem = bbp_alloc(URING_BUFFERS*buf_size);
+    assert(w->buf_mem);
+    iov.iov_base = w->buf_mem;
+    iov.iov_len = URING_BUFFERS*buf_size;
+    if (uring_init(&w->ring, URING_BUFFERS) || uring_register_buffers(&w->ring, &iov, 1)) {
+      fprintf(stderr, "WARNING: io_uring not available, using regular write\n");
+      bbp_free(w->buf_mem, URING_BUFFERS*buf_size);
+    }
+    else {
+      w->backend = IO_BACKEND_URING;
+      w->buf_count = URING_BUFFERS;
+      w->buf_len = calloc(w->buf_count, sizeof(size_t));
+      w->buf_pos = calloc(w->buf_count, sizeof(uint64_t));
+      return w->backend;
+    }
+  }
+#endif
+
+  w->backend = IO_BACKEND_READ;
+  w->buf_count = 1;
+  w->buf_mem = bbp_alloc(buf_size);
+  assert(w->buf_mem);
+
+  return w->backend;
+}
+
+void writer_close(Io_Writer *w)
+{
+#ifdef BBP_USE_URING
+  if (w->backend == IO_BACKEND_URING) {
+    wbuf_drain(w);
+    uring_exit(&w->ring);
+    free(w->buf_len);
+    free(w->buf_pos);
+  }
+#endif
+  if (w->backend == IO_BACKEND_MMAP) {
+    munmap(w->map, w->map_len);
+    ftruncate(w->fd, w->pos);
+  }
+  else
+    bbp_free(w->buf_mem, w->buf_count*w->buf_size);
+
+  free(w->bounce);
+}
+
+uint8_t *writer_buf(Io_Writer *w, size_t max_len)
+{
+  w->use_bounce = 0;
+
+  switch (w->backend) {
+    case IO_BACKEND_MMAP :
+      if (w->pos+max_len > w->map_len) {
+        munmap(w->map, w->map_len);
+        while (w->pos+max_len > w->map_len)
+          w->map_len *= 2;
+        ftruncate(w->fd, w->map_len);
+        w->map = mmap(NULL, w->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, w->fd, 0);
+        assert(w->map != MAP_FAILED);
+      }
+      if (!(w->pos % w->align))
+        return w->map + w->pos;
+      break;
+#ifdef BBP_USE_URING
+    case IO_BACKEND_URING :
+      if (max_len > w->buf_size) {
+        //does not fit a registered buffer, write synchronously
+        wbuf_drain(w);
+        break;
+      }
+      while (w->buf_len[w->cur])
+        wbuf_reap(w);
+      return wbuf_ptr(w, w->cur);
+#endif
+    default :
+      if (max_len <= w->buf_size)
+        return w->buf_mem;
+  }
+
+  w->use_bounce = 1;
+  bounce_reserve(&w->bounce, &w->bounce_size, max_len);
+  return w->bounce;
+}
+
+void writer_commit(Io_Writer *w, size_t len)
+{
+  switch (w->backend) {
+    case IO_BACKEND_MMAP :
+      if (w->use_bounce)
+        memcpy(w->map + w->pos, w->bounce, len);
+      break;
+#ifdef BBP_USE_URING
+    case IO_BACKEND_URING :
+      if (w->use_bounce) {
+        pwrite_full(w->fd, w->bounce, len, w->pos);
+        break;
+      }
+      if (!len)
+        break;
+      w->buf_len[w->cur] = len;
+      w->buf_pos[w->cur] = w->pos;
+      uring_prep_write_fixed(&w->ring, w->fd, wbuf_ptr(w, w->cur), len, w->pos, 0, w->cur);
+      uring_submit(&w->ring);
+      w->cur = (w->cur+1) % w->buf_count;
+      break;
+#endif
+    default :
+      write_full(w->fd, w->use_bounce ? w->bounce : w->buf_mem, len);
+  }
+
+  w->pos += len;
+}
+
+void writer_write(Io_Writer *w, uint8_t *buf, size_t len)
+{
+  if (w->backend == IO_BACKEND_READ) {
+    write_full(w->fd, buf, len);
+    w->pos += len;
+    return;
+  }
+
+  memcpy(writer_buf(w, len), buf, len);
+  writer_commit(w, len);
+}
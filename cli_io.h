@@ -0,0 +1,122 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_CLI_IO_H
+#define _BBP_CLI_IO_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef BBP_USE_URING
+#include "uring.h"
+#endif
+
+#define IO_BACKEND_READ  0 //read()/write()
+#define IO_BACKEND_MMAP  1 //mmap input and/or output
+#define IO_BACKEND_URING 2 //io_uring with registered buffers and several requests in flight
+
+/*
+ * sequential reader, input is held in a ring of segments which are refilled
+ * (asynchronously with io_uring) once fully consumed
+ */
+typedef struct {
+  int backend;
+  int fd;
+  int align; //alignment of returned pointers
+  int seg_count;
+  size_t seg_size;
+  uint8_t *seg_mem;
+  int64_t *seg_len; //-1 while in flight
+  uint64_t *seg_pos; //file position of segment
+  int cur; //segment we are consuming from
+  size_t pos; //consumed bytes in cur
+  uint64_t next_pos; //file position for the next segment
+  int eof;
+  uint8_t *bounce; //for requests which span segments or are unaligned
+  size_t bounce_size;
+  uint64_t map_len;
+#ifdef BBP_USE_URING
+  Uring ring;
+#endif
+} Io_Reader;
+
+/*
+ * sequential writer, buffers returned by writer_buf() are written
+ * out on writer_commit() (asynchronously with io_uring)
+ */
+typedef struct {
+  int backend;
+  int fd;
+  int align;
+  int buf_count;
+  size_t buf_size;
+  uint8_t *buf_mem;
+  size_t *buf_len; //length of in flight write, 0 if buffer is free
+  uint64_t *buf_pos;
+  int cur;
+  int use_bounce;
+  uint64_t pos; //file position of next write
+  uint8_t *map;
+  uint64_t map_len;
+  uint8_t *bounce;
+  size_t bounce_size;
+#ifdef BBP_USE_URING
+  Uring ring;
+#endif
+} Io_Writer;
+
+const char *io_backend_name(int backend);
+//returns -1 for unknown names
+int io_backend_parse(const char *name);
+
+/** init reader for \p fd, returns the actually used backend (falls back to IO_BACKEND_READ)
+ * non regular files like pipes are read with short reads handled, mmap and uring need regular files
+\param seg_size segment size, should be a multiple of the request size for best performance
+ */
+int reader_init(Io_Reader *r, int fd, int backend, size_t seg_size, int align);
+void reader_close(Io_Reader *r);
+//returned pointers stay valid until reader_close() (mmap backend)
+int reader_stable(Io_Reader *r);
+/** get the next \p len bytes (less only at the end of the input)
+ * the returned pointer is valid until the next reader call, returns NULL at the end of the input
+ */
+uint8_t *reader_get(Io_Reader *r, size_t len, size_t *got);
+//copy the next \p len bytes to \p dst without consuming them, returns number of copied bytes
+size_t reader_peek(Io_Reader *r, uint8_t *dst, size_t len);
+/** get the next complete bbp frame, returns NULL at the end of the input
+\param size uncompressed size of the frame
+\param size_c compressed size of the frame
+ */
+uint8_t *reader_frame(Io_Reader *r, uint32_t *size, uint32_t *size_c);
+
+//returns the actually used backend (falls back to IO_BACKEND_READ, which is also used for pipes)
+int writer_init(Io_Writer *w, int fd, int backend, size_t buf_size, int align);
+void writer_close(Io_Writer *w);
+//returns an aligned buffer which can hold at least \p max_len bytes
+uint8_t *writer_buf(Io_Writer *w, size_t max_len);
+//write out \p len bytes of the buffer returned by the last writer_buf() call
+void writer_commit(Io_Writer *w, size_t len);
+//write \p len bytes from \p buf (avoids the copy for the read/write backend)
+void writer_write(Io_Writer *w, uint8_t *buf, size_t len);
+
+#endif
@@ -0,0 +1,280 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "bbp.h"
+#include "cli_pipeline.h"
+
+/*
+ * The pipeline is a bounded ring of slots. Each slot carries a tag which
+ * combines the sequence number of the chunk it holds and its state, so
+ * reader, coders and writer hand over slots with a single atomic store
+ * (no locks). A chunk with sequence number n always uses slot n % count.
+ */
+
+#define SLOT_FREE 0 //may be filled by the reader
+#define SLOT_READ 1 //holds input, waiting for a coder
+#define SLOT_DONE 2 //holds output, waiting for the writer
+
+#define TAG(SEQ, STATE) ((SEQ)*4+(STATE))
+
+#define load_acquire(P) __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define store_release(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+
+#define SPIN_COUNT 256
+
+#define RU_PAGE(V) (((V)+4095)/4096*4096)
+
+typedef struct {
+  uint64_t tag;
+  uint8_t *in;
+  uint8_t *out;
+  uint8_t *in_fixed; //part of the huge page backed slot memory
+  uint8_t *out_fixed;
+  uint8_t *in_mem; //heap fallback for frames which don't fit
+  size_t in_size;
+  uint8_t *out_mem;
+  size_t out_size;
+  uint32_t len, len_c;
+  double time;
+} Slot;
+
+typedef struct {
+  Io_Reader *r;
+  Pipeline_Params *p;
+  int slot_count;
+  Slot *slots;
+  uint8_t *slot_mem;
+  size_t slot_mem_size;
+  size_t in_fixed_size;
+  size_t out_fixed_size;
+  uint64_t next_seq; //next chunk for a coder
+  uint64_t total; //number of chunks, valid once eof is set
+  int eof;
+} Pipeline;
+
+static double ms_delta(struct timespec start, struct timespec stop)
+{
+  return (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+static void backoff(int *spins)
+{
+  if (++*spins > SPIN_COUNT)
+    sched_yield();
+}
+
+//returns the fixed buffer if len fits, else a (reused) heap buffer
+static uint8_t *reserve(uint8_t *fixed, size_t fixed_size, uint8_t **buf, size_t *size, size_t len)
+{
+  void *tmp;
+
+  if (len <= fixed_size)
+    return fixed;
+
+  if (*size >= len)
+    return *buf;
+
+  free(*buf);
+  if (posix_memalign(&tmp, BBP_ALIGNMENT, len))
+    abort();
+  *buf = tmp;
+  *size = len;
+
+  return *buf;
+}
+
+//wait until the slot for seq has reached state, returns 0 if seq is past the end of the input
+static int slot_wait(Pipeline *pl, uint64_t seq, int state)
+{
+  Slot *s = &pl->slots[seq % pl->slot_count];
+  int spins = 0;
+
+  while (load_acquire(&s->tag) != TAG(seq, state)) {
+    if (load_acquire(&pl->eof) && seq >= pl->total)
+      return 0;
+    backoff(&spins);
+  }
+
+  return 1;
+}
+
+static void *reader_thread(void *data)
+{
+  Pipeline *pl = data;
+  Io_Reader *r = pl->r;
+  Slot *s;
+  uint64_t seq;
+  uint8_t *buf;
+  uint32_t len, len_c;
+  size_t got;
+
+  for(seq=0;;seq++) {
+    slot_wait(pl, seq, SLOT_FREE);
+    s = &pl->slots[seq % pl->slot_count];
+
+    if (pl->p->mode == 'd') {
+      buf = reader_frame(r, &len, &len_c);
+      got = len_c;
+    }
+    else {
+      buf = reader_get(r, pl->p->chunk_size, &got);
+      len = got;
+    }
+    if (!buf)
+      break;
+
+    if (reader_stable(r) && buf != r->bounce)
+      s->in = buf;
+    else {
+      s->in = reserve(s->in_fixed, pl->in_fixed_size, &s->in_mem, &s->in_size, got);
+      memcpy(s->in, buf, got);
+    }
+    s->len = len;
+    s->len_c = len_c;
+
+    store_release(&s->tag, TAG(seq, SLOT_READ));
+  }
+
+  pl->total = seq;
+  store_release(&pl->eof, 1);
+
+  return NULL;
+}
+
+static void *coder_thread(void *data)
+{
+  Pipeline *pl = data;
+  Pipeline_Params *p = pl->p;
+  Slot *s;
+  uint64_t seq;
+  struct timespec start, stop;
+
+  while (1) {
+    seq = __atomic_fetch_add(&pl->next_seq, 1, __ATOMIC_RELAXED);
+    if (!slot_wait(pl, seq, SLOT_READ))
+      break;
+    s = &pl->slots[seq % pl->slot_count];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (p->mode == 'd') {
+      s->out = reserve(s->out_fixed, pl->out_fixed_size, &s->out_mem, &s->out_size, s->len);
+      s->len = bbp_decode(s->in, s->out);
+    }
+    else {
+      s->out = reserve(s->out_fixed, pl->out_fixed_size, &s->out_mem, &s->out_size, bbp_max_compressed_size(s->len));
+      if (p->bs_split)
+        s->len_c = bbp_code_adaptive(s->in, s->out, p->bs, p->bs_split, p->bs2, s->len, p->offset);
+      else if (p->elem_size)
+        s->len_c = bbp_code_typed(s->in, s->out, p->bs, p->bs2, s->len, p->offset, p->elem_size, p->typed_transform);
+      else if (p->patched)
+        s->len_c = bbp_code_patched(s->in, s->out, p->bs, p->bs2, s->len, p->offset);
+      else
+        s->len_c = bbp_code_offset(s->in, s->out, p->bs, p->bs2, s->len, p->offset);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    s->time = ms_delta(start, stop);
+
+    store_release(&s->tag, TAG(seq, SLOT_DONE));
+  }
+
+  return NULL;
+}
+
+void pipeline_run(Io_Reader *r, Io_Writer *w, Pipeline_Params *p, Pipeline_Stats *stats)
+{
+  int i;
+  uint64_t seq;
+  Pipeline pl;
+  Slot *s;
+  pthread_t reader;
+  pthread_t *coders;
+
+  assert(p->threads >= 1);
+
+  memset(&pl, 0, sizeof(pl));
+  memset(stats, 0, sizeof(Pipeline_Stats));
+  pl.r = r;
+  pl.p = p;
+  //enough slots so every coder has one while the reader and the writer hold others
+  pl.slot_count = 2*p->threads+2;
+  pl.slots = calloc(pl.slot_count, sizeof(Slot));
+
+  //all slot buffers in one allocation, so they share few huge pages
+  if (p->mode == 'd') {
+    pl.in_fixed_size = reader_stable(r) ? 0 : RU_PAGE(bbp_max_compressed_size(p->chunk_size));
+    pl.out_fixed_size = RU_PAGE(p->chunk_size);
+  }
+  else {
+    pl.in_fixed_size = reader_stable(r) ? 0 : RU_PAGE(p->chunk_size);
+    pl.out_fixed_size = RU_PAGE(bbp_max_compressed_size(p->chunk_size));
+  }
+  pl.slot_mem_size = pl.slot_count*(pl.in_fixed_size+pl.out_fixed_size);
+  pl.slot_mem = bbp_alloc(pl.slot_mem_size);
+  assert(pl.slot_mem);
+
+  for(i=0;i<pl.slot_count;i++) {
+    pl.slots[i].tag = TAG(i, SLOT_FREE);
+    pl.slots[i].in_fixed = pl.slot_mem + i*(pl.in_fixed_size+pl.out_fixed_size);
+    pl.slots[i].out_fixed = pl.slots[i].in_fixed + pl.in_fixed_size;
+  }
+
+  coders = malloc(p->threads*sizeof(pthread_t));
+  pthread_create(&reader, NULL, reader_thread, &pl);
+  for(i=0;i<p->threads;i++)
+    pthread_create(&coders[i], NULL, coder_thread, &pl);
+
+  for(seq=0;slot_wait(&pl, seq, SLOT_DONE);seq++) {
+    s = &pl.slots[seq % pl.slot_count];
+
+    if (p->mode == 'd')
+      writer_write(w, s->out, s->len);
+    else
+      writer_write(w, s->out, s->len_c);
+
+    stats->size += s->len;
+    stats->size_c += s->len_c;
+    stats->time += s->time;
+
+    store_release(&s->tag, TAG(seq+pl.slot_count, SLOT_FREE));
+  }
+
+  pthread_join(reader, NULL);
+  for(i=0;i<p->threads;i++)
+    pthread_join(coders[i], NULL);
+
+  for(i=0;i<pl.slot_count;i++) {
+    free(pl.slots[i].in_mem);
+    free(pl.slots[i].out_mem);
+  }
+  bbp_free(pl.slot_mem, pl.slot_mem_size);
+  free(pl.slots);
+  free(coders);
+}
@@ -0,0 +1,51 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_CLI_PIPELINE_H
+#define _BBP_CLI_PIPELINE_H
+
+#include "cli_io.h"
+
+typedef struct {
+  char mode; //'e' or 'd'
+  int threads; //number of coding threads
+  int bs, bs2, offset;
+  size_t chunk_size;
+  int bs_split; //split block size of adaptive frames, 0 codes fixed block sizes
+  int patched; //code patched frames (bbp_code_patched())
+  int elem_size, typed_transform; //elem_size > 0 codes typed frames (bbp_code_typed())
+} Pipeline_Params;
+
+typedef struct {
+  uint64_t size;
+  uint64_t size_c;
+  double time; //time spent in bbp_code_offset()/bbp_decode() summed over all threads in ms
+} Pipeline_Stats;
+
+/** run compression or decompression from \p r to \p w with a reader thread,
+ * p->threads coding threads and the calling thread writing in input order.
+ * The output is identical to the single threaded case.
+ */
+void pipeline_run(Io_Reader *r, Io_Writer *w, Pipeline_Params *p, Pipeline_Stats *stats);
+
+#endif
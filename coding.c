@@ -26,6 +26,9 @@
 #include "bitpacking.h"
 #include "bitstream.h"
 #include "coding_helpers.h"
+#include "shuffle.h"
+#include "stats.h"
+#include "probes.h"
 
 static inline uint32_t calc_offset_start(Block_Coder_Data *b)
 {
@@ -41,13 +44,156 @@ static inline uint32_t calc_offset_start(Block_Coder_Data *b)
   return start;
 }
 
+/*
+ * whether pushing the blocks of bits stays below b->block_end, for the last
+ * segment of a stage also including the flush of a partial block, the raw
+ * tail and the alignment padding
+ */
+int push_fits(Block_Coder_Data *b, int *bits, int count, const int block_size, int last, int raw)
+{
+  int i;
+  int sum = 8-b->cur_block_free_bits;
+  uint8_t *end;
+  
+  for(i=0;i<count;i++)
+    sum += bits[i];
+  
+  //pushes write at most into the block following the last full one
+  if (count && b->cur_block+(sum/8+1)*block_size > b->block_end)
+    return 0;
+  
+  if (!last)
+    return 1;
+  
+  end = b->cur_block+(sum+7)/8*block_size+raw;
+  return b->block_buf+RU_N(end-b->block_buf, BBP_ALIGNMENT) <= b->block_end;
+}
+
+/*
+ * patched frames (PFOR): a block whose width is set by a few large diffs is
+ * packed at a lower width, the diffs which don't fit are exceptions. They are
+ * coded into b->patch as the gap to the previous one (LEB128, positions in the
+ * frame) followed by the full diff byte, the decoder overwrites them after
+ * unpacking a chunk.
+ */
+#define PATCH_COST 16 //bits per exception for a gap below 128
+
+static inline void patch_put(Block_Coder_Data *b, int pos, uint8_t val)
+{
+  uint32_t gap = pos-b->patch_pos;
+  
+  while (gap >= 128) {
+    *b->patch++ = gap | 128;
+    gap >>= 7;
+  }
+  *b->patch++ = gap;
+  *b->patch++ = val;
+  b->patch_pos = pos+1;
+  b->patch_count++;
+}
+
+static inline void patch_gap_get(Block_Coder_Data *b)
+{
+  int shift = 0;
+  
+  while (*b->patch & 128) {
+    b->patch_pos += (*b->patch++ & 127) << shift;
+    shift += 7;
+  }
+  b->patch_pos += *b->patch++ << shift;
+}
+
+void patch_decoder_init(Block_Coder_Data *b, uint8_t *patch, int count)
+{
+  b->patch = patch;
+  b->patch_count = count;
+  b->patch_pos = 0;
+  if (count)
+    patch_gap_get(b);
+}
+
+static inline void patch_chunk_dynamic(Block_Coder_Data *b, uint8_t *diff, int *bits, const int block_size, int len, int pos)
+{
+  int n, i, t, w;
+  int best, cost, best_cost;
+  uint16_t e;
+  uint8_t limit;
+  uint8_t *block;
+  
+  for(n=0;n<len/block_size;n++) {
+    w = bits[n];
+    if (!w)
+      continue;
+    block = diff+n*block_size;
+    best = w;
+    best_cost = w*block_size;
+    for(t=w-1;t>=0;t--) {
+      //a byte compare against a constant length vectorizes
+      limit = (1 << t)-1;
+      e = 0;
+      for(i=0;i<block_size;i++)
+        e += block[i] > limit;
+      cost = t*block_size + e*PATCH_COST;
+      if (cost < best_cost) {
+        best = t;
+        best_cost = cost;
+      }
+      //lower widths only add exceptions
+      if (e*PATCH_COST >= best_cost)
+        break;
+    }
+    if (best == w)
+      continue;
+    
+    for(i=0;i<block_size;i++)
+      if (block[i] >> best) {
+        patch_put(b, pos+n*block_size+i, block[i]);
+        block[i] &= (1 << best)-1;
+      }
+    bits[n] = best;
+  }
+}
+
+//lower the width of blocks of a chunk at frame position pos where the exceptions cost less than the saved bits
+void patch_chunk(Block_Coder_Data *b, uint8_t *diff, int *bits, const int block_size, int len, int pos)
+{
+  switch (block_size) {
+    case 4 : patch_chunk_dynamic(b, diff, bits, 4, len, pos); break;
+    case 8 : patch_chunk_dynamic(b, diff, bits, 8, len, pos); break;
+    case 16 : patch_chunk_dynamic(b, diff, bits, 16, len, pos); break;
+    case 32 : patch_chunk_dynamic(b, diff, bits, 32, len, pos); break;
+    case 64 : patch_chunk_dynamic(b, diff, bits, 64, len, pos); break;
+    case 128 : patch_chunk_dynamic(b, diff, bits, 128, len, pos); break;
+    case 256 : patch_chunk_dynamic(b, diff, bits, 256, len, pos); break;
+    case 512 : patch_chunk_dynamic(b, diff, bits, 512, len, pos); break;
+    case 1024 : patch_chunk_dynamic(b, diff, bits, 1024, len, pos); break;
+    case 2048 : patch_chunk_dynamic(b, diff, bits, 2048, len, pos); break;
+    case 4096 : patch_chunk_dynamic(b, diff, bits, 4096, len, pos); break;
+    default : abort();
+  }
+}
+
+//overwrite the exceptions of the chunk at frame position pos
+static inline void patch_apply(Block_Coder_Data *b, uint8_t *diff, int pos, int len)
+{
+  while (b->patch_count && b->patch_pos < pos+len) {
+    diff[b->patch_pos-pos] = *b->patch++;
+    b->patch_pos++;
+    if (--b->patch_count)
+      patch_gap_get(b);
+  }
+}
+
 CFINLINE void code_offset(Block_Coder_Data *b, uint8_t *stream, int len, uint8_t last, const int block_size)
 {
   int i;
   int remain;
   int start;
-  int bits_long[CHUNK_SIZE/block_size] __attribute__((aligned(BBP_ALIGNMENT)));
-  uint8_t diff[CHUNK_SIZE] __attribute__((aligned(BBP_ALIGNMENT)));
+  int path = diff_offset_path(b->offset, stream);
+  int bits_long[b->chunk/block_size] __attribute__((aligned(BBP_ALIGNMENT)));
+  uint8_t diff[b->chunk] __attribute__((aligned(BBP_ALIGNMENT)));
+  
+  STATS_START(t)
   
   comp_coder_reset(b);
   
@@ -55,33 +201,65 @@ CFINLINE void code_offset(Block_Coder_Data *b, uint8_t *stream, int len, uint8_t
   start = calc_offset_start(b);
   
   assert(b->offset);
+  assert(b->block_end);
   
   if (start+block_size > len) {
+    if (b->cur_block+RU_N(len, BBP_ALIGNMENT) > b->block_end) {
+      b->len_c = -1;
+      return;
+    }
+    STATS_ADD(b->stats, bytes_raw, len)
+    PROBE5(raw__copy, PROBE_DIR_ENCODE, len, len, block_size, b->offset);
     memcpy(b->cur_block, stream, len);
     //align up
+    memset(b->cur_block+len, 0, RU_N(len, BBP_ALIGNMENT)-len);
     b->cur_block += RU_N(len, BBP_ALIGNMENT);
     b->len_c = RU_N(len, BBP_ALIGNMENT);
+    STATS_LAP(b->stats, t, enc_copy)
     return;
   }
   
+  if (b->cur_block+start+block_size > b->block_end) {
+    b->len_c = -1;
+    return;
+  }
   memcpy(b->cur_block, stream, start);
   i = start;
   //cur_block  is now BBP_ALIGNMENT aligned but may not be block aligned!
   b->cur_block += start;
   memset(b->cur_block, 0, block_size);
+  STATS_LAP(b->stats, t, enc_copy)
   
-  //compress in CHUNK_SIZE chunks for performance (unrolling, cache locality etc.)
-  for(;i<len-CHUNK_SIZE;i+=CHUNK_SIZE) {
-    _code_diff_offset(stream+i,diff,b->offset,CHUNK_SIZE);
-    _code_max_chunk(diff, bits_long, block_size, CHUNK_SIZE);
-    push_block_chunk(b, bits_long, diff, block_size, CHUNK_SIZE);
+  //compress in b->chunk chunks for performance (unrolling, cache locality etc.)
+  for(;i<len-b->chunk;i+=b->chunk) {
+    _code_diff_offset_path(path,stream+i,diff,b->offset,b->chunk);
+    STATS_LAP(b->stats, t, enc_diff)
+    _code_max_chunk(diff, bits_long, block_size, b->chunk);
+    if (b->patch)
+      patch_chunk(b, diff, bits_long, block_size, b->chunk, i);
+    STATS_LAP(b->stats, t, enc_width)
+    //only close to block_end the exact size is needed
+    if (b->cur_block+b->chunk+2*block_size > b->block_end && !push_fits(b, bits_long, b->chunk/block_size, block_size, 0, 0)) {
+      b->len_c = -1;
+      return;
+    }
+    push_block_chunk(b, bits_long, diff, block_size, b->chunk);
+    STATS_LAP(b->stats, t, enc_pack)
   }
   
-  //do coding for remaining blocks (<CHUNK_SIZE && >=16B)
+  //do coding for remaining blocks (<b->chunk && >=16B)
   //TODO document: may be inlined+unrolled if user compiles with lto and len is constant!
   remain = (len-i)/(block_size*4)*(block_size*4)/BBP_ALIGNMENT*BBP_ALIGNMENT;
-  _code_diff_offset(stream+i,diff,b->offset,remain);
+  _code_diff_offset_path(path,stream+i,diff,b->offset,remain);
+  STATS_LAP(b->stats, t, enc_diff)
   _code_max_chunk(diff, bits_long, block_size, remain);
+  if (b->patch)
+    patch_chunk(b, diff, bits_long, block_size, remain, i);
+  STATS_LAP(b->stats, t, enc_width)
+  if (!push_fits(b, bits_long, remain/block_size, block_size, 1, len-i-remain)) {
+    b->len_c = -1;
+    return;
+  }
   push_block_chunk(b, bits_long, diff, block_size, remain);
   i += remain;
   
@@ -90,19 +268,26 @@ CFINLINE void code_offset(Block_Coder_Data *b, uint8_t *stream, int len, uint8_t
     next_block(b, block_size);
     b->cur_block_free_bits = 8;
   }
+  STATS_LAP(b->stats, t, enc_pack)
   
   //do memcpy for remaining bytes (<block_size || <16B)
   remain = len-i;
   memcpy(b->cur_block, stream+i, remain);
   b->cur_block += remain;
   i += remain;
+  STATS_ADD(b->stats, bytes_raw, start+remain)
+  PROBE5(raw__copy, PROBE_DIR_ENCODE, start+remain, len, block_size, b->offset);
   
   //align output up to BBP_ALIGNMENT bytes (small blocks or odd input len)
-  //TODO set unused bytes to zero?
-  if ((b->cur_block-b->block_buf) % BBP_ALIGNMENT)
-    b->cur_block += BBP_ALIGNMENT - ((b->cur_block-b->block_buf) % BBP_ALIGNMENT);
+  //padding is zeroed so output does not depend on previous buffer contents
+  if ((b->cur_block-b->block_buf) % BBP_ALIGNMENT) {
+    remain = BBP_ALIGNMENT - ((b->cur_block-b->block_buf) % BBP_ALIGNMENT);
+    memset(b->cur_block, 0, remain);
+    b->cur_block += remain;
+  }
   
   b->len_c = b->cur_block-b->block_buf;
+  STATS_LAP(b->stats, t, enc_copy)
   assert(i==len);
 }
 
@@ -121,54 +306,566 @@ int offset_calc_signal_len(Block_Coder_Data *b)
   
   i = start;
   
-  for(;i<len-CHUNK_SIZE;i+=CHUNK_SIZE)
-    signal_len += CHUNK_SIZE/b->block_size;
+  for(;i<len-b->chunk;i+=b->chunk)
+    signal_len += b->chunk/b->block_size;
   
-  remain = (len-i)/(b->block_size*4)*(b->block_size*4)/16*16;
+  remain = (len-i)/(b->block_size*4)*(b->block_size*4)/BBP_ALIGNMENT*BBP_ALIGNMENT;
   signal_len += remain/b->block_size;
   
   return signal_len;
 }
 
-static void decode_offset(Block_Coder_Data *b, const int block_size)
+#define SAMPLE_SIZE  512 //minimum bytes per sample window
+
+int offset_sample_window(Block_Coder_Data *b, int n, int *size)
+{
+  int start = calc_offset_start(b);
+  int span;
+  
+  *size = 4*b->block_size > SAMPLE_SIZE ? 4*b->block_size : SAMPLE_SIZE;
+  span = b->len-start-*size;
+  //small frames are left to the check after coding
+  if (span < 4*OFFSET_SAMPLE_COUNT**size)
+    return -1;
+  
+  return start+(int)((int64_t)span*n/(OFFSET_SAMPLE_COUNT-1))/BBP_ALIGNMENT*BBP_ALIGNMENT;
+}
+
+//estimated size of window bytes at pos packed by b, plus their signal
+static int offset_estimate(Block_Coder_Data *b, uint8_t *in, int pos, int window, int path, int signal_stored)
+{
+  int i, sum, signal;
+  int bits[SAMPLE_SIZE/4];
+  uint8_t diff[window] __attribute__((aligned(BBP_ALIGNMENT)));
+  
+  _code_diff_offset_path(path, in+pos, diff, b->offset, window);
+  _code_max_chunk(diff, bits, b->block_size, window);
+  sum = bits[0];
+  signal = 0;
+  for(i=1;i<window/b->block_size;i++) {
+    sum += bits[i];
+    signal += bits[i] != bits[i-1];
+  }
+  if (signal_stored)
+    signal = window/b->block_size;
+  else
+    signal /= 2;
+  
+  return sum*b->block_size/8 + signal;
+}
+
+/*
+ * estimate the output of b for a few windows spread over in, returns 1 if
+ * every window packs (plus its signal) to at least 1-1/margin of its size. A
+ * signal stored uncompressed costs a byte per block, the second stage codes
+ * runs of equal widths to almost nothing and is estimated at half a byte per
+ * change of the width. The first window which compresses ends the sampling,
+ * so compressible input only pays for diff and max of one window.
+ */
+int offset_sample_incompressible(Block_Coder_Data *b, uint8_t *in, int signal_stored, int margin)
+{
+  int n, window;
+  int path = diff_offset_path(b->offset, in);
+  
+  if (offset_sample_window(b, 0, &window) < 0)
+    return 0;
+  
+  for(n=0;n<OFFSET_SAMPLE_COUNT;n++)
+    if (offset_estimate(b, in, offset_sample_window(b, n, &window), window, path, signal_stored) < window-window/margin)
+      return 0;
+  
+  return 1;
+}
+
+int offset_estimate_incompressible(Block_Coder_Data *b, uint8_t *in, int signal_stored, int margin)
+{
+  int pos, window, sum = 0;
+  int path = diff_offset_path(b->offset, in);
+  
+  if (offset_sample_window(b, 0, &window) >= 0)
+    return offset_sample_incompressible(b, in, signal_stored, margin);
+  
+  for(pos=calc_offset_start(b);pos+window<=b->len;pos+=window)
+    sum += offset_estimate(b, in, pos, window, path, signal_stored);
+  pos -= calc_offset_start(b);
+  
+  return pos && sum >= pos-pos/margin;
+}
+
+/*
+ * adaptive frames: b->block_size bytes (a superblock) are coded either as one
+ * block into b or, where that saves bits, as blocks of sb->block_size into the
+ * separate stream sb. Both streams share the signal of b (widths in superblock
+ * order), split_map has a bit per superblock which is set if it was split.
+ * Head, tail and frames too small to code are copied raw into b just like
+ * with code_offset().
+ */
+
+#define SPLIT_BIT(M, N) (((M)[(N)/8] >> ((N)%8)) & 1)
+
+//decide and push the superblocks of one chunk, returns 0 if b would pass b->block_end
+static inline int code_adaptive_chunk(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map, int *super, uint8_t *diff, int chunk, int signal_cost, int last, int raw, const int split_size)
+{
+  int n, k, run, w, sum;
+  int block_size = b->block_size;
+  int sub = block_size/split_size;
+  int count = chunk/block_size;
+  int bits[b->chunk/split_size] __attribute__((aligned(BBP_ALIGNMENT)));
+  int bits_large[b->chunk/16]; //0 for split superblocks, so push_fits() only counts what b gets
+  uint8_t split[b->chunk/16];
+  
+  STATS_START(t)
+  
+  _code_max_chunk(diff, bits, split_size, chunk);
+  
+  //split if the bits saved pay for the extra widths in the signal
+  for(n=0;n<count;n++) {
+    w = 0;
+    sum = 0;
+    for(k=n*sub;k<(n+1)*sub;k++) {
+      sum += bits[k];
+      if (bits[k] > w)
+        w = bits[k];
+    }
+    split[n] = sum*split_size + (sub-1)*signal_cost < w*block_size;
+    bits_large[n] = split[n] ? 0 : w;
+  }
+  STATS_LAP(b->stats, t, enc_width)
+  
+  if ((last || b->cur_block+chunk+2*block_size > b->block_end) && !push_fits(b, bits_large, count, block_size, last, raw))
+    return 0;
+  
+  //runs of equal decisions are pushed at once, flat regions only see the large blocks
+  for(n=0;n<count;n+=run) {
+    for(run=1;n+run<count && split[n+run] == split[n];run++);
+    if (split[n]) {
+      sb->cur_signal = b->cur_signal;
+      push_block_chunk(sb, bits+n*sub, diff+n*block_size, split_size, run*block_size);
+      b->cur_signal = sb->cur_signal;
+      for(k=*super+n;k<*super+n+run;k++)
+        split_map[k/8] |= 1 << (k%8);
+      STATS_ADD(b->stats, blocks_split, run)
+    }
+    else
+      push_block_chunk(b, bits_large+n, diff+n*block_size, block_size, run*block_size);
+  }
+  *super += count;
+  STATS_ADD(b->stats, blocks_adaptive, count)
+  STATS_LAP(b->stats, t, enc_pack)
+  
+  return 1;
+}
+
+static inline void code_adaptive_split(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map, uint8_t *stream, int len, int signal_cost, const int split_size)
+{
+  int i;
+  int remain;
+  int start;
+  int super = 0;
+  int block_size = b->block_size;
+  int path = diff_offset_path(b->offset, stream);
+  uint8_t diff[b->chunk] __attribute__((aligned(BBP_ALIGNMENT)));
+  
+  STATS_START(t)
+  
+  comp_coder_reset(b);
+  comp_coder_reset(sb);
+  sb->len_c = 0;
+  
+  start = calc_offset_start(b);
+  
+  assert(b->offset);
+  assert(b->block_end);
+  
+  if (start+block_size > len) {
+    if (b->cur_block+RU_N(len, BBP_ALIGNMENT) > b->block_end) {
+      b->len_c = -1;
+      return;
+    }
+    STATS_ADD(b->stats, bytes_raw, len)
+    PROBE5(raw__copy, PROBE_DIR_ENCODE, len, len, block_size, b->offset);
+    memcpy(b->cur_block, stream, len);
+    memset(b->cur_block+len, 0, RU_N(len, BBP_ALIGNMENT)-len);
+    b->cur_block += RU_N(len, BBP_ALIGNMENT);
+    b->len_c = RU_N(len, BBP_ALIGNMENT);
+    STATS_LAP(b->stats, t, enc_copy)
+    return;
+  }
+  
+  if (b->cur_block+start+block_size > b->block_end) {
+    b->len_c = -1;
+    return;
+  }
+  memcpy(b->cur_block, stream, start);
+  i = start;
+  b->cur_block += start;
+  memset(b->cur_block, 0, block_size);
+  memset(sb->cur_block, 0, split_size);
+  STATS_LAP(b->stats, t, enc_copy)
+  
+  for(;i<len-b->chunk;i+=b->chunk) {
+    _code_diff_offset_path(path,stream+i,diff,b->offset,b->chunk);
+    STATS_LAP(b->stats, t, enc_diff)
+    if (!code_adaptive_chunk(b, sb, split_map, &super, diff, b->chunk, signal_cost, 0, 0, split_size)) {
+      b->len_c = -1;
+      return;
+    }
+    STATS_RESTART(t)
+  }
+  
+  remain = (len-i)/(block_size*4)*(block_size*4)/BBP_ALIGNMENT*BBP_ALIGNMENT;
+  _code_diff_offset_path(path,stream+i,diff,b->offset,remain);
+  STATS_LAP(b->stats, t, enc_diff)
+  if (!code_adaptive_chunk(b, sb, split_map, &super, diff, remain, signal_cost, 1, len-i-remain, split_size)) {
+    b->len_c = -1;
+    return;
+  }
+  i += remain;
+  STATS_RESTART(t)
+  
+  if (b->cur_block_free_bits != 8) {
+    next_block(b, block_size);
+    b->cur_block_free_bits = 8;
+  }
+  if (sb->cur_block_free_bits != 8) {
+    next_block(sb, split_size);
+    sb->cur_block_free_bits = 8;
+  }
+  
+  remain = len-i;
+  memcpy(b->cur_block, stream+i, remain);
+  b->cur_block += remain;
+  i += remain;
+  STATS_ADD(b->stats, bytes_raw, start+remain)
+  PROBE5(raw__copy, PROBE_DIR_ENCODE, start+remain, len, block_size, b->offset);
+  
+  //both streams are padded with zeros to BBP_ALIGNMENT
+  remain = RU_N(b->cur_block-b->block_buf, BBP_ALIGNMENT)-(b->cur_block-b->block_buf);
+  memset(b->cur_block, 0, remain);
+  b->cur_block += remain;
+  remain = RU_N(sb->cur_block-sb->block_buf, BBP_ALIGNMENT)-(sb->cur_block-sb->block_buf);
+  memset(sb->cur_block, 0, remain);
+  sb->cur_block += remain;
+  
+  b->len_c = b->cur_block-b->block_buf;
+  sb->len_c = sb->cur_block-sb->block_buf;
+  STATS_LAP(b->stats, t, enc_copy)
+  assert(i==len);
+}
+
+static inline void decode_adaptive_chunk(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map, int *super, uint8_t *diff, int chunk, int path, const int split_size)
+{
+  int n, run, split;
+  int block_size = b->block_size;
+  int count = chunk/block_size;
+  
+  STATS_START(t)
+  
+  for(n=0;n<count;n+=run) {
+    split = SPLIT_BIT(split_map, *super+n);
+    for(run=1;n+run<count && SPLIT_BIT(split_map, *super+n+run) == split;run++);
+    if (split) {
+      sb->cur_signal = b->cur_signal;
+      pull_block_chunk(sb, diff+n*block_size, split_size, run*block_size);
+      b->cur_signal = sb->cur_signal;
+    }
+    else
+      pull_block_chunk(b, diff+n*block_size, block_size, run*block_size);
+  }
+  *super += count;
+  STATS_LAP(b->stats, t, dec_unpack)
+  
+  _decode_inv_diff_path(path, b->cur_data, diff, b->offset, chunk);
+  b->cur_data += chunk;
+  STATS_LAP(b->stats, t, dec_undiff)
+}
+
+static inline void decode_adaptive_split(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map, const int split_size)
 {
+  int i;
   int remain;
-  int i, n;
-  uint8_t diff[CHUNK_SIZE] __attribute__((aligned(BBP_ALIGNMENT)));
   int start;
+  int super = 0;
+  int block_size = b->block_size;
+  int path = diff_offset_path(b->offset, b->data_buf);
+  uint8_t diff[b->chunk] __attribute__((aligned(BBP_ALIGNMENT)));
+  
+  STATS_START(t)
   
   comp_decoder_reset(b);
+  sb->cur_block = sb->block_buf;
+  sb->cur_block_free_bits = 8;
   
-  //16byte aligned and >= offset
   start = calc_offset_start(b);
   
   if (start+block_size > b->len) {
+    PROBE5(raw__copy, PROBE_DIR_DECODE, b->len, b->len, block_size, b->offset);
     memcpy(b->cur_data, b->cur_block, b->len);
     b->cur_data += b->len;
     b->len_c = b->len;
+    STATS_LAP(b->stats, t, dec_copy)
     return;
   }
   
   memcpy(b->cur_data, b->cur_block, start);
   i = start;
-  //cur_block  is now BBP_ALIGNMENT bytes aligned but may not be block aligned!
   b->cur_data += start;
   b->cur_block += start;
-    
+  STATS_LAP(b->stats, t, dec_copy)
+  
+  for(;i<b->len-b->chunk;i+=b->chunk)
+    decode_adaptive_chunk(b, sb, split_map, &super, diff, b->chunk, path, split_size);
   
-  for(;i<b->len-CHUNK_SIZE;i+=CHUNK_SIZE) {
-    for(n=0;n<CHUNK_SIZE;n+=block_size)
-      pull_block(b, diff+n, block_size);
-    _decode_lut_inv_diff(b->cur_data, diff, b->data_buf+i-b->offset, CHUNK_SIZE);
-    b->cur_data+= CHUNK_SIZE;
+  remain = (b->len-i)/(block_size*4)*(block_size*4)/BBP_ALIGNMENT*BBP_ALIGNMENT;
+  decode_adaptive_chunk(b, sb, split_map, &super, diff, remain, path, split_size);
+  i += remain;
+  STATS_RESTART(t)
+  
+  if (b->cur_block_free_bits != 8) {
+    b->cur_block += block_size;
+    b->cur_block_free_bits = 8;
   }
   
-  remain = (b->len-i)/(b->block_size*4)*(b->block_size*4)/BBP_ALIGNMENT*BBP_ALIGNMENT;
-  for(n=0;n<remain;n+=block_size)
+  remain = b->len-i;
+  PROBE5(raw__copy, PROBE_DIR_DECODE, start+remain, b->len, block_size, b->offset);
+  memcpy(b->cur_data, b->cur_block, remain);
+  b->cur_data += remain;
+  b->cur_block += remain;
+  i += remain;
+  
+  b->len_c = i;
+  STATS_LAP(b->stats, t, dec_copy)
+  assert(b->cur_data-b->data_buf==b->len);
+}
+
+//number of widths in the signal of an adaptive frame, needs block sizes, len, offset and the split map
+int adaptive_calc_signal_len(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map)
+{
+  int i;
+  int super = offset_calc_signal_len(b);
+  int split = 0;
+  
+  for(i=0;i<super/8;i++)
+    split += __builtin_popcount(split_map[i]);
+  for(i=i*8;i<super;i++)
+    split += SPLIT_BIT(split_map, i);
+  
+  return super + split*(b->block_size/sb->block_size-1);
+}
+
+//larger offsets don't use a window in the large frame mode, moving the history would cost more than the chunk
+#define STREAM_MAX_OFFSET CHUNK_SIZE
+
+//pull the blocks of len bytes, in the large frame mode with prefetching of the block stream (and the reference row)
+static inline void pull_chunk(Block_Coder_Data *b, uint8_t *diff, int len, int prefetch_ref, const int block_size)
+{
+  int n;
+  
+  if (!b->prefetch) {
+    pull_block_chunk(b, diff, block_size, len);
+    return;
+  }
+  
+  //the block stream is at most as long as the output, so one line per 64 output bytes suffices
+  for(n=0;n<len;n+=block_size) {
+    if (!(n & 63)) {
+      __builtin_prefetch(b->cur_block+b->prefetch);
+      if (prefetch_ref)
+        __builtin_prefetch(b->cur_data-b->offset+n+b->prefetch);
+    }
     pull_block(b, diff+n, block_size);
-  _decode_lut_inv_diff(b->cur_data, diff, b->cur_data-b->offset, remain);
+  }
+}
+
+/*
+ * reconstruct len bytes to cur_data, directly or (large frames) in the cache
+ * resident window dec, which has the last offset bytes of output in front,
+ * and from there with non-temporal stores, so the reference is never read
+ * back from memory
+ */
+static inline void undiff_chunk(Block_Coder_Data *b, uint8_t *dec, int path, uint8_t *diff, int len)
+{
+  if (!dec) {
+    _decode_inv_diff_path(path, b->cur_data, diff, b->offset, len);
+    b->cur_data += len;
+    return;
+  }
+  
+  _decode_inv_diff_path(path, dec, diff, b->offset, len);
+  _stream_copy(b->cur_data, dec, len);
+  memmove(dec-b->offset, dec+len-b->offset, b->offset);
+  b->cur_data += len;
+}
+
+/*
+ * typed frames: unshuffle the complete groups of the stream up to cur_data
+ * to the output, end points behind them (in the window or the block
+ * stream), last also writes the partial group and the tail
+ */
+static inline void typed_emit(Block_Coder_Data *b, uint8_t *end, int last)
+{
+  Typed_Rows *t = b->typed;
+  int pos = b->cur_data-b->data_buf;
+  int done = t->pos/t->row*b->offset;
+  int n = last ? t->count-t->pos : (pos-done)/b->offset*t->row;
+  int tail = b->len-t->count*(b->offset/t->row);
+  
+  //the rows of the partial last group and the tail may add up to a whole group
+  if (!last && n > t->count/t->row*t->row-t->pos)
+    n = t->count/t->row*t->row-t->pos;
+  unshuffle_rows(end-(pos-done), b->data_buf, t->pos, n, t);
+  t->pos += n;
+  if (last)
+    memcpy(b->data_buf+t->count*t->elem_size, end-tail, tail);
+}
+
+//typed frames: room for len bytes behind dec in the window of size bytes, the last offset bytes stay in front
+static inline uint8_t *typed_slide(Block_Coder_Data *b, uint8_t *window, int size, uint8_t *dec, int len)
+{
+  uint8_t *first = window+RU_N(b->offset, BBP_ALIGNMENT);
+  
+  if (dec+len <= window+size)
+    return dec;
+  memmove(first-b->offset, dec-b->offset, b->offset);
+  return first;
+}
+
+static inline void typed_chunk(Block_Coder_Data *b, uint8_t *window, int size, uint8_t **dec, int path, uint8_t *diff, int len, const int block_size)
+{
+  STATS_START(t)
+  
+  pull_chunk(b, diff, len, 0, block_size);
+  STATS_LAP(b->stats, t, dec_unpack)
+  *dec = typed_slide(b, window, size, *dec, len);
+  _decode_inv_diff_path(path, *dec, diff, b->offset, len);
+  *dec += len;
+  b->cur_data += len;
+  typed_emit(b, *dec, 0);
+  STATS_LAP(b->stats, t, dec_undiff)
+}
+
+/*
+ * typed frames: the stream of plane rows is reconstructed in a cache
+ * resident window and the complete row groups of each chunk go straight to
+ * the output, unshuffled. The window slides only when full, so large row
+ * groups do not cost a history move per chunk.
+ */
+static inline void decode_typed(Block_Coder_Data *b, uint8_t *diff, int start, const int block_size)
+{
+  int i, remain;
+  int size = RU_N(b->offset, BBP_ALIGNMENT)+2*RU_N(b->offset, b->chunk);
+  int path;
+  void *window;
+  uint8_t *dec;
+  
+  STATS_START(t)
+  
+  assert(!b->patch_count);
+  if (posix_memalign(&window, BBP_ALIGNMENT, size))
+    abort();
+  dec = (uint8_t*)window+RU_N(b->offset, BBP_ALIGNMENT);
+  path = diff_offset_path(b->offset, dec);
+  
+  b->cur_data += start;
+  b->cur_block += start;
+  typed_emit(b, b->cur_block, 0);
+  memcpy(dec-b->offset, b->cur_block-b->offset, b->offset);
+  STATS_LAP(b->stats, t, dec_copy)
+  
+  for(i=start;i<b->len-b->chunk;i+=b->chunk)
+    typed_chunk(b, window, size, &dec, path, diff, b->chunk, block_size);
+  
+  remain = (b->len-i)/(b->block_size*4)*(b->block_size*4)/BBP_ALIGNMENT*BBP_ALIGNMENT;
+  typed_chunk(b, window, size, &dec, path, diff, remain, block_size);
+  STATS_RESTART(t)
+  
+  //we already pulled the partially free block, need to point to next one
+  if (b->cur_block_free_bits != 8) {
+    b->cur_block += block_size;
+    b->cur_block_free_bits = 8;
+  }
+  
+  remain = b->len-i-remain;
+  PROBE5(raw__copy, PROBE_DIR_DECODE, start+remain, b->len, block_size, b->offset);
+  dec = typed_slide(b, window, size, dec, remain);
+  memcpy(dec, b->cur_block, remain);
   b->cur_data += remain;
+  b->cur_block += remain;
+  typed_emit(b, dec+remain, 1);
+  b->len_c = b->len;
+  free(window);
+  STATS_LAP(b->stats, t, dec_copy)
+}
+
+static void decode_offset(Block_Coder_Data *b, const int block_size)
+{
+  int remain;
+  int i;
+  int path = diff_offset_path(b->offset, b->data_buf);
+  uint8_t diff[b->chunk] __attribute__((aligned(BBP_ALIGNMENT)));
+  int start;
+  void *window = NULL;
+  uint8_t *dec = NULL;
+  
+  STATS_START(t)
+  
+  comp_decoder_reset(b);
+  
+  //16byte aligned and >= offset
+  start = calc_offset_start(b);
+  
+  if (start+block_size > b->len) {
+    PROBE5(raw__copy, PROBE_DIR_DECODE, b->len, b->len, block_size, b->offset);
+    if (b->typed) {
+      b->cur_data += b->len;
+      typed_emit(b, b->cur_block+b->len, 1);
+    }
+    else {
+      memcpy(b->cur_data, b->cur_block, b->len);
+      b->cur_data += b->len;
+    }
+    b->len_c = b->len;
+    STATS_LAP(b->stats, t, dec_copy)
+    return;
+  }
+  
+  if (b->typed) {
+    decode_typed(b, diff, start, block_size);
+    return;
+  }
+  
+  memcpy(b->cur_data, b->cur_block, start);
+  i = start;
+  //cur_block  is now BBP_ALIGNMENT bytes aligned but may not be block aligned!
+  b->cur_data += start;
+  b->cur_block += start;
+  
+  //large frames: history of RU_N(offset) bytes and one chunk, larger offsets only prefetch
+  if (b->stream && b->offset <= STREAM_MAX_OFFSET && !posix_memalign(&window, BBP_ALIGNMENT, RU_N(b->offset, BBP_ALIGNMENT)+b->chunk)) {
+    dec = (uint8_t*)window+RU_N(b->offset, BBP_ALIGNMENT);
+    memcpy(dec-b->offset, b->cur_data-b->offset, b->offset);
+    path = diff_offset_path(b->offset, dec);
+  }
+  STATS_LAP(b->stats, t, dec_copy)
+  
+  for(;i<b->len-b->chunk;i+=b->chunk) {
+    pull_chunk(b, diff, b->chunk, !dec, block_size);
+    if (b->patch_count)
+      patch_apply(b, diff, i, b->chunk);
+    STATS_LAP(b->stats, t, dec_unpack)
+    undiff_chunk(b, dec, path, diff, b->chunk);
+    STATS_LAP(b->stats, t, dec_undiff)
+  }
+  
+  remain = (b->len-i)/(b->block_size*4)*(b->block_size*4)/BBP_ALIGNMENT*BBP_ALIGNMENT;
+  pull_chunk(b, diff, remain, !dec, block_size);
+  if (b->patch_count)
+    patch_apply(b, diff, i, remain);
+  STATS_LAP(b->stats, t, dec_unpack)
+  undiff_chunk(b, dec, path, diff, remain);
   i+= remain;
+  free(window);
+  STATS_LAP(b->stats, t, dec_undiff)
   
   //we already pulled the partially free block, need to point to next one
   if (b->cur_block_free_bits != 8) {
@@ -177,12 +874,14 @@ static void decode_offset(Block_Coder_Data *b, const int block_size)
   }
   
   remain = b->len-i;
+  PROBE5(raw__copy, PROBE_DIR_DECODE, start+remain, b->len, block_size, b->offset);
   memcpy(b->cur_data, b->cur_block, remain);
   b->cur_data += remain;
   b->cur_block += remain;
   i += remain;
   
   b->len_c = i;
+  STATS_LAP(b->stats, t, dec_copy)
   assert(b->cur_data-b->data_buf==b->len);
 }
 
@@ -233,3 +932,49 @@ void code(Block_Coder_Data *b, uint8_t *in, int len)
   else
     abort();
 }
+
+/*
+ * signal_cost is the estimated size of one width in the signal in bits.
+ * split block sizes are specialized, the superblock size b->block_size only
+ * selects the push/pull functions once per run.
+ */
+void code_adaptive(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map, uint8_t *in, int len, int signal_cost)
+{
+  assert(b->coder == CODER_ADAPTIVE);
+  assert(sb->block_size >= 4 && sb->block_size*4 <= b->block_size);
+  
+  switch (sb->block_size)
+  {
+    case 4 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 4); break;
+    case 8 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 8); break;
+    case 16 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 16); break;
+    case 32 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 32); break;
+    case 64 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 64); break;
+    case 128 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 128); break;
+    case 256 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 256); break;
+    case 512 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 512); break;
+    case 1024 : code_adaptive_split(b, sb, split_map, in, len, signal_cost, 1024); break;
+    default :
+	abort();
+  }
+}
+
+void decode_adaptive(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map)
+{
+  assert(b->coder == CODER_ADAPTIVE);
+  
+  switch (sb->block_size)
+  {
+    case 4 : decode_adaptive_split(b, sb, split_map, 4); break;
+    case 8 : decode_adaptive_split(b, sb, split_map, 8); break;
+    case 16 : decode_adaptive_split(b, sb, split_map, 16); break;
+    case 32 : decode_adaptive_split(b, sb, split_map, 32); break;
+    case 64 : decode_adaptive_split(b, sb, split_map, 64); break;
+    case 128 : decode_adaptive_split(b, sb, split_map, 128); break;
+    case 256 : decode_adaptive_split(b, sb, split_map, 256); break;
+    case 512 : decode_adaptive_split(b, sb, split_map, 512); break;
+    case 1024 : decode_adaptive_split(b, sb, split_map, 1024); break;
+    default :
+	abort();
+  }
+}
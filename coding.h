@@ -27,11 +27,24 @@
 #include "common.h"
 
 #define CODER_NONE 0
+#define CODER_STORED 1 //whole frame copied uncompressed
 
 #define CODER_OFFSET 2
+#define CODER_ADAPTIVE 3 //offset deltas, superblocks optionally split into smaller blocks
+#define CODER_U32 4 //32 bit values, see coding_u32.h
 
 void code(Block_Coder_Data *b, uint8_t *in, int len);
 void decode(Block_Coder_Data *b);
 int offset_calc_signal_len(Block_Coder_Data *b);
+#define OFFSET_SAMPLE_COUNT 4 //windows of offset_sample_incompressible()
+//start of sample window n of b, *size bytes, or -1 if b is too small to be sampled
+int offset_sample_window(Block_Coder_Data *b, int n, int *size);
+int offset_sample_incompressible(Block_Coder_Data *b, uint8_t *in, int signal_stored, int margin);
+//the same, but frames too small to be sampled are estimated whole instead of being left to the check after coding
+int offset_estimate_incompressible(Block_Coder_Data *b, uint8_t *in, int signal_stored, int margin);
+void code_adaptive(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map, uint8_t *in, int len, int signal_cost);
+void decode_adaptive(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map);
+void patch_decoder_init(Block_Coder_Data *b, uint8_t *patch, int count);
+int adaptive_calc_signal_len(Block_Coder_Data *b, Block_Coder_Data *sb, uint8_t *split_map);
 
 #endif
\ No newline at end of file
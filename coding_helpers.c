@@ -23,70 +23,287 @@
 
 #include "coding_helpers.h"
 
+#ifdef BBP_USE_SSE
+#include <emmintrin.h>
+#endif
 #include "intrinsics.h"
 
+//zigzag of the difference prediction-value, the sign moves to the lowest bit
+#ifdef BBP_USE_AVX2
+static inline __m256i zigzag_32(__m256i p_vec, __m256i n_vec)
+{
+  __m256i diff_vec, vec_a, vec_b;
+  __m256i vec128 = set1_1_32(128);
+  
+  diff_vec = (__m256i)sub_u1_32(p_vec, n_vec);
+  vec_a = (__m256i)add_sat_u1_32(diff_vec, diff_vec);
+  vec_b = (__m256i)sub_sat_u1_32(diff_vec, vec128);
+  vec_b = (__m256i)add_sat_u1_32(vec_b, vec_b);
+  vec_b = ~vec_b;
+  return min_u1_32(vec_a, vec_b);
+}
+#elif !defined(BBP_USE_SIMD)
+/*
+ * SWAR for builds without SIMD, where the saturating ops of intrinsics_c.h
+ * are loops over bytes: the zigzag only needs shifts and masks on 64 bit
+ * words, byte differences are left to the vector extension, which gcc and
+ * clang lower to the same word tricks where there are no vector registers
+ * and keep in them where there are (SSE2). Shifts are arithmetic, the bits
+ * they fill in are masked off.
+ */
+static const v2di swar_high = {0x8080808080808080ll, 0x8080808080808080ll};
+static const v2di swar_low = {0x0101010101010101ll, 0x0101010101010101ll};
+
+//0x01 bytes to 0xFF, nothing carries into the next byte
+static inline v2di spread_u8_64(v2di ones)
+{
+  return (ones << 8) - ones;
+}
+
+static inline v16qi zigzag_16(v16qi p_vec, v16qi n_vec)
+{
+  v2di d = (v2di)(p_vec - n_vec);
+  
+  return (v16qi)(((d << 1) & ~swar_low) ^ spread_u8_64((d >> 7) & swar_low));
+}
+#else
+static inline v16qi zigzag_16(v16qi p_vec, v16qi n_vec)
+{
+  v16qi diff_vec, vec_a, vec_b;
+  v16qi vec128 = {128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128};
+  
+  diff_vec = p_vec - n_vec;
+  vec_a = paddusb(diff_vec, diff_vec);
+  vec_b = psubusb(diff_vec, vec128);
+  vec_b = paddusb(vec_b, vec_b);
+  vec_b = ~vec_b;
+  return pminub(vec_a, vec_b);
+}
+#endif
+
+//reconstruction ref-unzigzag(diff)
+#ifndef BBP_USE_SIMD
+static inline v16qi undiff_16(v16qi ref, v16qi diff)
+{
+  v2di z = (v2di)diff;
+  
+  return ref - (v16qi)(((z >> 1) & ~swar_high) ^ spread_u8_64(z & swar_low));
+}
+#else
+static inline v16qi unzigzag_16(v16qi val)
+{
+  v2di mask_odd = {0x0101010101010101, 0x0101010101010101};
+  v2di mask_shift = {0xFEFEFEFEFEFEFEFE, 0xFEFEFEFEFEFEFEFE};
+  v16qi v_0 = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  v16qi odd_mask2;
+  
+  odd_mask2 = (v16qi)pand(mask_odd, (v2di)val);
+  odd_mask2 = pcmpgtb(odd_mask2, v_0);
+  val = (v16qi)pand(mask_shift, (v2di)val);
+  val = (v16qi)psrldi((v4si)val, 1);
+  return (v16qi)pxor((v2di)odd_mask2, (v2di)val);
+}
+
+static inline v16qi undiff_16(v16qi ref, v16qi diff)
+{
+  return ref - unzigzag_16(diff);
+}
+#endif
+
+int diff_offset_path(int off, uint8_t *data)
+{
+  if ((uintptr_t)data % DIFF_PATH_ALIGNMENT)
+    return DIFF_PATH_UNALIGNED;
+  if (off == 32)
+    return DIFF_PATH_REG32;
+  if (off == 64)
+    return DIFF_PATH_REG64;
+  if (!(off % BBP_ALIGNMENT))
+    return DIFF_PATH_ALIGNED;
+  return DIFF_PATH_UNALIGNED;
+}
+
+const char *diff_offset_path_name(int path)
+{
+  switch (path) {
+    case DIFF_PATH_ALIGNED : return "aligned";
+    case DIFF_PATH_REG32 : return "reg 32";
+    case DIFF_PATH_REG64 : return "reg 64";
+    default : return "unaligned";
+  }
+}
+
 void _code_diff_offset(uint8_t *n, uint8_t *diff, int off, int block_size)
 {  
+  int j;
   
 #ifdef BBP_USE_AVX2
-  __m256i p_vec, diff_vec, vec_a, vec_b, n_vec;
-  __m256i vec128 = set1_1_32(128);;
-  int j;
+  __m256i p_vec;
   
   for(j=0;j<block_size/32;j++) {
     LOAD_UA_32(p_vec, n-off+j*32)
-    //TODO maybe add extra version for aligned offsets? But seems to be slower...
-    //p_vec = *(v16qi*)(n-off+j*16);
-    n_vec = *(__m256i*)(n+j*32);
-    diff_vec = (__m256i)sub_u1_32(p_vec, n_vec);
-    vec_a = (__m256i)add_sat_u1_32(diff_vec, diff_vec);
-    vec_b = (__m256i)sub_sat_u1_32(diff_vec, vec128);
-    vec_b = (__m256i)add_sat_u1_32(vec_b, vec_b);
-    vec_b = ~vec_b;
-    *(__m256i*)(diff+j*32) = min_u1_32(vec_a, vec_b);
+    *(__m256i*)(diff+j*32) = zigzag_32(p_vec, *(__m256i*)(n+j*32));
   }
 #else
-  v16qi p_vec, diff_vec, vec_a, vec_b, n_vec;
-  v16qi vec128 = {128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128};
-  int j;
+  v16qi p_vec;
   
   for(j=0;j<block_size/16;j++) {
     LOAD_UA(p_vec, n-off+j*16)
-    //TODO maybe add extra version for aligned offsets? But seems to be slower...
-    //p_vec = *(v16qi*)(n-off+j*16);
-    n_vec = *(v16qi*)(n+j*16);
-    diff_vec = p_vec - n_vec;
-    vec_a = paddusb(diff_vec, diff_vec);
-    vec_b = psubusb(diff_vec, vec128);
-    vec_b = paddusb(vec_b, vec_b);
-    vec_b = ~vec_b;
-    *(v16qi*)(diff+j*16) = pminub(vec_a, vec_b);
+    *(v16qi*)(diff+j*16) = zigzag_16(p_vec, *(v16qi*)(n+j*16));
   }
 #endif
 }
 
+//off is a multiple of BBP_ALIGNMENT, so the prediction is as aligned as n
+void _code_diff_offset_aligned(uint8_t *n, uint8_t *diff, int off, int block_size)
+{  
+  int j;
+  
+#ifdef BBP_USE_AVX2
+  for(j=0;j<block_size/32;j++)
+    *(__m256i*)(diff+j*32) = zigzag_32(*(__m256i*)(n-off+j*32), *(__m256i*)(n+j*32));
+#else
+  for(j=0;j<block_size/16;j++)
+    *(v16qi*)(diff+j*16) = zigzag_16(*(v16qi*)(n-off+j*16), *(v16qi*)(n+j*16));
+#endif
+}
+
+/*
+ * for off 32 and 64 the prediction is the input loaded off/16 steps before,
+ * so the previous row rotates through registers instead of being loaded twice,
+ * a remainder shorter than off is finished with the aligned kernel
+ */
+static inline void code_diff_offset_reg(uint8_t *n, uint8_t *diff, const int off, int block_size)
+{
+  int j, k;
+  int len = block_size/off*off;
+  
+#ifdef BBP_USE_AVX2
+  __m256i prev[2], n_vec;
+  
+  for(k=0;k<off/32;k++)
+    prev[k] = *(__m256i*)(n-off+k*32);
+  for(j=0;j<len;j+=off)
+    for(k=0;k<off/32;k++) {
+      n_vec = *(__m256i*)(n+j+k*32);
+      *(__m256i*)(diff+j+k*32) = zigzag_32(prev[k], n_vec);
+      prev[k] = n_vec;
+    }
+#else
+  v16qi prev[4], n_vec;
+  
+  for(k=0;k<off/16;k++)
+    prev[k] = *(v16qi*)(n-off+k*16);
+  for(j=0;j<len;j+=off)
+    for(k=0;k<off/16;k++) {
+      n_vec = *(v16qi*)(n+j+k*16);
+      *(v16qi*)(diff+j+k*16) = zigzag_16(prev[k], n_vec);
+      prev[k] = n_vec;
+    }
+#endif
+  
+  if (len < block_size)
+    _code_diff_offset_aligned(n+len, diff+len, off, block_size-len);
+}
+
+void _code_diff_offset_reg32(uint8_t *n, uint8_t *diff, int block_size)
+{
+  code_diff_offset_reg(n, diff, 32, block_size);
+}
+
+void _code_diff_offset_reg64(uint8_t *n, uint8_t *diff, int block_size)
+{
+  code_diff_offset_reg(n, diff, 64, block_size);
+}
+
 void _decode_lut_inv_diff(uint8_t *dec, uint8_t *diff, uint8_t *off, int block_size)
 {
   int j;
-  v2di mask_odd = {0x0101010101010101, 0x0101010101010101};
-  v2di mask_shift = {0xFEFEFEFEFEFEFEFE, 0xFEFEFEFEFEFEFEFE};
-  v16qi v_0 = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-  v16qi val, odd_mask2;
   v16qi off_v, dec_v;
   
   for(j=0;j<block_size;j+=16) {
-    val = *(v16qi*)(diff+j);
-    odd_mask2 = (v16qi)pand(mask_odd, (v2di)val);
-    odd_mask2 = pcmpgtb(odd_mask2, v_0);
-    val = (v16qi)pand(mask_shift, (v2di)val);
-    val = (v16qi)psrldi((v4si)val, 1);
-    val = (v16qi)pxor((v2di)odd_mask2, (v2di)val);
     LOAD_UA(off_v, off+j)
-    dec_v= off_v - val;
+    dec_v = undiff_16(off_v, *(v16qi*)(diff+j));
     memcpy(dec+j, &dec_v, 16);
   }
 }
 
+//dec and off are 16 byte aligned
+void _decode_lut_inv_diff_aligned(uint8_t *dec, uint8_t *diff, uint8_t *off, int block_size)
+{
+  int j;
+  
+  for(j=0;j<block_size;j+=16)
+    *(v16qi*)(dec+j) = undiff_16(*(v16qi*)(off+j), *(v16qi*)(diff+j));
+}
+
+/*
+ * the prediction was decoded off/16 steps before and is still in a register,
+ * which removes the store to load forwarding from the dependency chain of
+ * every row
+ */
+static inline void decode_inv_diff_reg(uint8_t *dec, uint8_t *diff, const int off, int block_size)
+{
+  int j, k;
+  int len = block_size/off*off;
+  v16qi prev[4];
+  
+  for(k=0;k<off/16;k++)
+    prev[k] = *(v16qi*)(dec-off+k*16);
+  for(j=0;j<len;j+=off)
+    for(k=0;k<off/16;k++) {
+      prev[k] = undiff_16(prev[k], *(v16qi*)(diff+j+k*16));
+      *(v16qi*)(dec+j+k*16) = prev[k];
+    }
+  
+  if (len < block_size)
+    _decode_lut_inv_diff_aligned(dec+len, diff+len, dec+len-off, block_size-len);
+}
+
+void _decode_lut_inv_diff_reg32(uint8_t *dec, uint8_t *diff, int block_size)
+{
+  decode_inv_diff_reg(dec, diff, 32, block_size);
+}
+
+void _decode_lut_inv_diff_reg64(uint8_t *dec, uint8_t *diff, int block_size)
+{
+  decode_inv_diff_reg(dec, diff, 64, block_size);
+}
+
+void _code_diff_offset_path(int path, uint8_t *n, uint8_t *diff, int off, int block_size)
+{
+  switch (path) {
+    case DIFF_PATH_ALIGNED : _code_diff_offset_aligned(n, diff, off, block_size); break;
+    case DIFF_PATH_REG32 : _code_diff_offset_reg32(n, diff, block_size); break;
+    case DIFF_PATH_REG64 : _code_diff_offset_reg64(n, diff, block_size); break;
+    default : _code_diff_offset(n, diff, off, block_size);
+  }
+}
+
+void _decode_inv_diff_path(int path, uint8_t *dec, uint8_t *diff, int off, int block_size)
+{
+  switch (path) {
+    case DIFF_PATH_ALIGNED : _decode_lut_inv_diff_aligned(dec, diff, dec-off, block_size); break;
+    case DIFF_PATH_REG32 : _decode_lut_inv_diff_reg32(dec, diff, block_size); break;
+    case DIFF_PATH_REG64 : _decode_lut_inv_diff_reg64(dec, diff, block_size); break;
+    default : _decode_lut_inv_diff(dec, diff, dec-off, block_size);
+  }
+}
+
+void _stream_copy(uint8_t *dst, uint8_t *src, int len)
+{
+#ifdef BBP_USE_SSE
+  int j;
+  
+  for(j=0;j<len/16*16;j+=16)
+    _mm_stream_si128((__m128i*)(dst+j), *(__m128i*)(src+j));
+  memcpy(dst+j, src+j, len-j);
+  _mm_sfence();
+#else
+  memcpy(dst, src, len);
+#endif
+}
+
 CFINLINE void _code_max(uint8_t *diff, int *bits, const int block_size)
 {
   if (block_size >= 16) {
@@ -228,7 +445,21 @@ void _code_max_chunk(uint8_t *diff, int *bits, const int block_size, const int c
     abort();
 #else
   int i;
-  for(i=0;i<chunk_size/block_size;i++)
-    _code_max(diff+i*block_size, bits+i, block_size);
+  
+  if (block_size == 4) {
+    uint64_t max_l;
+    
+    //two blocks per word, the folds only move bytes down within their half
+    for(i=0;i<chunk_size/8;i++) {
+      max_l = ((uint64_t*)diff)[i];
+      max_l |= max_l >> 16;
+      max_l |= max_l >> 8;
+      bits[2*i] = clz_lut[(uint8_t)max_l];
+      bits[2*i+1] = clz_lut[(uint8_t)(max_l >> 32)];
+    }
+  }
+  else
+    for(i=0;i<chunk_size/block_size;i++)
+      _code_max(diff+i*block_size, bits+i, block_size);
 #endif
 }
@@ -37,4 +37,32 @@ CFINLINE void _code_max(uint8_t *diff, int *bits, const int block_size);
 CFINLINE void _code_max_chunk(uint8_t *diff, int *bits, const int block_size, const int chunk_size);
 CFINLINE void _decode_lut_inv_diff(uint8_t *dec, uint8_t *diff, uint8_t *off, int block_size);
 
+//variants of the diff and reconstruction kernels, picked once per frame by diff_offset_path()
+#define DIFF_PATH_UNALIGNED 0 //any offset
+#define DIFF_PATH_ALIGNED   1 //offset a multiple of BBP_ALIGNMENT, aligned loads of the previous row
+#define DIFF_PATH_REG32     2 //offset 32, previous row kept in registers
+#define DIFF_PATH_REG64     3 //offset 64
+
+//alignment of data the aligned and register variants need, the widest vector of the kernels
+#ifdef BBP_USE_AVX2
+#define DIFF_PATH_ALIGNMENT 32
+#else
+#define DIFF_PATH_ALIGNMENT 16
+#endif
+
+//data is the input (coding) or output (decoding) of the frame
+int diff_offset_path(int off, uint8_t *data);
+const char *diff_offset_path_name(int path);
+void _code_diff_offset_aligned(uint8_t *n, uint8_t *diff, int off, int block_size);
+void _code_diff_offset_reg32(uint8_t *n, uint8_t *diff, int block_size);
+void _code_diff_offset_reg64(uint8_t *n, uint8_t *diff, int block_size);
+void _decode_lut_inv_diff_aligned(uint8_t *dec, uint8_t *diff, uint8_t *off, int block_size);
+void _decode_lut_inv_diff_reg32(uint8_t *dec, uint8_t *diff, int block_size);
+void _decode_lut_inv_diff_reg64(uint8_t *dec, uint8_t *diff, int block_size);
+//the kernels of path, the reference of the reconstruction is dec-off
+void _code_diff_offset_path(int path, uint8_t *n, uint8_t *diff, int off, int block_size);
+void _decode_inv_diff_path(int path, uint8_t *dec, uint8_t *diff, int off, int block_size);
+//copy with non-temporal stores where available, dst and src are 16 byte aligned
+void _stream_copy(uint8_t *dst, uint8_t *src, int len);
+
 #endif
\ No newline at end of file
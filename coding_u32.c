@@ -0,0 +1,221 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "coding_u32.h"
+
+//transform block n of in to d, returns the bit width of the result
+static inline int transform_block(uint32_t *in, uint32_t *d, uint32_t *refs, int n, int transform, const int block_size)
+{
+  int i;
+  uint32_t min, or = 0;
+  
+  in += n*block_size;
+  if (transform == BBP_U32_D1) {
+    d[0] = in[0] - (n ? in[-1] : 0);
+    for(i=1;i<block_size;i++)
+      d[i] = in[i]-in[i-1];
+  }
+  else {
+    min = in[0];
+    for(i=1;i<block_size;i++)
+      min = in[i] < min ? in[i] : min;
+    refs[n] = min;
+    for(i=0;i<block_size;i++)
+      d[i] = in[i]-min;
+  }
+  
+  for(i=0;i<block_size;i++)
+    or |= d[i];
+  
+  return or ? 32-__builtin_clz(or) : 0;
+}
+
+static inline void push_block_u32(Block_Coder_Data *b, uint32_t *d, int bits, const int block_size)
+{
+  int i, shift;
+  uint32_t *cur = (uint32_t*)b->cur_block;
+  
+  *b->cur_signal++ = bits;
+  if (!bits)
+    return;
+  
+  if (b->cur_block_free_bits == 32) {
+    //fresh words, nothing to keep
+    b->cur_block_free_bits -= bits;
+    for(i=0;i<block_size;i++)
+      cur[i] = d[i] << b->cur_block_free_bits;
+  }
+  else if (b->cur_block_free_bits >= bits) {
+    b->cur_block_free_bits -= bits;
+    for(i=0;i<block_size;i++)
+      cur[i] |= d[i] << b->cur_block_free_bits;
+  }
+  else {
+    //first use up remaining free bits, then continue in the next words
+    shift = bits - b->cur_block_free_bits;
+    for(i=0;i<block_size;i++)
+      cur[i] |= d[i] >> shift;
+    cur += block_size;
+    b->cur_block_free_bits = 32 - shift;
+    for(i=0;i<block_size;i++)
+      cur[i] = d[i] << b->cur_block_free_bits;
+  }
+  
+  if (!b->cur_block_free_bits) {
+    cur += block_size;
+    b->cur_block_free_bits = 32;
+  }
+  b->cur_block = (uint8_t*)cur;
+}
+
+static inline void pull_block_u32(Block_Coder_Data *b, uint32_t *d, const int block_size)
+{
+  int i, shift;
+  uint32_t *cur = (uint32_t*)b->cur_block;
+  int bits = *b->cur_signal++;
+  uint32_t mask = (uint32_t)((1ull << bits)-1);
+  
+  if (!bits) {
+    for(i=0;i<block_size;i++)
+      d[i] = 0;
+    return;
+  }
+  
+  if (b->cur_block_free_bits >= bits) {
+    b->cur_block_free_bits -= bits;
+    for(i=0;i<block_size;i++)
+      d[i] = (cur[i] >> b->cur_block_free_bits) & mask;
+    if (!b->cur_block_free_bits) {
+      cur += block_size;
+      b->cur_block_free_bits = 32;
+    }
+  }
+  else {
+    shift = bits - b->cur_block_free_bits;
+    for(i=0;i<block_size;i++)
+      d[i] = (cur[i] & ((1u << b->cur_block_free_bits)-1)) << shift;
+    cur += block_size;
+    b->cur_block_free_bits = 32 - shift;
+    for(i=0;i<block_size;i++)
+      d[i] |= cur[i] >> b->cur_block_free_bits;
+  }
+  b->cur_block = (uint8_t*)cur;
+}
+
+static inline void code_u32_dynamic(Block_Coder_Data *b, uint32_t *in, uint32_t *refs, int count, int transform, const int block_size)
+{
+  int n, bits, pad;
+  int tail = count % block_size;
+  uint32_t d[block_size];
+  
+  b->cur_block = b->block_buf;
+  b->cur_block_free_bits = 32;
+  b->cur_signal = b->signal_buf;
+  b->len_c = -1;
+  
+  for(n=0;n<count/block_size;n++) {
+    //a block spills into at most one further group of words
+    if (b->cur_block+2*4*block_size > b->block_end)
+      return;
+    bits = transform_block(in, d, refs, n, transform, block_size);
+    push_block_u32(b, d, bits, block_size);
+  }
+  if (b->cur_block_free_bits != 32)
+    b->cur_block += 4*block_size;
+  //word groups of small blocks are less than BBP_ALIGNMENT
+  pad = RU_N(b->cur_block-b->block_buf, BBP_ALIGNMENT)-(b->cur_block-b->block_buf);
+  
+  if (b->cur_block+pad+RU_N(4*tail, BBP_ALIGNMENT) > b->block_end)
+    return;
+  memset(b->cur_block, 0, pad);
+  b->cur_block += pad;
+  memcpy(b->cur_block, in+count-tail, 4*tail);
+  memset(b->cur_block+4*tail, 0, RU_N(4*tail, BBP_ALIGNMENT)-4*tail);
+  b->cur_block += RU_N(4*tail, BBP_ALIGNMENT);
+  
+  b->len_c = b->cur_block-b->block_buf;
+}
+
+static inline void decode_u32_dynamic(Block_Coder_Data *b, uint32_t *refs, uint32_t *out, int count, int transform, const int block_size)
+{
+  int n, i;
+  int tail = count % block_size;
+  uint32_t prev = 0;
+  uint32_t d[block_size];
+  
+  b->cur_block = b->block_buf;
+  b->cur_block_free_bits = 32;
+  b->cur_signal = b->signal_buf;
+  
+  for(n=0;n<count/block_size;n++,out+=block_size) {
+    pull_block_u32(b, d, block_size);
+    if (transform == BBP_U32_D1) {
+      //the prefix sum is a serial dependency, but only one add per value
+      for(i=0;i<block_size;i++) {
+        prev += d[i];
+        out[i] = prev;
+      }
+    }
+    else
+      for(i=0;i<block_size;i++)
+        out[i] = d[i]+refs[n];
+  }
+  if (b->cur_block_free_bits != 32)
+    b->cur_block += 4*block_size;
+  b->cur_block = b->block_buf+RU_N(b->cur_block-b->block_buf, BBP_ALIGNMENT);
+  
+  memcpy(out, b->cur_block, 4*tail);
+  b->cur_block += RU_N(4*tail, BBP_ALIGNMENT);
+}
+
+void code_u32(Block_Coder_Data *b, uint32_t *in, uint32_t *refs, int count, int transform)
+{
+  switch (b->block_size) {
+    case 4 : code_u32_dynamic(b, in, refs, count, transform, 4); break;
+    case 8 : code_u32_dynamic(b, in, refs, count, transform, 8); break;
+    case 16 : code_u32_dynamic(b, in, refs, count, transform, 16); break;
+    case 32 : code_u32_dynamic(b, in, refs, count, transform, 32); break;
+    case 64 : code_u32_dynamic(b, in, refs, count, transform, 64); break;
+    case 128 : code_u32_dynamic(b, in, refs, count, transform, 128); break;
+    case 256 : code_u32_dynamic(b, in, refs, count, transform, 256); break;
+    case 512 : code_u32_dynamic(b, in, refs, count, transform, 512); break;
+    case 1024 : code_u32_dynamic(b, in, refs, count, transform, 1024); break;
+    default : abort();
+  }
+}
+
+void decode_u32(Block_Coder_Data *b, uint32_t *refs, uint32_t *out, int count, int transform)
+{
+  switch (b->block_size) {
+    case 4 : decode_u32_dynamic(b, refs, out, count, transform, 4); break;
+    case 8 : decode_u32_dynamic(b, refs, out, count, transform, 8); break;
+    case 16 : decode_u32_dynamic(b, refs, out, count, transform, 16); break;
+    case 32 : decode_u32_dynamic(b, refs, out, count, transform, 32); break;
+    case 64 : decode_u32_dynamic(b, refs, out, count, transform, 64); break;
+    case 128 : decode_u32_dynamic(b, refs, out, count, transform, 128); break;
+    case 256 : decode_u32_dynamic(b, refs, out, count, transform, 256); break;
+    case 512 : decode_u32_dynamic(b, refs, out, count, transform, 512); break;
+    case 1024 : decode_u32_dynamic(b, refs, out, count, transform, 1024); break;
+    default : abort();
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_CODING_U32_H
+#define _BBP_CODING_U32_H
+
+#include "common.h"
+
+/*
+ * coding of 32 bit integer arrays: each block of block_size values is
+ * transformed (BBP_U32_D1: difference to the previous value, BBP_U32_FOR:
+ * difference to the block minimum, which is stored in refs) and packed at the
+ * bit width (0-32) of the OR of its values. The packing is the same as for
+ * bytes with 32 bit lanes: a block takes bits from the top of the current
+ * block_size words and continues in the next ones, the widths go to the
+ * signal. Values behind the last full block are stored raw behind the blocks.
+ */
+
+//codes count values from in to b (block_buf, block_end, signal_buf and block_size set), b->len_c is -1 if coding stopped at block_end
+void code_u32(Block_Coder_Data *b, uint32_t *in, uint32_t *refs, int count, int transform);
+//decodes count values from b (block_buf, signal_buf and block_size set) to out
+void decode_u32(Block_Coder_Data *b, uint32_t *refs, uint32_t *out, int count, int transform);
+
+#endif
@@ -43,6 +43,11 @@ void raninit( ranctx *x, u4 seed ) {
 }
 
 int inits_count = 0;
+int inner_chunk = CHUNK_SIZE;
+
+uint8_t *lut;
+uint8_t *lut_inv;
+uint8_t *clz_lut;
 
 //lut for wrapped diffs:
 /* lut[n] - n
@@ -38,7 +38,7 @@ typedef uint16_t v8qi __attribute__ ((vector_size (16)));
 typedef int32_t v4si __attribute__ ((vector_size (16)));
 
 //from http://burtleburtle.net/bob/rand/smallprng.html
-typedef unsigned long int  u4;
+typedef uint32_t u4;
 typedef struct ranctx { u4 a; u4 b; u4 c; u4 d; } ranctx;
 
 typedef struct {
@@ -46,6 +46,16 @@ typedef struct {
   uint8_t symbol;
 } Sort_Data;
 
+//planes of typed frames, see shuffle.h
+typedef struct {
+  int elem_size, xor;
+  int row; //elements per group
+  int count; //elements
+  int stored; //bit p set: plane p is stored in planes instead of the rows
+  uint8_t *planes;
+  int pos; //decoding: elements written to the output
+} Typed_Rows;
+
 typedef struct {
   uint8_t *cur_data; //pointer to current data (only used for decoding atm
   uint8_t *block_buf; //block buffer
@@ -61,7 +71,18 @@ typedef struct {
   int block_size;
   int text_coder_pos;
   int offset;
-  int len, len_c;
+  int len, len_c; //len_c is -1 if coding stopped at block_end
+  uint8_t *block_end; //coder output limit, the coder never writes at or past it
+  uint8_t *patch; //patched frames: exception stream cursor, NULL otherwise
+  int patch_count; //exceptions written (coding) or left (decoding)
+  int patch_pos; //position after the last exception (coding) or of the next one (decoding)
+  int stream; //decoding: large frame, output through a window with non-temporal stores
+  int prefetch; //decoding: prefetch distance of large frames, 0 disables it
+  int chunk; //inner chunk size (power of 2) of the diff/width/pack pipeline, stored in the header
+  Typed_Rows *typed; //decoding: typed frames (stream of plane rows, see shuffle.h), NULL otherwise
+#ifdef CALC_STATS
+  Bbp_Stats *stats;
+#endif
 } Block_Coder_Data;
 
 typedef struct {
@@ -95,15 +116,11 @@ typedef struct {
   ranctx rng_st;
 } Comp_Context;
 
-uint8_t *lut; //lut for wrapped delta mapping
-uint8_t *lut_inv; //lut for wrapped delta mapping
-uint8_t *clz_lut; //lut to count max bit usage
+extern uint8_t *lut; //lut for wrapped delta mapping
+extern uint8_t *lut_inv; //lut for wrapped delta mapping
+extern uint8_t *clz_lut; //lut to count max bit usage
 extern int inits_count;
-
-#ifdef CALC_STATS
-  uint32_t hist[9];
-  uint32_t hist_ext[256];
-#endif
+extern int inner_chunk; //chunk size of new frames, see bbp_inner_chunk()
 
 u4 ranval( ranctx *x );
 void raninit( ranctx *x, u4 seed );
@@ -0,0 +1,309 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * generates deterministic raw test images, only integer arithmetic and the
+ * ranctx prng from common.c are used, so the output for a given seed and
+ * parameters is identical on every machine
+ */
+
+#include "common.h"
+
+#define PATTERN_GRADIENT 0 //smooth 2d gradient with noise of depth bits
+#define PATTERN_NOISE    1 //uniform noise of depth bits
+#define PATTERN_BAYER    2 //RGGB mosaic of a smooth scene
+#define PATTERN_SPARSE   3 //frames which differ in a few small rectangles
+#define PATTERN_TEXT     4 //text on a gradient
+#define PATTERN_16BIT    5 //little endian 16 bit samples with bits significant bits
+#define PATTERN_COUNT    6
+
+static const char *pattern_names[PATTERN_COUNT] = {"gradient", "noise", "bayer", "sparse", "text", "16bit"};
+
+#define GLYPH_COUNT 96
+#define GLYPH_W 5
+#define GLYPH_H 7
+#define CELL_W 6
+#define CELL_H 12
+
+typedef struct {
+  int width, height; //in pixels
+  int depth; //noise bits
+  int bits; //significant bits of 16 bit samples
+  int frames;
+  int changes; //changed rectangles per frame (sparse)
+  u4 seed;
+} Gen_Params;
+
+static uint8_t clamp8(int v)
+{
+  if (v < 0)
+    return 0;
+  if (v > 255)
+    return 255;
+  return v;
+}
+
+//signed noise with depth bits, centered around 0
+static int noise(ranctx *r, int depth)
+{
+  if (!depth)
+    return 0;
+  return (int)(ranval(r) & ((1u << depth)-1)) - (1 << (depth-1));
+}
+
+//0..255 over the image diagonal
+static int gradient(Gen_Params *p, int x, int y)
+{
+  return (x*255/(p->width > 1 ? p->width-1 : 1) + y*255/(p->height > 1 ? p->height-1 : 1))/2;
+}
+
+static void gen_gradient(uint8_t *buf, Gen_Params *p, ranctx *r)
+{
+  int x, y;
+
+  for(y=0;y<p->height;y++)
+    for(x=0;x<p->width;x++)
+      *buf++ = clamp8(gradient(p, x, y) + noise(r, p->depth));
+}
+
+static void gen_noise(uint8_t *buf, Gen_Params *p, ranctx *r)
+{
+  size_t i;
+
+  for(i=0;i<(size_t)p->width*p->height;i++)
+    buf[i] = clamp8(128 + noise(r, p->depth));
+}
+
+static void gen_bayer(uint8_t *buf, Gen_Params *p, ranctx *r)
+{
+  int x, y, v, dx, dy, d2, r2;
+  int cx = p->width/2, cy = p->height/2;
+
+  r2 = (p->height/3)*(p->height/3);
+  for(y=0;y<p->height;y++)
+    for(x=0;x<p->width;x++) {
+      if (!(y & 1))
+        v = !(x & 1) ? x*255/p->width : (x+y)*255/(p->width+p->height); //R G
+      else
+        v = !(x & 1) ? (x+y)*255/(p->width+p->height) : y*255/p->height; //G B
+      //a bright disc in the middle
+      dx = x-cx;
+      dy = y-cy;
+      d2 = dx*dx+dy*dy;
+      if (d2 < r2)
+        v += 64*(r2-d2)/r2;
+      *buf++ = clamp8(v + noise(r, p->depth));
+    }
+}
+
+static void gen_sparse(uint8_t *buf, Gen_Params *p, ranctx *r)
+{
+  int f, c, x, y, x0, y0, w, h, v;
+  size_t frame = (size_t)p->width*p->height;
+  uint8_t *cur;
+
+  gen_gradient(buf, p, r);
+
+  for(f=1;f<p->frames;f++) {
+    cur = buf+f*frame;
+    memcpy(cur, cur-frame, frame);
+    for(c=0;c<p->changes;c++) {
+      w = 1 + ranval(r) % 32;
+      h = 1 + ranval(r) % 32;
+      x0 = ranval(r) % p->width;
+      y0 = ranval(r) % p->height;
+      v = ranval(r) & 0xFF;
+      for(y=y0;y<y0+h && y<p->height;y++)
+        for(x=x0;x<x0+w && x<p->width;x++)
+          cur[y*p->width+x] = clamp8(v + noise(r, p->depth));
+    }
+  }
+}
+
+static void gen_text(uint8_t *buf, Gen_Params *p, ranctx *r)
+{
+  int g, i, x, y, cx, cy, gx, gy;
+  uint64_t glyphs[GLYPH_COUNT];
+
+  //random 5x7 glyphs with about 40% of the pixels set
+  for(g=0;g<GLYPH_COUNT;g++) {
+    glyphs[g] = 0;
+    for(i=0;i<GLYPH_W*GLYPH_H;i++)
+      if (ranval(r) % 100 < 40)
+        glyphs[g] |= 1ull << i;
+  }
+
+  //light background
+  for(y=0;y<p->height;y++)
+    for(x=0;x<p->width;x++)
+      buf[y*p->width+x] = clamp8(192 + gradient(p, x, y)/4 + noise(r, p->depth));
+
+  for(cy=CELL_H;cy+CELL_H<=p->height;cy+=CELL_H)
+    for(cx=CELL_W;cx+CELL_W<=p->width-CELL_W;cx+=CELL_W) {
+      //about 15% spaces
+      if (ranval(r) % 100 < 15)
+        continue;
+      g = ranval(r) % GLYPH_COUNT;
+      for(gy=0;gy<GLYPH_H;gy++)
+        for(gx=0;gx<GLYPH_W;gx++)
+          if (glyphs[g] & (1ull << (gy*GLYPH_W+gx)))
+            buf[(cy+gy)*p->width+cx+gx] = clamp8(24 + noise(r, p->depth));
+    }
+}
+
+static void gen_16bit(uint8_t *buf, Gen_Params *p, ranctx *r)
+{
+  int x, y, v;
+  int max = (1 << p->bits)-1;
+
+  for(y=0;y<p->height;y++)
+    for(x=0;x<p->width;x++) {
+      v = (int)((int64_t)gradient(p, x, y)*max/255) + noise(r, p->depth);
+      if (v < 0) v = 0;
+      if (v > max) v = max;
+      *buf++ = v & 0xFF;
+      *buf++ = v >> 8;
+    }
+}
+
+//bytes per line, which is the offset to use for the image
+static int pattern_line(int pattern, Gen_Params *p)
+{
+  return pattern == PATTERN_16BIT ? 2*p->width : p->width;
+}
+
+static size_t pattern_size(int pattern, Gen_Params *p)
+{
+  size_t size = (size_t)pattern_line(pattern, p)*p->height;
+
+  if (pattern == PATTERN_SPARSE)
+    size *= p->frames;
+
+  return size;
+}
+
+static uint8_t *generate(int pattern, Gen_Params *p)
+{
+  ranctx r;
+  uint8_t *buf = malloc(pattern_size(pattern, p));
+
+  assert(buf);
+  raninit(&r, p->seed);
+
+  switch (pattern) {
+    case PATTERN_GRADIENT : gen_gradient(buf, p, &r); break;
+    case PATTERN_NOISE : gen_noise(buf, p, &r); break;
+    case PATTERN_BAYER : gen_bayer(buf, p, &r); break;
+    case PATTERN_SPARSE : gen_sparse(buf, p, &r); break;
+    case PATTERN_TEXT : gen_text(buf, p, &r); break;
+    case PATTERN_16BIT : gen_16bit(buf, p, &r); break;
+  }
+
+  return buf;
+}
+
+static void write_pattern(int pattern, Gen_Params *p, const char *path)
+{
+  FILE *f;
+  size_t size = pattern_size(pattern, p);
+  uint8_t *buf = generate(pattern, p);
+  //bayer rows repeat every two lines
+  int offset = pattern == PATTERN_BAYER ? 2*pattern_line(pattern, p) : pattern_line(pattern, p);
+
+  f = fopen(path, "wb");
+  if (!f || fwrite(buf, 1, size, f) != size) {
+    fprintf(stderr, "ERROR: could not write %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fclose(f);
+  free(buf);
+
+  printf("%s %dx%d: %zu bytes, offset %d -> %s\n", pattern_names[pattern], p->width, p->height, size, offset, path);
+}
+
+static void help(void)
+{
+  printf("usage: bbp_corpus [options] <pattern> <out>\n");
+  printf("       bbp_corpus [options] all <directory>\n");
+  printf("writes a deterministic raw test image, patterns are gradient, noise, bayer, sparse, text and 16bit\n");
+  printf("'all' writes every pattern as <directory>/<pattern>.raw\n");
+  printf("  -w <n>   width in pixels (default 1920)\n");
+  printf("  -h <n>   height in pixels (default 1080)\n");
+  printf("  -d <n>   noise depth in bits (default 2)\n");
+  printf("  -b <n>   significant bits for 16bit (default 12)\n");
+  printf("  -f <n>   frames for sparse (default 8)\n");
+  printf("  -c <n>   changed rectangles per frame for sparse (default 16)\n");
+  printf("  -s <n>   seed (default 1)\n");
+  printf("the offset to use with bbp is printed for each image\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, i, pattern = -1;
+  char path[4096];
+  Gen_Params p;
+
+  p.width = 1920;
+  p.height = 1080;
+  p.depth = 2;
+  p.bits = 12;
+  p.frames = 8;
+  p.changes = 16;
+  p.seed = 1;
+
+  while ((opt = getopt(argc, argv, "w:h:d:b:f:c:s:")) != -1) {
+    switch (opt) {
+      case 'w' : p.width = atoi(optarg); break;
+      case 'h' : p.height = atoi(optarg); break;
+      case 'd' : p.depth = atoi(optarg); break;
+      case 'b' : p.bits = atoi(optarg); break;
+      case 'f' : p.frames = atoi(optarg); break;
+      case 'c' : p.changes = atoi(optarg); break;
+      case 's' : p.seed = strtoul(optarg, NULL, 0); break;
+      default : help();
+    }
+  }
+
+  if (argc-optind != 2 || p.width < 2 || p.height < 2 || p.depth < 0 || p.depth > 16 || p.bits < 1 || p.bits > 16 || p.frames < 1 || p.changes < 0)
+    help();
+
+  if (!strcmp(argv[optind], "all")) {
+    mkdir(argv[optind+1], 0755);
+    for(i=0;i<PATTERN_COUNT;i++) {
+      snprintf(path, sizeof(path), "%s/%s.raw", argv[optind+1], pattern_names[i]);
+      write_pattern(i, &p, path);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  for(i=0;i<PATTERN_COUNT;i++)
+    if (!strcmp(argv[optind], pattern_names[i]))
+      pattern = i;
+  if (pattern < 0)
+    help();
+
+  write_pattern(pattern, &p, argv[optind+1]);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * compares the C entry points (bbp_code_offset() with bs_r -1, bbp_decode())
+ * with bbp::Frame from bbp.hpp, once with only the block size as template
+ * parameter and once with offset and frame length fixed at compile time
+ * (BBP_CPP_BENCH_OFFSET, the offset of the test image, and
+ * BBP_DEFAULT_CHUNK_SIZE). Frames are verified by decoding each variant's
+ * output with the other decoder.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <chrono>
+
+#include "bbp.hpp"
+
+#ifndef BBP_CPP_BENCH_OFFSET
+#define BBP_CPP_BENCH_OFFSET 854
+#endif
+
+#define FRAME_SIZE BBP_DEFAULT_CHUNK_SIZE
+
+typedef int (*Code_Func)(const uint8_t *in, uint8_t *out, int len, int offset);
+typedef int (*Decode_Func)(const uint8_t *in, uint8_t *out);
+
+static uint8_t *src, *comp, *dec;
+static int frames, reps = 5;
+
+template<int BS> static int c_code(const uint8_t *in, uint8_t *out, int len, int offset)
+{
+  return bbp_code_offset((uint8_t*)in, out, BS, -1, len, offset);
+}
+
+static int c_decode(const uint8_t *in, uint8_t *out)
+{
+  return bbp_decode((uint8_t*)in, out);
+}
+
+template<int BS> static int cpp_code(const uint8_t *in, uint8_t *out, int len, int offset)
+{
+  return bbp::Frame<BS>::code(in, out, len, offset);
+}
+
+template<int BS> static int cpp_decode(const uint8_t *in, uint8_t *out)
+{
+  return bbp::Frame<BS>::decode(in, out);
+}
+
+template<int BS> static int fixed_code(const uint8_t *in, uint8_t *out, int, int)
+{
+  return bbp::Frame<BS, BBP_CPP_BENCH_OFFSET, FRAME_SIZE>::code(in, out);
+}
+
+template<int BS> static int fixed_decode(const uint8_t *in, uint8_t *out)
+{
+  return bbp::Frame<BS, BBP_CPP_BENCH_OFFSET, FRAME_SIZE>::decode(in, out);
+}
+
+static double now_ms(void)
+{
+  return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//codes and decodes all frames reps times, verifies with the other decoder, returns 0 on errors
+static int run(const char *name, int bs, int offset, Code_Func code, Decode_Func decode, Decode_Func verify)
+{
+  int r, f;
+  size_t size_c = 0;
+  size_t max_c = bbp_max_compressed_size(FRAME_SIZE);
+  double t, enc = 1e30, dec_t = 1e30;
+
+  for(r=0;r<reps;r++) {
+    size_c = 0;
+    t = now_ms();
+    for(f=0;f<frames;f++)
+      size_c += code(src+(size_t)f*FRAME_SIZE, comp+f*max_c, FRAME_SIZE, offset);
+    t = now_ms()-t;
+    enc = t < enc ? t : enc;
+
+    t = now_ms();
+    for(f=0;f<frames;f++)
+      decode(comp+f*max_c, dec+(size_t)f*FRAME_SIZE);
+    t = now_ms()-t;
+    dec_t = t < dec_t ? t : dec_t;
+  }
+
+  if (memcmp(dec, src, (size_t)frames*FRAME_SIZE)) {
+    fprintf(stderr, "ERROR: %s bs %d: round trip failed\n", name, bs);
+    return 0;
+  }
+  memset(dec, 0, (size_t)frames*FRAME_SIZE);
+  for(f=0;f<frames;f++)
+    verify(comp+f*max_c, dec+(size_t)f*FRAME_SIZE);
+  if (memcmp(dec, src, (size_t)frames*FRAME_SIZE)) {
+    fprintf(stderr, "ERROR: %s bs %d: frames don't decode with the other decoder\n", name, bs);
+    return 0;
+  }
+
+  printf("%-10s %5d %7.3f %10.1f %10.1f\n", name, bs, (double)frames*FRAME_SIZE/size_c,
+         (double)frames*FRAME_SIZE/1024/1024*1000/enc, (double)frames*FRAME_SIZE/1024/1024*1000/dec_t);
+  return 1;
+}
+
+template<int BS> static int run_bs(int offset)
+{
+  int ok = 1;
+
+  ok &= run("c", BS, offset, c_code<BS>, c_decode, cpp_decode<BS>);
+  ok &= run("c++", BS, offset, cpp_code<BS>, cpp_decode<BS>, c_decode);
+  if (offset == BBP_CPP_BENCH_OFFSET)
+    ok &= run("c++ fixed", BS, offset, fixed_code<BS>, fixed_decode<BS>, c_decode);
+
+  return ok;
+}
+
+static void help(void)
+{
+  printf("usage: bbp_cpp_bench [-n <reps>] <file> [<offset>]\n");
+  printf("codes the file in frames of %d bytes with the C coder and bbp::Frame (bbp.hpp), the variant with\n", FRAME_SIZE);
+  printf("offset and frame length as template parameters runs for the offset %d only\n", BBP_CPP_BENCH_OFFSET);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, ok = 1;
+  int offset = BBP_CPP_BENCH_OFFSET;
+  long len;
+  FILE *f;
+  void *buf;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n' :
+        reps = atoi(optarg);
+        if (reps < 1)
+          help();
+        break;
+      default :
+        help();
+    }
+  }
+  if (argc-optind < 1 || argc-optind > 2)
+    help();
+  if (argc-optind == 2)
+    offset = atoi(argv[optind+1]);
+  if (offset < BBP_ALIGNMENT)
+    help();
+
+  f = fopen(argv[optind], "r");
+  if (!f) {
+    fprintf(stderr, "ERROR: could not open %s\n", argv[optind]);
+    return EXIT_FAILURE;
+  }
+  fseek(f, 0, SEEK_END);
+  len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  frames = len/FRAME_SIZE;
+  if (!frames) {
+    fprintf(stderr, "ERROR: %s is smaller than one frame of %d bytes\n", argv[optind], FRAME_SIZE);
+    return EXIT_FAILURE;
+  }
+
+  if (posix_memalign(&buf, BBP_ALIGNMENT, (size_t)frames*FRAME_SIZE))
+    abort();
+  src = (uint8_t*)buf;
+  if (posix_memalign(&buf, BBP_ALIGNMENT, (size_t)frames*bbp_max_compressed_size(FRAME_SIZE)))
+    abort();
+  comp = (uint8_t*)buf;
+  if (posix_memalign(&buf, BBP_ALIGNMENT, (size_t)frames*FRAME_SIZE))
+    abort();
+  dec = (uint8_t*)buf;
+  if (fread(src, FRAME_SIZE, frames, f) != (size_t)frames)
+    abort();
+  fclose(f);
+
+  bbp_init();
+
+  printf("%d frames of %d bytes, offset %d, best of %d, MB/s\n", frames, FRAME_SIZE, offset, reps);
+  printf("%-10s %5s %7s %10s %10s\n", "coder", "bs", "ratio", "encode", "decode");
+  ok &= run_bs<8>(offset);
+  ok &= run_bs<16>(offset);
+  ok &= run_bs<64>(offset);
+  ok &= run_bs<512>(offset);
+
+  bbp_shutdown();
+  free(src);
+  free(comp);
+  free(dec);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
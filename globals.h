@@ -39,7 +39,10 @@
 #include "bbp.h"
 
 #define MAX_BLOCK_SIZE BBP_MAX_BLOCK_SIZE
+//inner chunk size of frames without HP_CHUNK and before bbp_init() calibrated it
 #define CHUNK_SIZE 8192
+#define MIN_INNER_CHUNK BBP_MIN_INNER_CHUNK
+#define MAX_INNER_CHUNK BBP_MAX_INNER_CHUNK
 
 #ifdef COMPILER_GCC
 #define CFINLINE inline
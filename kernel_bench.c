@@ -0,0 +1,485 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * drives the kernels of bitpacking.c and coding_helpers.c directly (this
+ * tool is built from the library sources) on a single L1 resident chunk and
+ * on buffers streamed from DRAM, for every block size and bit width
+ */
+
+#include "common.h"
+#include "bitpacking.h"
+#include "bitstream.h"
+#include "coding_helpers.h"
+#include "bench_util.h"
+
+#define KERNEL_DIFF   0 //_code_diff_offset_path
+#define KERNEL_WIDTH  1 //_code_max_chunk
+#define KERNEL_PACK   2 //push_block_chunk
+#define KERNEL_UNPACK 3 //pull_block
+#define KERNEL_UNDIFF 4 //_decode_inv_diff_path
+#define KERNEL_COUNT  5
+
+static const char *kernel_names[KERNEL_COUNT] = {"diff", "width", "pack", "unpack", "undiff"};
+
+#define GUARD 8192 //in front of buffers for the offset, and behind for block overrun
+
+typedef struct {
+  int kernels[KERNEL_COUNT];
+  Param_List bs, width;
+  int offset;
+  int unaligned; //force the unaligned diff and undiff kernels
+  int diff_path; //DIFF_PATH_* of diff and undiff for offset
+  size_t dram_size; //0 disables the dram runs
+  size_t volume; //bytes processed per measurement
+  int reps;
+  int format;
+  int perf; //wrap the timed loop with hardware counters
+  Perf_Counters counters;
+} Kernel_Config;
+
+typedef struct {
+  uint8_t *src; //kernel input (deltas for pack, pixels for diff)
+  uint8_t *dst; //packed blocks
+  uint8_t *sig; //signals
+  uint8_t *out; //unpacked deltas, reconstructed pixels
+  size_t size;
+  size_t alloc;
+  int bits[CHUNK_SIZE/4];
+} Buffers;
+
+typedef struct {
+  double ns_block;
+  double bytes_cycle;
+  double mbs;
+  double bytes; //processed per run, for the per byte perf figures
+  Perf_Values perf; //of the best run
+} Kernel_Result;
+
+/*
+ * the kernel actually used by the dispatch in bitpacking.c for a block size,
+ * keep in sync with push_block_chunk_dynamic() and pull_block()
+ */
+static const char *pack_path(int bs)
+{
+#if defined(BBP_USE_NEON)
+  if (bs >= 16) return "neon 16";
+#endif
+#if defined(BBP_USE_AVX2)
+  if (bs >= 32) return "avx2 32";
+#endif
+#if defined(BBP_USE_SSE)
+  if (bs >= 16) return "sse 16";
+#endif
+  if (bs >= 8) return "u64 8";
+  if (bs == 4) return "u32 4";
+  return "u8 1";
+}
+
+static const char *unpack_path(int bs)
+{
+#if defined(BBP_USE_SSE)
+  if (bs >= 16) return "sse 16";
+#endif
+  if (bs >= 8) return "u64 8";
+  if (bs >= 4) return "u32 4";
+  return "u8 1";
+}
+
+static const char *kernel_path(Kernel_Config *c, int kernel, int bs)
+{
+  switch (kernel) {
+    case KERNEL_DIFF :
+    case KERNEL_UNDIFF : return diff_offset_path_name(c->diff_path);
+    case KERNEL_PACK : return pack_path(bs);
+    case KERNEL_UNPACK : return unpack_path(bs);
+    default : return simd_string();
+  }
+}
+
+static void buffers_alloc(Buffers *b, size_t size)
+{
+  b->size = size;
+  b->alloc = size+2*GUARD;
+  b->src = bbp_alloc(b->alloc);
+  b->dst = bbp_alloc(b->alloc);
+  b->sig = bbp_alloc(b->alloc);
+  b->out = bbp_alloc(b->alloc);
+  assert(b->src && b->dst && b->sig && b->out);
+  b->src += GUARD;
+  b->dst += GUARD;
+  b->sig += GUARD;
+  b->out += GUARD;
+}
+
+static void buffers_free(Buffers *b)
+{
+  bbp_free(b->src-GUARD, b->alloc);
+  bbp_free(b->dst-GUARD, b->alloc);
+  bbp_free(b->sig-GUARD, b->alloc);
+  bbp_free(b->out-GUARD, b->alloc);
+}
+
+//deltas of exactly width bits per block
+static void fill_width(Buffers *b, int bs, int width, ranctx *rng)
+{
+  size_t i;
+  uint8_t mask = width ? (1 << width)-1 : 0;
+
+  for(i=0;i<b->size;i++)
+    b->src[i] = ranval(rng) & mask;
+  for(i=0;i<b->size;i+=bs)
+    b->src[i] = mask;
+  for(i=0;i<CHUNK_SIZE/bs;i++)
+    b->bits[i] = width;
+}
+
+static void fill_random(uint8_t *buf, size_t len, ranctx *rng)
+{
+  size_t i;
+
+  for(i=0;i<len;i++)
+    buf[i] = ranval(rng);
+}
+
+static void pack_chunk(Buffers *buf, size_t off, int bs)
+{
+  Block_Coder_Data b;
+
+  memset(&b, 0, sizeof(b));
+  b.block_size = bs;
+  b.block_buf = buf->dst+off;
+  b.signal_buf = buf->sig+off/4;
+  comp_coder_reset(&b);
+  memset(b.cur_block, 0, bs);
+  push_block_chunk(&b, buf->bits, buf->src+off, bs, CHUNK_SIZE);
+  if (b.cur_block_free_bits != 8)
+    next_block(&b, bs);
+}
+
+static void unpack_chunk(Buffers *buf, size_t off, int bs)
+{
+  Block_Coder_Data b;
+
+  memset(&b, 0, sizeof(b));
+  b.block_size = bs;
+  b.block_buf = buf->dst+off;
+  b.signal_buf = buf->sig+off/4;
+  b.data_buf = buf->out+off;
+  //the reset clears the first block of the output if the chunk holds one
+  b.len = CHUNK_SIZE;
+  comp_decoder_reset(&b);
+  pull_block_chunk(&b, buf->out+off, bs, CHUNK_SIZE);
+}
+
+static void run_chunk(Kernel_Config *c, Buffers *buf, int kernel, size_t off, int bs)
+{
+  switch (kernel) {
+    case KERNEL_DIFF :
+      _code_diff_offset_path(c->diff_path, buf->src+off, buf->out+off, c->offset, CHUNK_SIZE);
+      break;
+    case KERNEL_WIDTH :
+      _code_max_chunk(buf->src+off, buf->bits, bs, CHUNK_SIZE);
+      break;
+    case KERNEL_PACK :
+      pack_chunk(buf, off, bs);
+      break;
+    case KERNEL_UNPACK :
+      unpack_chunk(buf, off, bs);
+      break;
+    case KERNEL_UNDIFF :
+      _decode_inv_diff_path(c->diff_path, buf->out+off, buf->src+off, c->offset, CHUNK_SIZE);
+      break;
+  }
+}
+
+/*
+ * process c->volume bytes in CHUNK_SIZE calls, all on the first chunk (l1)
+ * or walking through the whole buffer (dram), best of c->reps
+ */
+static void measure(Kernel_Config *c, Buffers *buf, int kernel, int bs, int dram, Kernel_Result *res)
+{
+  int r;
+  size_t i, iters, chunks, off;
+  uint64_t cyc, best_cyc = 0;
+  double ms, best_ms = 0;
+  struct timespec start, stop;
+  Perf_Values perf;
+
+  iters = c->volume/CHUNK_SIZE;
+  chunks = dram ? buf->size/CHUNK_SIZE : 1;
+
+  //warmup
+  for(i=0;i<chunks;i++)
+    run_chunk(c, buf, kernel, i*CHUNK_SIZE, bs);
+
+  memset(&res->perf, 0, sizeof(Perf_Values));
+  for(r=0;r<c->reps;r++) {
+    off = 0;
+    memset(&perf, 0, sizeof(Perf_Values));
+    if (c->perf)
+      perf_start(&c->counters);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cyc = cycles();
+    for(i=0;i<iters;i++) {
+      run_chunk(c, buf, kernel, off, bs);
+      off += CHUNK_SIZE;
+      if (off >= chunks*CHUNK_SIZE)
+        off = 0;
+    }
+    cyc = cycles()-cyc;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    if (c->perf)
+      perf_stop(&c->counters, &perf);
+    ms = ms_delta(start, stop);
+    if (!r || ms < best_ms) {
+      best_ms = ms;
+      best_cyc = cyc;
+      res->perf = perf;
+    }
+  }
+
+  res->ns_block = best_ms*1000000/(iters*(CHUNK_SIZE/bs));
+  res->bytes_cycle = best_cyc ? (double)iters*CHUNK_SIZE/best_cyc : 0;
+  res->mbs = (double)iters*CHUNK_SIZE/1024/1024*1000/best_ms;
+  res->bytes = (double)iters*CHUNK_SIZE;
+}
+
+//unpack the first chunk after packing it and compare
+static void verify(Buffers *buf, int bs, int width)
+{
+  pack_chunk(buf, 0, bs);
+  unpack_chunk(buf, 0, bs);
+  if (memcmp(buf->src, buf->out, CHUNK_SIZE)) {
+    fprintf(stderr, "ERROR: pack/unpack mismatch for block size %d width %d\n", bs, width);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void print_header(Kernel_Config *c)
+{
+  switch (c->format) {
+    case FORMAT_CSV :
+      printf("kernel,path,bs,width,buffer,ns_block,bytes_cycle,mbs");
+      if (c->perf)
+        perf_print_csv_header("");
+      printf("\n");
+      break;
+    case FORMAT_JSON :
+      printf("{\"simd\": \"%s\", \"chunk\": %d, \"offset\": %d, \"volume\": %zu, \"reps\": %d, \"results\": [\n", simd_string(), CHUNK_SIZE, c->offset, c->volume, c->reps);
+      break;
+    default :
+      printf("simd: %s, best of %d runs over %zu bytes each, calls of %d bytes, bytes/cycle from the tsc\n", simd_string(), c->reps, c->volume, CHUNK_SIZE);
+      printf("%-7s %-9s %5s %5s %-5s %10s %11s %10s\n", "kernel", "path", "bs", "width", "buf", "ns/block", "bytes/cycle", "MB/s");
+  }
+}
+
+static void print_result(Kernel_Config *c, int *first, int kernel, int bs, int width, int dram, Kernel_Result *r)
+{
+  const char *buf = dram ? "dram" : "l1";
+
+  switch (c->format) {
+    case FORMAT_CSV :
+      printf("%s,%s,%d,%d,%s,%.3f,%.4f,%.1f", kernel_names[kernel], kernel_path(c, kernel, bs), bs, width, buf, r->ns_block, r->bytes_cycle, r->mbs);
+      if (c->perf)
+        perf_print_csv(&r->perf, r->bytes);
+      printf("\n");
+      break;
+    case FORMAT_JSON :
+      printf("%s  {\"kernel\": \"%s\", \"path\": \"%s\", \"bs\": %d, \"width\": %d, \"buffer\": \"%s\", \"ns_block\": %.3f, \"bytes_cycle\": %.4f, \"mbs\": %.1f",
+             *first ? "" : ",\n", kernel_names[kernel], kernel_path(c, kernel, bs), bs, width, buf, r->ns_block, r->bytes_cycle, r->mbs);
+      if (c->perf)
+        perf_print_json("perf", &r->perf, r->bytes);
+      printf("}");
+      break;
+    default :
+      if (width >= 0)
+        printf("%-7s %-9s %5d %5d %-5s %10.3f %11.3f %10.1f\n", kernel_names[kernel], kernel_path(c, kernel, bs), bs, width, buf, r->ns_block, r->bytes_cycle, r->mbs);
+      else
+        printf("%-7s %-9s %5d %5s %-5s %10.3f %11.3f %10.1f\n", kernel_names[kernel], kernel_path(c, kernel, bs), bs, "-", buf, r->ns_block, r->bytes_cycle, r->mbs);
+      if (c->perf)
+        perf_print_table("perf", &r->perf, r->bytes);
+  }
+  *first = 0;
+  fflush(stdout);
+}
+
+static void run_buffer(Kernel_Config *c, Buffers *buf, int dram, int *first)
+{
+  int k, i, j, bs, width;
+  Kernel_Result r;
+  ranctx rng;
+
+  raninit(&rng, 1);
+  c->diff_path = c->unaligned ? DIFF_PATH_UNALIGNED : diff_offset_path(c->offset, buf->src);
+
+  for(k=0;k<KERNEL_COUNT;k++) {
+    if (!c->kernels[k])
+      continue;
+    switch (k) {
+      case KERNEL_DIFF :
+      case KERNEL_UNDIFF :
+        //independent of block size and content, one call is the block
+        fill_random(buf->src-GUARD, buf->size+2*GUARD, &rng);
+        fill_random(buf->out-GUARD, buf->size+2*GUARD, &rng);
+        measure(c, buf, k, CHUNK_SIZE, dram, &r);
+        print_result(c, first, k, CHUNK_SIZE, -1, dram, &r);
+        break;
+      case KERNEL_WIDTH :
+        fill_random(buf->src, buf->size, &rng);
+        for(i=0;i<c->bs.count;i++) {
+          measure(c, buf, k, c->bs.val[i], dram, &r);
+          print_result(c, first, k, c->bs.val[i], -1, dram, &r);
+        }
+        break;
+      default :
+        for(i=0;i<c->bs.count;i++)
+          for(j=0;j<c->width.count;j++) {
+            bs = c->bs.val[i];
+            width = c->width.val[j];
+            fill_width(buf, bs, width, &rng);
+            if (!dram)
+              verify(buf, bs, width);
+            if (k == KERNEL_UNPACK) {
+              size_t off;
+              for(off=0;off<(dram ? buf->size : CHUNK_SIZE);off+=CHUNK_SIZE)
+                pack_chunk(buf, off, bs);
+            }
+            measure(c, buf, k, bs, dram, &r);
+            print_result(c, first, k, bs, width, dram, &r);
+          }
+    }
+  }
+}
+
+static void help(void)
+{
+  printf("usage: bbp_kernel_bench [options]\n");
+  printf("times the coding kernels per call of %d bytes on an l1 resident chunk and on a buffer streamed from dram\n", CHUNK_SIZE);
+  printf("  -k <list>   kernels: diff, width, pack, unpack, undiff (default all)\n");
+  printf("  -b <list>   block sizes (default 4,8,...,4096)\n");
+  printf("  -w <list>   bit widths for pack and unpack (default 0,1,...,8)\n");
+  printf("  -o <n>      offset for diff and undiff (default 854)\n");
+  printf("  -u          use the unaligned diff and undiff kernels for every offset\n");
+  printf("  -m <size>   dram buffer size, 0 disables the dram runs (default 64m)\n");
+  printf("  -v <size>   bytes processed per measurement (default 16m)\n");
+  printf("  -n <n>      repetitions, the best is reported (default 3)\n");
+  printf("  -f <fmt>    output format: table, csv or json (default table)\n");
+  printf("  -p          count cycles, instructions, cache and branch misses with perf_event_open\n");
+  exit(EXIT_FAILURE);
+}
+
+static void parse_kernels(Kernel_Config *c, const char *str)
+{
+  int k, found;
+  char *tok, *save, *list = strdup(str);
+
+  memset(c->kernels, 0, sizeof(c->kernels));
+  for(tok=strtok_r(list, ",", &save);tok;tok=strtok_r(NULL, ",", &save)) {
+    found = 0;
+    for(k=0;k<KERNEL_COUNT;k++)
+      if (!strcmp(tok, kernel_names[k]))
+        found = c->kernels[k] = 1;
+    if (!found)
+      help();
+  }
+  free(list);
+}
+
+int main(int argc, char *argv[])
+{
+  int opt, i, first = 1;
+  char *end;
+  Kernel_Config c;
+  Buffers *buf;
+
+  memset(&c, 0, sizeof(c));
+  parse_kernels(&c, "diff,width,pack,unpack,undiff");
+  parse_list(&c.bs, "4,8,16,32,64,128,256,512,1024,2048,4096");
+  parse_list(&c.width, "0,1,2,3,4,5,6,7,8");
+  c.offset = 854;
+  c.dram_size = 64*1024*1024;
+  c.volume = 16*1024*1024;
+  c.reps = 3;
+
+  while ((opt = getopt(argc, argv, "k:b:w:o:um:v:n:f:p")) != -1) {
+    switch (opt) {
+      case 'k' : parse_kernels(&c, optarg); break;
+      case 'b' : parse_list(&c.bs, optarg); break;
+      case 'w' : parse_list(&c.width, optarg); break;
+      case 'o' : c.offset = atoi(optarg); break;
+      case 'u' : c.unaligned = 1; break;
+      case 'm' : c.dram_size = parse_size(optarg, &end); break;
+      case 'v' : c.volume = parse_size(optarg, &end); break;
+      case 'n' : c.reps = atoi(optarg); break;
+      case 'p' : c.perf = 1; break;
+      case 'f' :
+        c.format = parse_format(optarg);
+        if (c.format < 0)
+          help();
+        break;
+      default : help();
+    }
+  }
+
+  if (optind != argc || c.reps < 1 || c.volume < CHUNK_SIZE || c.offset < 1 || c.offset > GUARD)
+    help();
+  for(i=0;i<c.bs.count;i++)
+    if (c.bs.val[i] < 4 || c.bs.val[i] > BBP_MAX_BLOCK_SIZE || c.bs.val[i] & (c.bs.val[i]-1))
+      help();
+  for(i=0;i<c.width.count;i++)
+    if (c.width.val[i] < 0 || c.width.val[i] > 8)
+      help();
+  c.dram_size = c.dram_size/CHUNK_SIZE*CHUNK_SIZE;
+
+  bbp_init();
+
+  buf = malloc(sizeof(Buffers));
+  assert(buf);
+
+  if (c.perf)
+    perf_open(&c.counters);
+
+  print_header(&c);
+
+  buffers_alloc(buf, CHUNK_SIZE);
+  run_buffer(&c, buf, 0, &first);
+  buffers_free(buf);
+
+  if (c.dram_size) {
+    buffers_alloc(buf, c.dram_size);
+    run_buffer(&c, buf, 1, &first);
+    buffers_free(buf);
+  }
+
+  if (c.format == FORMAT_JSON)
+    printf("\n]}\n");
+
+  if (c.perf)
+    perf_close(&c.counters);
+
+  free(buf);
+  bbp_shutdown();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,70 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_PROBES_H
+#define _BBP_PROBES_H
+
+/*
+ * USDT probes (provider "bbp") for bpftrace/perf/systemtap, built with
+ * BBP_USE_SDT if sys/sdt.h was found. A disabled probe is a single nop in
+ * the text plus a note section entry, the arguments are only materialized in
+ * registers or on the stack. Without BBP_USE_SDT all macros expand to nothing.
+ *
+ * probes and arguments:
+ *   code__start    (len, bs, bs_r, offset)
+ *   code__done     (len, len_c, bs, bs_r, offset)
+ *   decode__start  (len, len_c, bs, bs_r, offset)
+ *   decode__done   (len, len_c, bs, bs_r, offset)
+ *   stage__code__start   (stage, len, bs, offset)         stage 0: blocks, 1: signal
+ *   stage__code__done    (stage, len, len_c, bs, offset)
+ *   stage__decode__start (stage, len, bs, offset)
+ *   stage__decode__done  (stage, len, len_c, bs, offset)
+ *   raw__copy      (dir, raw_len, len, bs, offset)        dir 0: encode, 1: decode
+ *
+ * bs_r is -1 for frames without second stage. raw__copy fires for the
+ * uncompressed head/tail of a stage and for stages too small to code at all
+ * (raw_len == len).
+ */
+
+#define PROBE_STAGE_BLOCKS 0
+#define PROBE_STAGE_SIGNAL 1
+
+#define PROBE_DIR_ENCODE 0
+#define PROBE_DIR_DECODE 1
+
+#ifdef BBP_USE_SDT
+
+#include <sys/sdt.h>
+
+#define PROBE4(NAME, A, B, C, D) DTRACE_PROBE4(bbp, NAME, A, B, C, D)
+#define PROBE5(NAME, A, B, C, D, E) DTRACE_PROBE5(bbp, NAME, A, B, C, D, E)
+
+#else
+
+//arguments are still referenced so variables only used by probes don't warn
+#define PROBE4(NAME, A, B, C, D) do { (void)(A); (void)(B); (void)(C); (void)(D); } while (0)
+#define PROBE5(NAME, A, B, C, D, E) do { (void)(A); (void)(B); (void)(C); (void)(D); (void)(E); } while (0)
+
+#endif
+
+#endif
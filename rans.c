@@ -0,0 +1,233 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "rans.h"
+
+/*
+ * renormalization in 16 bit words: states stay in [RANS_L, RANS_L << 16) and
+ * below 2^31, so the encoder can divide by multiplying with a 32 bit
+ * reciprocal of the frequency (as in ryg_rans) and every symbol moves at
+ * most one word, so the decoder renormalizes with a single conditional read
+ * instead of a loop; the words are stored little endian like the states
+ */
+
+#define RANS_L (1u << 15)
+#define RANS_SCALE (1u << RANS_SCALE_BITS)
+#define RANS_MASK (RANS_SCALE-1)
+
+typedef struct {
+  uint32_t x_max; //state limit before the symbol has to renormalize
+  uint32_t rcp_freq; //fixed point reciprocal of freq
+  uint32_t bias;
+  uint16_t cmpl_freq; //RANS_SCALE-freq
+  uint16_t rcp_shift;
+} Rans_Enc_Symbol;
+
+//scale the counts to RANS_SCALE with every present symbol >= 1
+static void rans_normalize(uint32_t *count, int len, uint16_t *freq)
+{
+  int i, max = 0;
+  int sum = 0;
+
+  for(i=0;i<RANS_SYMBOLS;i++) {
+    freq[i] = (uint64_t)count[i]*RANS_SCALE/len;
+    if (count[i] && !freq[i])
+      freq[i] = 1;
+    sum += freq[i];
+    if (freq[i] > freq[max])
+      max = i;
+  }
+
+  //the most frequent symbol is at least RANS_SCALE/RANS_SYMBOLS, which absorbs the rounding
+  freq[max] += RANS_SCALE-sum;
+}
+
+static void rans_enc_symbol_init(Rans_Enc_Symbol *s, uint32_t start, uint32_t freq)
+{
+  int shift = 0;
+
+  s->x_max = ((RANS_L >> RANS_SCALE_BITS) << 16) * freq;
+  s->cmpl_freq = RANS_SCALE-freq;
+  if (freq < 2) {
+    //x/1 can't be done with a 32 bit reciprocal, x*(2^32-1) >> 32 = x-1 is corrected by the bias
+    s->rcp_freq = ~0u;
+    s->rcp_shift = 32;
+    s->bias = start+RANS_SCALE-1;
+  }
+  else {
+    while (freq > (1u << shift))
+      shift++;
+    s->rcp_freq = (uint32_t)(((1ull << (shift+31)) + freq-1) / freq);
+    s->rcp_shift = shift-1+32;
+    s->bias = start;
+  }
+}
+
+static inline void rans_put_u16(uint8_t *buf, uint32_t v)
+{
+  buf[0] = v;
+  buf[1] = v >> 8;
+}
+
+static inline uint32_t rans_get_u16(uint8_t *buf)
+{
+  return buf[0] | (buf[1] << 8);
+}
+
+static inline void rans_put_u32(uint8_t *buf, uint32_t v)
+{
+  buf[0] = v;
+  buf[1] = v >> 8;
+  buf[2] = v >> 16;
+  buf[3] = v >> 24;
+}
+
+static inline uint32_t rans_get_u32(uint8_t *buf)
+{
+  return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static inline uint32_t rans_enc_put(uint32_t x, uint8_t **ptr, Rans_Enc_Symbol *s)
+{
+  uint32_t q;
+
+  if (x >= s->x_max) {
+    *ptr -= 2;
+    rans_put_u16(*ptr, x);
+    x >>= 16;
+  }
+
+  q = (uint32_t)(((uint64_t)x * s->rcp_freq) >> s->rcp_shift);
+  return x + s->bias + q*s->cmpl_freq;
+}
+
+int rans_encode(uint8_t *in, int len, uint8_t *out, int out_max)
+{
+  int i, size;
+  uint32_t count[RANS_SYMBOLS];
+  uint16_t freq[RANS_SYMBOLS];
+  uint32_t start;
+  Rans_Enc_Symbol syms[RANS_SYMBOLS];
+  uint32_t x[RANS_WAYS];
+  int w;
+  uint8_t *end, *ptr, *min;
+
+  assert(len);
+
+  //the stream is built in words backwards from the (word aligned) end of out
+  out_max &= ~1;
+  if (out_max < RANS_HEADER_SIZE+4*RANS_WAYS+BBP_ALIGNMENT)
+    return -1;
+
+  memset(count, 0, sizeof(count));
+  for(i=0;i<len;i++) {
+    assert(in[i] < RANS_SYMBOLS);
+    count[in[i]]++;
+  }
+  rans_normalize(count, len, freq);
+
+  start = 0;
+  for(i=0;i<RANS_SYMBOLS;i++) {
+    rans_enc_symbol_init(&syms[i], start, freq[i]);
+    start += freq[i];
+    out[2*i] = freq[i] & 0xFF;
+    out[2*i+1] = freq[i] >> 8;
+  }
+  memset(out+2*RANS_SYMBOLS, 0, RANS_HEADER_SIZE-2*RANS_SYMBOLS);
+
+  for(i=0;i<RANS_WAYS;i++)
+    x[i] = RANS_L;
+
+  end = out+out_max;
+  ptr = end;
+  //room for the words of one group of symbols and the flushed states
+  min = out+RANS_HEADER_SIZE+4*RANS_WAYS+2*RANS_WAYS;
+
+  //the decoder runs forward, so the symbols are coded in reverse, the tail first
+  for(i=len-1;i>=(len & ~(RANS_WAYS-1));i--)
+    x[i & (RANS_WAYS-1)] = rans_enc_put(x[i & (RANS_WAYS-1)], &ptr, &syms[in[i]]);
+
+  //the constant inner loops are unrolled, so the states stay in registers
+  for(i=(len & ~(RANS_WAYS-1))-RANS_WAYS;i>=0;i-=RANS_WAYS) {
+    if (ptr < min)
+      return -1;
+    for(w=RANS_WAYS-1;w>=0;w--)
+      x[w] = rans_enc_put(x[w], &ptr, &syms[in[i+w]]);
+  }
+
+  size = end-ptr;
+  memmove(out+RANS_HEADER_SIZE+4*RANS_WAYS, ptr, size);
+  for(w=0;w<RANS_WAYS;w++)
+    rans_put_u32(out+RANS_HEADER_SIZE+4*w, x[w]);
+
+  size += RANS_HEADER_SIZE+4*RANS_WAYS;
+  if (RU_N(size, BBP_ALIGNMENT) > out_max)
+    return -1;
+  memset(out+size, 0, RU_N(size, BBP_ALIGNMENT)-size);
+
+  return RU_N(size, BBP_ALIGNMENT);
+}
+
+static inline uint32_t rans_dec_get(uint32_t x, uint8_t **ptr, uint8_t *sym, uint8_t *slot, uint16_t *freq, uint16_t *cum)
+{
+  uint8_t s = slot[x & RANS_MASK];
+
+  *sym = s;
+  x = freq[s]*(x >> RANS_SCALE_BITS) + (x & RANS_MASK) - cum[s];
+  if (x < RANS_L) {
+    x = (x << 16) | rans_get_u16(*ptr);
+    *ptr += 2;
+  }
+
+  return x;
+}
+
+void rans_decode(uint8_t *in, uint8_t *out, int len)
+{
+  int i, w;
+  uint16_t freq[RANS_SYMBOLS], cum[RANS_SYMBOLS];
+  uint8_t slot[RANS_SCALE];
+  uint32_t x[RANS_WAYS];
+  uint32_t start = 0;
+  uint8_t *ptr;
+
+  for(i=0;i<RANS_SYMBOLS;i++) {
+    freq[i] = in[2*i] | (in[2*i+1] << 8);
+    cum[i] = start;
+    memset(slot+start, i, freq[i]);
+    start += freq[i];
+  }
+  assert(start == RANS_SCALE);
+
+  for(w=0;w<RANS_WAYS;w++)
+    x[w] = rans_get_u32(in+RANS_HEADER_SIZE+4*w);
+  ptr = in+RANS_HEADER_SIZE+4*RANS_WAYS;
+
+  //RANS_WAYS independent states per iteration, only the word reads are ordered
+  for(i=0;i<len-(RANS_WAYS-1);i+=RANS_WAYS)
+    for(w=0;w<RANS_WAYS;w++)
+      x[w] = rans_dec_get(x[w], &ptr, out+i+w, slot, freq, cum);
+
+  for(w=0;i<len;i++,w++)
+    x[w] = rans_dec_get(x[w], &ptr, out+i, slot, freq, cum);
+}
@@ -0,0 +1,49 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_RANS_H
+#define _BBP_RANS_H
+
+#include "common.h"
+
+/*
+ * order 0 rANS for the signal (block bit widths 0..8), with a static model
+ * per frame and RANS_WAYS interleaved states sharing one stream, so the
+ * decoder has RANS_WAYS independent dependency chains.
+ *
+ * layout: uint16_t freq[RANS_SYMBOLS] (little endian), padding to
+ * RANS_HEADER_SIZE, RANS_WAYS 32 bit states, stream of 16 bit words, zero padding to
+ * BBP_ALIGNMENT
+ */
+
+#define RANS_SYMBOLS     9
+#define RANS_WAYS        8
+#define RANS_SCALE_BITS  12
+#define RANS_HEADER_SIZE 20
+
+//codes len symbols from in to out, returns the size (a multiple of BBP_ALIGNMENT) or -1 if it would exceed out_max
+int rans_encode(uint8_t *in, int len, uint8_t *out, int out_max);
+//decodes len symbols from in to out
+void rans_decode(uint8_t *in, uint8_t *out, int len);
+
+#endif
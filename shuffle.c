@@ -0,0 +1,394 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "shuffle.h"
+
+#ifdef BBP_USE_SSE
+#include <tmmintrin.h>
+#endif
+
+/*
+ * the kernels take groups of row elements, which are step[p] bytes apart
+ * in plane p, with cont the xor continues from the element in front of in
+ * (out). Elements start to count, also the complete fallback.
+ */
+static inline void shuffle_scalar(uint8_t *in, uint8_t **planes, const int *step, int row, int start, int count, const int elem_size, int xor, int cont)
+{
+  int i, p;
+  int g = start/row, j = start%row;
+  
+  for(i=start;i<count;i++) {
+    for(p=0;p<elem_size;p++)
+      planes[p][g*step[p]+j] = in[i*elem_size+p] ^ (xor && (i || cont) ? in[(i-1)*elem_size+p] : 0);
+    if (++j == row) {
+      j = 0;
+      g++;
+    }
+  }
+}
+
+static inline void unshuffle_scalar(uint8_t **planes, const int *step, int row, uint8_t *out, int start, int count, const int elem_size, int xor, int cont)
+{
+  int i, p;
+  int g = start/row, j = start%row;
+  
+  for(i=start;i<count;i++) {
+    for(p=0;p<elem_size;p++)
+      out[i*elem_size+p] = planes[p][g*step[p]+j] ^ (xor && (i || cont) ? out[(i-1)*elem_size+p] : 0);
+    if (++j == row) {
+      j = 0;
+      g++;
+    }
+  }
+}
+
+#ifdef BBP_USE_SSE
+
+#define LOAD(P) _mm_loadu_si128((__m128i*)(P))
+#define STORE(P, V) _mm_storeu_si128((__m128i*)(P), V)
+
+//xor of each element of v with the previous one, prev holds the elements before v
+static inline __m128i xor_prev(__m128i v, __m128i prev, const int elem_size)
+{
+  //the shifts take immediates only
+  switch (elem_size) {
+    case 2 : return _mm_xor_si128(v, _mm_alignr_epi8(v, prev, 14));
+    case 4 : return _mm_xor_si128(v, _mm_alignr_epi8(v, prev, 12));
+    default : return _mm_xor_si128(v, _mm_alignr_epi8(v, prev, 8));
+  }
+}
+
+//16 elements per iteration, which must not cross a group, returns the number of shuffled elements
+static inline int shuffle_sse(uint8_t *in, uint8_t **planes, const int *step, int row, int count, const int elem_size, int xor, int cont)
+{
+  int i, j, k;
+  uint8_t *dst[8];
+  __m128i v[8], prev = cont ? LOAD(in-16) : _mm_setzero_si128(), cur;
+  __m128i t[8], u[8];
+  const __m128i mask2 = _mm_setr_epi8(0,2,4,6,8,10,12,14, 1,3,5,7,9,11,13,15);
+  const __m128i mask4 = _mm_setr_epi8(0,4,8,12, 1,5,9,13, 2,6,10,14, 3,7,11,15);
+  const __m128i mask8 = _mm_setr_epi8(0,8, 1,9, 2,10, 3,11, 4,12, 5,13, 6,14, 7,15);
+  
+  for(k=0;k<elem_size;k++)
+    dst[k] = planes[k];
+  
+  for(i=0,j=0;i+16<=count;i+=16) {
+    for(k=0;k<elem_size;k++) {
+      cur = LOAD(in+i*elem_size+16*k);
+      v[k] = xor ? xor_prev(cur, prev, elem_size) : cur;
+      prev = cur;
+    }
+    
+    switch (elem_size) {
+      case 2 :
+        //plane 0 in the low, plane 1 in the high half
+        t[0] = _mm_shuffle_epi8(v[0], mask2);
+        t[1] = _mm_shuffle_epi8(v[1], mask2);
+        STORE(dst[0]+j, _mm_unpacklo_epi64(t[0], t[1]));
+        STORE(dst[1]+j, _mm_unpackhi_epi64(t[0], t[1]));
+        break;
+      case 4 :
+        //a dword per plane, then a 4x4 dword transpose
+        for(k=0;k<4;k++)
+          t[k] = _mm_shuffle_epi8(v[k], mask4);
+        u[0] = _mm_unpacklo_epi32(t[0], t[1]);
+        u[1] = _mm_unpackhi_epi32(t[0], t[1]);
+        u[2] = _mm_unpacklo_epi32(t[2], t[3]);
+        u[3] = _mm_unpackhi_epi32(t[2], t[3]);
+        STORE(dst[0]+j, _mm_unpacklo_epi64(u[0], u[2]));
+        STORE(dst[1]+j, _mm_unpackhi_epi64(u[0], u[2]));
+        STORE(dst[2]+j, _mm_unpacklo_epi64(u[1], u[3]));
+        STORE(dst[3]+j, _mm_unpackhi_epi64(u[1], u[3]));
+        break;
+      case 8 :
+        //a word per plane, then a 8x8 word transpose
+        for(k=0;k<8;k++)
+          v[k] = _mm_shuffle_epi8(v[k], mask8);
+        for(k=0;k<8;k+=2) {
+          t[k] = _mm_unpacklo_epi16(v[k], v[k+1]);
+          t[k+1] = _mm_unpackhi_epi16(v[k], v[k+1]);
+        }
+        for(k=0;k<8;k+=4) {
+          u[k] = _mm_unpacklo_epi32(t[k], t[k+2]);
+          u[k+1] = _mm_unpackhi_epi32(t[k], t[k+2]);
+          u[k+2] = _mm_unpacklo_epi32(t[k+1], t[k+3]);
+          u[k+3] = _mm_unpackhi_epi32(t[k+1], t[k+3]);
+        }
+        for(k=0;k<4;k++) {
+          STORE(dst[2*k]+j, _mm_unpacklo_epi64(u[k], u[k+4]));
+          STORE(dst[2*k+1]+j, _mm_unpackhi_epi64(u[k], u[k+4]));
+        }
+        break;
+      default :
+        abort();
+    }
+    
+    j += 16;
+    if (j == row) {
+      j = 0;
+      for(k=0;k<elem_size;k++)
+        dst[k] += step[k];
+    }
+  }
+  
+  return i;
+}
+
+//prefix xor over the elements of v, carry holds the last element before v in all lanes
+static inline __m128i xor_prefix(__m128i v, __m128i *carry, const int elem_size)
+{
+  switch (elem_size) {
+    case 2 :
+      v = _mm_xor_si128(v, _mm_slli_si128(v, 2));
+      v = _mm_xor_si128(v, _mm_slli_si128(v, 4));
+      v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+      v = _mm_xor_si128(v, *carry);
+      *carry = _mm_shufflehi_epi16(v, 0xFF);
+      *carry = _mm_unpackhi_epi64(*carry, *carry);
+      break;
+    case 4 :
+      v = _mm_xor_si128(v, _mm_slli_si128(v, 4));
+      v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+      v = _mm_xor_si128(v, *carry);
+      *carry = _mm_shuffle_epi32(v, 0xFF);
+      break;
+    default :
+      v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+      v = _mm_xor_si128(v, *carry);
+      *carry = _mm_unpackhi_epi64(v, v);
+  }
+  
+  return v;
+}
+
+//the element in front of out in all lanes, the carry of xor_prefix()
+static inline __m128i load_carry(uint8_t *out, const int elem_size)
+{
+  int64_t e = 0;
+  
+  memcpy(&e, out-elem_size, elem_size);
+  switch (elem_size) {
+    case 2 : return _mm_set1_epi16((int16_t)e);
+    case 4 : return _mm_set1_epi32((int32_t)e);
+    default : return _mm_set1_epi64x(e);
+  }
+}
+
+static inline int unshuffle_sse(uint8_t **planes, const int *step, int row, uint8_t *out, int count, const int elem_size, int xor, int cont)
+{
+  int i, j, k;
+  uint8_t *src[8];
+  __m128i p[8], o[8], t[8], u[8];
+  __m128i carry = cont ? load_carry(out, elem_size) : _mm_setzero_si128();
+  
+  for(k=0;k<elem_size;k++)
+    src[k] = planes[k];
+  
+  for(i=0,j=0;i+16<=count;i+=16) {
+    for(k=0;k<elem_size;k++)
+      p[k] = LOAD(src[k]+j);
+    j += 16;
+    if (j == row) {
+      j = 0;
+      for(k=0;k<elem_size;k++)
+        src[k] += step[k];
+    }
+    
+    //interleaving the planes is the inverse transpose
+    switch (elem_size) {
+      case 2 :
+        o[0] = _mm_unpacklo_epi8(p[0], p[1]);
+        o[1] = _mm_unpackhi_epi8(p[0], p[1]);
+        break;
+      case 4 :
+        t[0] = _mm_unpacklo_epi8(p[0], p[1]);
+        t[1] = _mm_unpackhi_epi8(p[0], p[1]);
+        t[2] = _mm_unpacklo_epi8(p[2], p[3]);
+        t[3] = _mm_unpackhi_epi8(p[2], p[3]);
+        o[0] = _mm_unpacklo_epi16(t[0], t[2]);
+        o[1] = _mm_unpackhi_epi16(t[0], t[2]);
+        o[2] = _mm_unpacklo_epi16(t[1], t[3]);
+        o[3] = _mm_unpackhi_epi16(t[1], t[3]);
+        break;
+      case 8 :
+        for(k=0;k<8;k+=2) {
+          t[k] = _mm_unpacklo_epi8(p[k], p[k+1]);
+          t[k+1] = _mm_unpackhi_epi8(p[k], p[k+1]);
+        }
+        //bytes 0-3 of elements 0-3, 4-7, 8-11, 12-15 in u[0-3], bytes 4-7 in u[4-7]
+        for(k=0;k<8;k+=4) {
+          u[k] = _mm_unpacklo_epi16(t[k], t[k+2]);
+          u[k+1] = _mm_unpackhi_epi16(t[k], t[k+2]);
+          u[k+2] = _mm_unpacklo_epi16(t[k+1], t[k+3]);
+          u[k+3] = _mm_unpackhi_epi16(t[k+1], t[k+3]);
+        }
+        for(k=0;k<4;k++) {
+          o[2*k] = _mm_unpacklo_epi32(u[k], u[k+4]);
+          o[2*k+1] = _mm_unpackhi_epi32(u[k], u[k+4]);
+        }
+        break;
+      default :
+        abort();
+    }
+    
+    for(k=0;k<elem_size;k++)
+      STORE(out+i*elem_size+16*k, xor ? xor_prefix(o[k], &carry, elem_size) : o[k]);
+  }
+  
+  return i;
+}
+
+#endif
+
+//groups of row elements, byte p to planes[p]
+static void shuffle_groups(uint8_t *in, uint8_t **planes, const int *step, int row, int count, int elem_size, int xor, int cont)
+{
+  int done = 0;
+  
+#ifdef BBP_USE_SSE
+  switch (elem_size) {
+    case 2 : done = shuffle_sse(in, planes, step, row, count, 2, xor, cont); break;
+    case 4 : done = shuffle_sse(in, planes, step, row, count, 4, xor, cont); break;
+    case 8 : done = shuffle_sse(in, planes, step, row, count, 8, xor, cont); break;
+  }
+#endif
+  
+  switch (elem_size) {
+    case 2 : shuffle_scalar(in, planes, step, row, done, count, 2, xor, cont); break;
+    case 4 : shuffle_scalar(in, planes, step, row, done, count, 4, xor, cont); break;
+    case 8 : shuffle_scalar(in, planes, step, row, done, count, 8, xor, cont); break;
+    default : abort();
+  }
+}
+
+static void unshuffle_groups(uint8_t **planes, const int *step, int row, uint8_t *out, int count, int elem_size, int xor, int cont)
+{
+  int done = 0;
+  
+#ifdef BBP_USE_SSE
+  switch (elem_size) {
+    case 2 : done = unshuffle_sse(planes, step, row, out, count, 2, xor, cont); break;
+    case 4 : done = unshuffle_sse(planes, step, row, out, count, 4, xor, cont); break;
+    case 8 : done = unshuffle_sse(planes, step, row, out, count, 8, xor, cont); break;
+  }
+#endif
+  
+  switch (elem_size) {
+    case 2 : unshuffle_scalar(planes, step, row, out, done, count, 2, xor, cont); break;
+    case 4 : unshuffle_scalar(planes, step, row, out, done, count, 4, xor, cont); break;
+    case 8 : unshuffle_scalar(planes, step, row, out, done, count, 8, xor, cont); break;
+    default : abort();
+  }
+}
+
+int typed_row_size(Typed_Rows *t)
+{
+  return (t->elem_size-__builtin_popcount(t->stored))*t->row;
+}
+
+//the planes of the groups from element first, rows at the rows of the group, n elements per group
+static inline void group_planes(Typed_Rows *t, uint8_t *rows, int first, int n, uint8_t **planes, int *step)
+{
+  int p, coded = 0, stored = 0;
+  
+  for(p=0;p<t->elem_size;p++)
+    if (t->stored & (1 << p)) {
+      planes[p] = t->planes+(stored++)*t->count+first;
+      step[p] = t->row;
+    }
+    else {
+      planes[p] = rows+(coded++)*n;
+      step[p] = typed_row_size(t);
+    }
+}
+
+void shuffle_planes(uint8_t *in, Typed_Rows *t, uint8_t *whole, int stride, int first, int count)
+{
+  int p;
+  uint8_t *planes[8];
+  int step[8];
+  
+  for(p=0;p<t->elem_size;p++) {
+    planes[p] = whole+p*stride+first;
+    step[p] = 0;
+  }
+  shuffle_groups(in+first*t->elem_size, planes, step, count, count, t->elem_size, t->xor, first > 0);
+}
+
+void planes_to_rows(uint8_t *whole, int stride, uint8_t *rows, Typed_Rows *t)
+{
+  int i, n, p, k;
+  int coded = typed_row_size(t)/t->row;
+  
+  for(i=0;i<t->count;i+=t->row) {
+    n = t->count-i < t->row ? t->count-i : t->row;
+    for(p=0,k=0;p<t->elem_size;p++)
+      if (!(t->stored & (1 << p)))
+        memcpy(rows+i*coded+(k++)*n, whole+p*stride+i, n);
+  }
+  for(p=0,k=0;p<t->elem_size;p++)
+    if (t->stored & (1 << p))
+      memcpy(t->planes+(k++)*t->count, whole+p*stride, t->count);
+}
+
+/*
+ * the full groups in one pass if no vector of 16 elements crosses a group,
+ * else a group per pass, then the last (partial) group
+ */
+#define TYPED_RUN(T, FULL) ((T)->row % 16 ? (T)->row : (FULL))
+
+void shuffle_rows(uint8_t *in, uint8_t *rows, Typed_Rows *t)
+{
+  int i, n;
+  int full = t->count/t->row*t->row;
+  int run = TYPED_RUN(t, full);
+  uint8_t *planes[8];
+  int step[8];
+  
+  for(i=0;i<full;i+=run) {
+    group_planes(t, rows+i/t->row*typed_row_size(t), i, t->row, planes, step);
+    shuffle_groups(in+i*t->elem_size, planes, step, t->row, run, t->elem_size, t->xor, i > 0);
+  }
+  if ((n = t->count-full)) {
+    group_planes(t, rows+full/t->row*typed_row_size(t), full, n, planes, step);
+    shuffle_groups(in+full*t->elem_size, planes, step, n, n, t->elem_size, t->xor, full > 0);
+  }
+}
+
+void unshuffle_rows(uint8_t *rows, uint8_t *out, int first, int count, Typed_Rows *t)
+{
+  int i, n;
+  int full = count/t->row*t->row;
+  int run = TYPED_RUN(t, full);
+  uint8_t *planes[8];
+  int step[8];
+  
+  for(i=0;i<full;i+=run) {
+    group_planes(t, rows+i/t->row*typed_row_size(t), first+i, t->row, planes, step);
+    unshuffle_groups(planes, step, t->row, out+(first+i)*t->elem_size, run, t->elem_size, t->xor, first+i > 0);
+  }
+  if ((n = count-full)) {
+    group_planes(t, rows+full/t->row*typed_row_size(t), first+full, n, planes, step);
+    unshuffle_groups(planes, step, n, out+(first+full)*t->elem_size, n, t->elem_size, t->xor, first+full > 0);
+  }
+}
@@ -0,0 +1,56 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_SHUFFLE_H
+#define _BBP_SHUFFLE_H
+
+#include "common.h"
+
+/*
+ * byte planes for typed frames: each group of row elements becomes a row of
+ * row bytes per plane, byte p of element i of the group at i of row p, the
+ * last (partial) group rows of the remaining elements. With an offset of a
+ * group every plane byte is predicted by the same byte of the element one
+ * row earlier, so all planes are coded in one frame. Planes with a bit in
+ * stored (noise, like the low mantissa bytes of floats) skip the rows and go
+ * whole to planes instead, count bytes each, so they cost a copy and not a
+ * pack. With xor every element is first xored with the previous one
+ * (bytewise the same as on the whole element), so the sign, exponent and
+ * high mantissa bits of slowly changing floats turn into zero planes.
+ * Both directions are one pass, the inverse xor is done on the elements
+ * while they are still in registers. unshuffle_rows() starts at a group
+ * boundary, so the decoder can write the groups of each chunk to the output
+ * as soon as they are complete.
+ */
+
+//bytes of the coded rows of a group
+int typed_row_size(Typed_Rows *t);
+void shuffle_rows(uint8_t *in, uint8_t *rows, Typed_Rows *t);
+//elements first to first+count as whole planes to whole, stride bytes apart, first is 0 or at least 16
+void shuffle_planes(uint8_t *in, Typed_Rows *t, uint8_t *whole, int stride, int first, int count);
+//the same as shuffle_rows() from all planes of shuffle_planes() at whole
+void planes_to_rows(uint8_t *whole, int stride, uint8_t *rows, Typed_Rows *t);
+//elements first to first+count from their rows at rows, first is a multiple of row
+void unshuffle_rows(uint8_t *rows, uint8_t *out, int first, int count, Typed_Rows *t);
+
+#endif
@@ -0,0 +1,135 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "common.h"
+#include "stats.h"
+
+#include <time.h>
+
+#ifdef CALC_STATS
+
+//all counters of Bbp_Stats are uint64_t and come before ticks_per_second
+#define STATS_COUNTERS (offsetof(Bbp_Stats, ticks_per_second)/sizeof(uint64_t))
+
+static Bbp_Stats stats_global;
+
+//reference points to derive ticks_per_second
+static uint64_t ticks_start;
+static struct timespec time_start;
+
+uint64_t stats_ticks_ns(void)
+{
+  struct timespec t;
+  
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1000000000ull + t.tv_nsec;
+}
+
+/*
+ * widths are 0..8, so all 9 counters fit into a uint64_t with 7 bits each,
+ * counting is then a shift and an add without any memory dependency
+ */
+#define HIST_PACKED_MAX 127
+
+void stats_hist(uint64_t *hist, uint8_t *signal, int len)
+{
+  int i, n, end;
+  uint64_t acc0, acc1;
+  
+  for(i=0;i<len;) {
+    acc0 = 0;
+    acc1 = 0;
+    end = len-i > 2*HIST_PACKED_MAX ? i+2*HIST_PACKED_MAX : len;
+    for(;i<end-1;i+=2) {
+      acc0 += 1ull << (7*signal[i]);
+      acc1 += 1ull << (7*signal[i+1]);
+    }
+    if (i < end)
+      acc0 += 1ull << (7*signal[i++]);
+    
+    for(n=0;n<9;n++)
+      hist[n] += ((acc0 >> (7*n)) & HIST_PACKED_MAX) + ((acc1 >> (7*n)) & HIST_PACKED_MAX);
+  }
+}
+
+void stats_merge(Bbp_Stats *frame)
+{
+  int i;
+  uint64_t *src = (uint64_t*)frame;
+  uint64_t *dst = (uint64_t*)&stats_global;
+
+  for(i=0;i<STATS_COUNTERS;i++)
+    if (src[i])
+      __atomic_fetch_add(&dst[i], src[i], __ATOMIC_RELAXED);
+}
+
+int bbp_stats_get(Bbp_Stats *stats)
+{
+  int i;
+  uint64_t *src = (uint64_t*)&stats_global;
+  uint64_t *dst = (uint64_t*)stats;
+  uint64_t ticks;
+  struct timespec now;
+  double s;
+
+  for(i=0;i<STATS_COUNTERS;i++)
+    dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+
+  ticks = STATS_TICKS();
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  s = (now.tv_sec - time_start.tv_sec) + (now.tv_nsec - time_start.tv_nsec) / 1000000000.0;
+  if (s > 0)
+    stats->ticks_per_second = (ticks-ticks_start)/s;
+  else
+    stats->ticks_per_second = 0;
+
+  return 1;
+}
+
+void bbp_stats_reset(void)
+{
+  int i;
+  uint64_t *dst = (uint64_t*)&stats_global;
+
+  for(i=0;i<STATS_COUNTERS;i++)
+    __atomic_store_n(&dst[i], 0, __ATOMIC_RELAXED);
+
+  if (!ticks_start) {
+    ticks_start = STATS_TICKS();
+    clock_gettime(CLOCK_MONOTONIC, &time_start);
+  }
+}
+
+#else
+
+int bbp_stats_get(Bbp_Stats *stats)
+{
+  memset(stats, 0, sizeof(Bbp_Stats));
+  return 0;
+}
+
+void bbp_stats_reset(void)
+{
+}
+
+#endif
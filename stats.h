@@ -0,0 +1,65 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_STATS_H
+#define _BBP_STATS_H
+
+/*
+ * Stage timing for CALC_STATS builds. The coders account into the Bbp_Stats
+ * of their Block_Coder_Data (on the stack of bbp_code_offset()/bbp_decode()),
+ * which are merged into the global stats once per frame, so the per chunk
+ * overhead is two tick reads per stage and no shared cache lines. Bit width
+ * histograms are built once per frame from the signal.
+ * Without CALC_STATS all macros expand to nothing.
+ */
+
+#ifdef CALC_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STATS_TICKS() __builtin_ia32_rdtsc()
+#else
+#define STATS_TICKS() stats_ticks_ns()
+#endif
+
+#define STATS_START(T) uint64_t T = STATS_TICKS();
+//restart T without accounting, after time spent in a function with its own laps
+#define STATS_RESTART(T) (T) = STATS_TICKS();
+//add the ticks since T to FIELD of stats S and restart T
+#define STATS_LAP(S, T, FIELD) { uint64_t _now = STATS_TICKS(); (S)->FIELD += _now-(T); (T) = _now; }
+#define STATS_ADD(S, FIELD, V) (S)->FIELD += (V);
+
+uint64_t stats_ticks_ns(void);
+//add the bit widths stored in signal to hist
+void stats_hist(uint64_t *hist, uint8_t *signal, int len);
+void stats_merge(Bbp_Stats *frame);
+
+#else
+
+#define STATS_START(T)
+#define STATS_RESTART(T)
+#define STATS_LAP(S, T, FIELD)
+#define STATS_ADD(S, FIELD, V)
+
+#endif
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+#define load_acquire(P) __atomic_load_n((P), __ATOMIC_ACQUIRE)
+#define store_release(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+
+int uring_init(Uring *u, unsigned entries)
+{
+  struct io_uring_params p;
+
+  memset(u, 0, sizeof(Uring));
+  memset(&p, 0, sizeof(p));
+
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0)
+    return -errno;
+
+  u->sq_map_len = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+  u->cq_map_len = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+  u->sqes_len = p.sq_entries*sizeof(struct io_uring_sqe);
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_map_len > u->sq_map_len)
+      u->sq_map_len = u->cq_map_len;
+    u->cq_map_len = u->sq_map_len;
+  }
+
+  u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_map == MAP_FAILED)
+    goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    u->cq_map = u->sq_map;
+  else {
+    u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_map == MAP_FAILED)
+      goto fail;
+  }
+
+  u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+    goto fail;
+
+  u->sq_head = (unsigned*)((uint8_t*)u->sq_map + p.sq_off.head);
+  u->sq_tail = (unsigned*)((uint8_t*)u->sq_map + p.sq_off.tail);
+  u->sq_mask = (unsigned*)((uint8_t*)u->sq_map + p.sq_off.ring_mask);
+  u->sq_array = (unsigned*)((uint8_t*)u->sq_map + p.sq_off.array);
+  u->cq_head = (unsigned*)((uint8_t*)u->cq_map + p.cq_off.head);
+  u->cq_tail = (unsigned*)((uint8_t*)u->cq_map + p.cq_off.tail);
+  u->cq_mask = (unsigned*)((uint8_t*)u->cq_map + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe*)((uint8_t*)u->cq_map + p.cq_off.cqes);
+
+  return 0;
+
+fail:
+  close(u->fd);
+  return -ENOMEM;
+}
+
+void uring_exit(Uring *u)
+{
+  munmap(u->sqes, u->sqes_len);
+  if (u->cq_map != u->sq_map)
+    munmap(u->cq_map, u->cq_map_len);
+  munmap(u->sq_map, u->sq_map_len);
+  close(u->fd);
+}
+
+int uring_register_buffers(Uring *u, struct iovec *iov, unsigned count)
+{
+  if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, count))
+    return -errno;
+  return 0;
+}
+
+static void prep_rw(Uring *u, int op, int fd, void *buf, unsigned len, uint64_t pos, int buf_idx, uint64_t user_data)
+{
+  unsigned tail = *u->sq_tail;
+  unsigned idx = tail & *u->sq_mask;
+  struct io_uring_sqe *sqe = &u->sqes[idx];
+
+  //we never queue more than the ring size (callers limit in-flight buffers)
+  assert(tail - load_acquire(u->sq_head) <= *u->sq_mask);
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = pos;
+  sqe->buf_index = buf_idx;
+  sqe->user_data = user_data;
+
+  u->sq_array[idx] = idx;
+  store_release(u->sq_tail, tail+1);
+  u->pending++;
+}
+
+void uring_prep_read_fixed(Uring *u, int fd, void *buf, unsigned len, uint64_t pos, int buf_idx, uint64_t user_data)
+{
+  prep_rw(u, IORING_OP_READ_FIXED, fd, buf, len, pos, buf_idx, user_data);
+}
+
+void uring_prep_write_fixed(Uring *u, int fd, void *buf, unsigned len, uint64_t pos, int buf_idx, uint64_t user_data)
+{
+  prep_rw(u, IORING_OP_WRITE_FIXED, fd, buf, len, pos, buf_idx, user_data);
+}
+
+static int enter(Uring *u, unsigned wait_nr)
+{
+  int ret;
+
+  do
+    ret = syscall(__NR_io_uring_enter, u->fd, u->pending, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+  while (ret < 0 && errno == EINTR);
+
+  if (ret < 0)
+    return -errno;
+
+  u->pending -= ret;
+  return ret;
+}
+
+int uring_submit(Uring *u)
+{
+  if (!u->pending)
+    return 0;
+  return enter(u, 0);
+}
+
+int uring_wait(Uring *u, uint64_t *user_data)
+{
+  unsigned head;
+  struct io_uring_cqe *cqe;
+  int res;
+
+  head = *u->cq_head;
+  while (head == load_acquire(u->cq_tail)) {
+    res = enter(u, 1);
+    assert(res >= 0);
+  }
+
+  cqe = &u->cqes[head & *u->cq_mask];
+  *user_data = cqe->user_data;
+  res = cqe->res;
+  store_release(u->cq_head, head+1);
+
+  return res;
+}
@@ -0,0 +1,64 @@
+/*
+ *
+ *  BBP - high speed image compressor using block-wise bitpacking
+ *
+ *  Copyright (C) 2014-2015 Hendrik Siedelmann <hendrik.siedelmann@googlemail.com>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef _BBP_URING_H
+#define _BBP_URING_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * minimal io_uring wrapper using the raw syscalls (no liburing dependency),
+ * only supports what the cli needs: fixed buffer reads/writes
+ */
+
+typedef struct {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_map, *cq_map;
+  size_t sq_map_len, cq_map_len, sqes_len;
+  unsigned pending; //sqes queued but not yet submitted
+} Uring;
+
+//returns 0 on success, -errno if io_uring is not available
+int uring_init(Uring *u, unsigned entries);
+void uring_exit(Uring *u);
+int uring_register_buffers(Uring *u, struct iovec *iov, unsigned count);
+
+//queue a READ_FIXED/WRITE_FIXED, submitted with the next uring_submit()/uring_wait()
+void uring_prep_read_fixed(Uring *u, int fd, void *buf, unsigned len, uint64_t pos, int buf_idx, uint64_t user_data);
+void uring_prep_write_fixed(Uring *u, int fd, void *buf, unsigned len, uint64_t pos, int buf_idx, uint64_t user_data);
+
+int uring_submit(Uring *u);
+//submit pending sqes and wait for one completion, returns the result, user_data in \p user_data
+int uring_wait(Uring *u, uint64_t *user_data);
+
+#endif